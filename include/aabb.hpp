@@ -4,6 +4,8 @@
 #include "ray.hpp"
 #include "basic_types.hpp"
 
+#include <algorithm>
+
 class AABB {
 public:
     Point minimum;
@@ -12,37 +14,42 @@ public:
     AABB() {}
     AABB(const Point& a, const Point& b) : minimum(a), maximum(b) {}
 
-    inline bool hit(const Ray& ray, double t_min, double t_max) const {
-        auto invD = 1.0f / ray.get_direction().x();
-        auto t0 = (minimum.x() - ray.get_origin().x()) * invD;
-        auto t1 = (maximum.x() - ray.get_origin().x()) * invD;
-        if (invD < 0.0f)
-            std::swap(t0, t1);
-        t_min = t0 > t_min ? t0 : t_min;
-        t_max = t1 < t_max ? t1 : t_max;
-        if (t_max <= t_min)
-            return false;
-        invD = 1.0f / ray.get_direction().y();
-        t0 = (minimum.y() - ray.get_origin().y()) * invD;
-        t1 = (maximum.y() - ray.get_origin().y()) * invD;
-        if (invD < 0.0f)
-            std::swap(t0, t1);
-        t_min = t0 > t_min ? t0 : t_min;
-        t_max = t1 < t_max ? t1 : t_max;
-        if (t_max <= t_min)
-            return false;
-        invD = 1.0f / ray.get_direction().z();
-        t0 = (minimum.z() - ray.get_origin().z()) * invD;
-        t1 = (maximum.z() - ray.get_origin().z()) * invD;
-        if (invD < 0.0f)
-            std::swap(t0, t1);
-        t_min = t0 > t_min ? t0 : t_min;
-        t_max = t1 < t_max ? t1 : t_max;
-        if (t_max <= t_min)
-        {
-            return false;
-        }
-        return true;
+    //i为0时返回minimum，为1时返回maximum
+    inline const Point& bound(int i) const {
+        return i ? maximum : minimum;
+    }
+
+    //slab测试，用光线预先算好的方向倒数和符号直接选出每个轴上的近平面和远平面
+    //没有除法，也没有提前返回的分支，范围的上界是光线当前的t_max
+    inline bool hit(const Ray& ray, double t_min) const {
+        const Point& origin = ray.get_origin();
+        const Direction& inv = ray.get_inv_direction();
+        const int* sign = ray.get_sign();
+
+        double tx_near = (bound(sign[0]).x() - origin.x()) * inv.x();
+        double tx_far = (bound(1 - sign[0]).x() - origin.x()) * inv.x();
+        double ty_near = (bound(sign[1]).y() - origin.y()) * inv.y();
+        double ty_far = (bound(1 - sign[1]).y() - origin.y()) * inv.y();
+        double tz_near = (bound(sign[2]).z() - origin.z()) * inv.z();
+        double tz_far = (bound(1 - sign[2]).z() - origin.z()) * inv.z();
+
+        t_min = std::max(std::max(tx_near, ty_near), std::max(tz_near, t_min));
+        double t_max = std::min(std::min(tx_far, ty_far), std::min(tz_far, ray.get_t_max()));
+
+        //轴对齐的平面三角形的包围盒在一个轴上厚度为0，击中时近平面和远平面的t相等，所以要用<=
+        return t_min <= t_max;
+    }
+
+    //两个时刻的包围盒之间线性插值
+    //物体上的每个点都是线性运动时，插值的结果一定包住该时刻的物体
+    inline static AABB lerp(const AABB& box0, const AABB& box1, double t) {
+        return AABB(box0.minimum + (box1.minimum - box0.minimum) * t,
+                    box0.maximum + (box1.maximum - box0.maximum) * t);
+    }
+
+    inline bool operator==(const AABB& other) const {
+        return minimum.x() == other.minimum.x() && minimum.y() == other.minimum.y() && minimum.z() == other.minimum.z()
+            && maximum.x() == other.maximum.x() && maximum.y() == other.maximum.y() && maximum.z() == other.maximum.z();
     }
 
     inline static AABB surrounding_box(const AABB& box0, const AABB& box1) {
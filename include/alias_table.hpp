@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+//Walker/Vose别名表，按给定的权重在O(1)时间内随机选出一个下标
+//每个格子保存一个接受概率和一个别名，先均匀选格子，再决定取格子本身还是它的别名
+class AliasTable
+{
+private:
+    std::vector<double> probability;
+    std::vector<uint32_t> alias;
+
+    //归一化后的权重，也就是每个下标被选中的概率
+    std::vector<double> pmf;
+
+public:
+    AliasTable() = default;
+
+    //权重不能为负，全部为0时退化成均匀分布
+    AliasTable(const std::vector<double> &weights);
+
+    //u是[0, 1)之间的随机数
+    int sample(double u) const;
+
+    double get_pmf(int i) const
+    {
+        return pmf[i];
+    }
+
+    int size() const
+    {
+        return static_cast<int>(pmf.size());
+    }
+
+    bool empty() const
+    {
+        return pmf.empty();
+    }
+};
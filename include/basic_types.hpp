@@ -2,6 +2,11 @@
 
 #include "vector3d.hpp"
 
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
 class Direction;
 
 class Point
@@ -19,7 +24,7 @@ public:
 
     inline double z() const;
 
-    inline const Vector3d get_vector() const;
+    inline const Vector3d &get_vector() const;
 
     inline double operator[](int i) const;
 
@@ -48,15 +53,17 @@ public:
 
     inline double z() const;
 
-    inline const Vector3d get_vector() const;
+    inline const Vector3d &get_vector() const;
+
+    inline double operator[](int i) const;
 
     inline const Direction unit() const;
 
-    inline float length() const;
+    inline double length() const;
 
-    inline float length_squared() const;
+    inline double length_squared() const;
 
-    inline float dot(const Direction &d) const;
+    inline double dot(const Direction &d) const;
 
     inline const Direction cross(const Direction &d) const;
 
@@ -125,7 +132,7 @@ public:
         return vector[2];
     }
 
-    inline const Vector3d Point::get_vector() const
+    inline const Vector3d &Point::get_vector() const
     {
         return vector;
     }
@@ -167,28 +174,33 @@ public:
         return vector[2];
     }
 
-    inline const Vector3d Direction::get_vector() const
+    inline const Vector3d &Direction::get_vector() const
     {
         return vector;
     }
 
+    inline double Direction::operator[](int i) const
+    {
+        return vector[i];
+    }
+
     inline const Direction Direction::unit() const
     {
         Vector3d unit_vector = vector.unit();
         return Direction(unit_vector);
     }
 
-    inline float Direction::length() const
+    inline double Direction::length() const
     {
         return vector.length();
     }
 
-    inline float Direction::length_squared() const
+    inline double Direction::length_squared() const
     {
         return vector.length_squared();
     }
 
-    inline float Direction::dot(const Direction &d) const
+    inline double Direction::dot(const Direction &d) const
     {
         return vector.dot(d.vector);
     }
@@ -338,4 +350,46 @@ public:
     inline const Color Color::operator-(double t) const
     {
         return Color(vector - t);
-    }
\ No newline at end of file
+    }
+
+//浮点运算的误差界，n次运算后相对误差不超过gamma(n)
+inline double error_gamma(int n)
+{
+    constexpr double epsilon = std::numeric_limits<double>::epsilon() * 0.5;
+    return (n * epsilon) / (1 - n * epsilon);
+}
+
+//往正无穷或负无穷方向走一个ulp，和std::nextafter一样，但是可以内联
+inline double next_double_up(double v)
+{
+    if (std::isinf(v) && v > 0)
+    {
+        return v;
+    }
+    if (v == -0.0)
+    {
+        v = 0.0;
+    }
+    uint64_t bits;
+    std::memcpy(&bits, &v, sizeof(bits));
+    bits = (v >= 0) ? bits + 1 : bits - 1;
+    std::memcpy(&v, &bits, sizeof(bits));
+    return v;
+}
+
+inline double next_double_down(double v)
+{
+    if (std::isinf(v) && v < 0)
+    {
+        return v;
+    }
+    if (v == 0.0)
+    {
+        v = -0.0;
+    }
+    uint64_t bits;
+    std::memcpy(&bits, &v, sizeof(bits));
+    bits = (v > 0) ? bits - 1 : bits + 1;
+    std::memcpy(&v, &bits, sizeof(bits));
+    return v;
+}
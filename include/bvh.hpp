@@ -13,6 +13,12 @@ public:
     std::shared_ptr<Hittable> right;
     AABB box;
 
+    //快门打开和关闭时的包围盒，遍历时按光线的时间插值
+    //两者相同(子树里没有运动的物体)时直接用box，和静态场景的开销一样
+    AABB box0;
+    AABB box1;
+    bool moving;
+
     BVH(std::vector<std::shared_ptr<Hittable>>& objects, size_t start, size_t end) {
         auto axis = rand() % 3;
         
@@ -44,16 +50,28 @@ public:
         AABB box_right = right->bounding_box();
 
         box = AABB::surrounding_box(box_left, box_right);
+
+        box0 = AABB::surrounding_box(left->bounding_box_at(0), right->bounding_box_at(0));
+        box1 = AABB::surrounding_box(left->bounding_box_at(1), right->bounding_box_at(1));
+        moving = !(box0 == box1);
     }
 
-    virtual bool hit(const Ray& ray, double t_min, double t_max, HitRecord& rec) const override {
-        if (!box.hit(ray, t_min, t_max))
+    //左子树击中时光线的t_max已经收缩，右子树只会找更近的交点
+    virtual bool hit(const Ray& ray, double t_min, HitRecord& rec) const override {
+        if (moving)
+        {
+            if (!AABB::lerp(box0, box1, ray.get_time()).hit(ray, t_min))
+            {
+                return false;
+            }
+        }
+        else if (!box.hit(ray, t_min))
         {
             return false;
         }
 
-        bool hit_left = left->hit(ray, t_min, t_max, rec);
-        bool hit_right = right->hit(ray, t_min, hit_left ? rec.t : t_max, rec);
+        bool hit_left = left->hit(ray, t_min, rec);
+        bool hit_right = right->hit(ray, t_min, rec);
         
         return hit_left || hit_right;
     }
@@ -62,6 +80,10 @@ public:
         return box;
     }
 
+    virtual AABB bounding_box_at(double time) const override {
+        return moving ? AABB::lerp(box0, box1, time) : box;
+    }
+
 private:
 
     static bool box_x_compare(const std::shared_ptr<Hittable> a,
@@ -1,22 +1,41 @@
 #pragma once
 
+#include "alias_table.hpp"
 #include "basic_types.hpp"
+#include "hash_grid.hpp"
 #include "pdf.h"
 #include "photo_map.hpp"
 #include "ray.hpp"
 #include "hittable.hpp"
 #include "hittable_list.hpp"
+#include "irradiance_cache.hpp"
+#include "light_bvh.hpp"
+#include "path_guiding.hpp"
+#include "radiance_cache.hpp"
+#include "reservoir.hpp"
 
 #include "image.hpp"
-#include "random_generator.hpp"
+#include "sampler.hpp"
 
+#include <chrono>
 #include <memory>
+#include <unordered_map>
 
 enum Algorithm
 {
     PathTracing,
     PathTracingPDF,
-    PhotonMapping
+    PhotonMapping,
+    PathTracingNEE,
+    IrradianceCaching,
+    ReSTIR,
+    VCM,
+    MLT,
+    VPL,
+    Normals,
+    Albedo,
+    AmbientOcclusion,
+    DirectLighting
 };
 
 class Camera
@@ -52,21 +71,347 @@ private:
 
     Image image;
 
+    //每个像素实际用掉的样本数，按颜色显示
+    Image sample_heatmap;
+
     int samples_per_pixel;
     int max_depth;
 
-    RandomGenerator random_generator;
+    //采样器的类型，每次渲染按它创建采样器，frame_index作为种子，让每一帧的噪声不同
+    int sampler_type = SamplerType::Sobol;
+    uint32_t frame_index = 0;
+
+    //render_parallel每个线程一个采样器，类型、样本数和线程数不变时在多次渲染之间复用，只换种子
+    std::vector<std::unique_ptr<Sampler>> thread_samplers;
+    int thread_sampler_type = -1;
 
     std::shared_ptr<Hittable> world;
     Color background_color = Color(0, 0, 0);
     Color overflows_color = Color(255, 255, 0);
 
+    //前几次反弹不做俄罗斯轮盘赌
+    int russian_roulette_min_bounces = 3;
+
     int algorithm = Algorithm::PathTracing;
 
     std::vector<std::shared_ptr<Hittable>> lights;
+
+    //按功率选光源的别名表、光源BVH，和光源在lights中的下标，在set_world时建立
+    AliasTable light_table;
+    LightBVH light_bvh;
+    std::unordered_map<const Hittable *, int> light_indices;
+
+    //下一事件估计用光源BVH还是别名表选光源
+    bool use_light_bvh = true;
+
+    //自适应采样：整幅图像一遍一遍地渲染，每遍给还没收敛的像素adaptive_min_samples个样本，最多samples_per_pixel个
+    //误差按adaptive_tile_size大小的块估计，块内像素亮度均值的相对标准误差都低于adaptive_max_error时这个块停止
+    //只看单个像素的话，没有采到稀有亮路径的像素方差为0，会过早停止并偏暗，块内的邻居能发现这种情况
+    //比adaptive_dark_luminance暗的像素按这个亮度计算相对误差，否则全黑附近的像素永远达不到目标
+    //adaptive_min_samples为0时关闭，每个像素都用满samples_per_pixel
+    int adaptive_min_samples = 0;
+    double adaptive_max_error = 0.05;
+    double adaptive_dark_luminance = 0.5;
+    static constexpr int adaptive_tile_size = 8;
+
+    //每个像素累计的颜色、亮度的均值和离差平方和(Welford算法)以及样本数
+    struct PixelStatistics
+    {
+        Color sum = Color(0, 0, 0);
+        double mean = 0;
+        double squared_deviation = 0;
+        int samples = 0;
+    };
+    std::vector<PixelStatistics> pixel_statistics;
+
+    //每个块是否还需要继续采样
+    std::vector<char> active_tiles;
+    int tiles_x = 0;
+
+    //路径引导：pdf积分器在渲染前先用一部分样本训练SD树，学习每个位置的入射辐亮度分布，
+    //之后反弹方向一半按学到的分布采样，另一半按材质和光源采样
+    bool path_guiding = false;
+    SDTree guiding_tree;
+
+    //训练时ray_color_pdf把路径上每个顶点的入射辐亮度记录到guiding_tree
+    bool guiding_training = false;
+
+    //漫反射表面的间接光照缓存，set_world时清空，相机移动时保留
+    IrradianceCache irradiance_cache;
+
+    //计算一个缓存记录时半球在theta和phi方向上的分层数，一个记录共irradiance_theta_strata * irradiance_phi_strata条光线
+    int irradiance_theta_strata = 16;
+    int irradiance_phi_strata = 48;
+
+    //哈希辐亮度缓存：pdf和nee积分器把路径上每个非镜面顶点发出的辐亮度写入缓存，set_world时清空
+    //反弹次数达到radiance_cache_min_bounces后，落在样本数不少于radiance_cache_min_samples的格子里的路径就此结束，
+    //剩下的部分用格子的平均辐亮度代替。缓存的值又来自被缓存截断的路径，所以它逐渐包含任意多次反弹
+    bool radiance_cache_enabled = false;
+    RadianceCache radiance_cache;
+    int radiance_cache_min_bounces = 1;
+    int radiance_cache_min_samples = 16;
+
+    //一条路径最多记录的顶点数，更深的顶点不写入缓存，这样不需要分配内存
+    static constexpr int max_radiance_cache_vertices = 32;
+
+    //ReSTIR：主交点上的直接光照用蓄水池重采样(Bitterli等人的spatiotemporal reservoir resampling)
+    //每个像素先从restir_candidates个光源样本中按目标函数(不考虑遮挡时贡献的亮度)选出一个，
+    //再和重投影到上一次采样的同一表面的蓄水池、以及半径restir_spatial_radius内restir_spatial_neighbors个邻居像素的蓄水池合并。
+    //最后只为选中的样本追踪一条阴影光线，目标函数不考虑遮挡，复用的样本在这个像素被挡住时贡献为0。
+    //上一次的蓄水池的M最多算作restir_temporal_history * restir_candidates，
+    //这样过时的样本不会一直占据主导。一帧内的每个样本和相邻的两帧之间都做时间复用，自适应采样不作用于这个算法
+    int restir_candidates = 16;
+    int restir_spatial_neighbors = 5;
+    double restir_spatial_radius = 30;
+    int restir_temporal_history = 20;
+
+    //空间复用最多合并的邻居数，邻居的下标存在栈上的数组里
+    static constexpr int max_restir_spatial_neighbors = 16;
+
+    //一个像素的主交点，valid为false时主光线没有击中非镜面的表面，radiance就是整条路径的颜色
+    //valid为true时radiance是主交点上直接光照以外的部分，直接光照由蓄水池计算
+    struct PrimaryHit
+    {
+        HitRecord rec;
+        Ray ray;
+        Color radiance;
+        bool valid = false;
+    };
+    std::vector<PrimaryHit> primary_hits;
+    std::vector<PrimaryHit> previous_primary_hits;
+
+    //初始候选和时间复用之后的蓄水池，空间复用之后的蓄水池，以及上一次采样空间复用之后的蓄水池
+    std::vector<Reservoir<LightSample>> reservoirs;
+    std::vector<Reservoir<LightSample>> reused_reservoirs;
+    std::vector<Reservoir<LightSample>> previous_reservoirs;
+
+    //ReSTIR GI：主交点上的间接光照也用蓄水池重采样(Ouyang等人)，每个像素每次只追踪一条次级路径作为候选，
+    //在像素之间和采样之间复用的是这条路径的第一个交点和它发出的辐亮度。复用时按两个主交点看这个点的立体角换算，
+    //上一次的蓄水池的M最多算作restir_temporal_history。关闭时间接光照是每个像素自己的一条路径
+    //时间复用只接力时间复用之后的蓄水池，空间复用的结果不再传下去，否则雅可比行列式一次次相乘，少数像素的W会越来越大
+    bool restir_gi = false;
+    std::vector<Reservoir<PathSample>> gi_reservoirs;
+    std::vector<Reservoir<PathSample>> previous_gi_reservoirs;
+
+    //VCM(Georgiev等人的vertex connection and merging)：每次迭代先从光源发出和像素数一样多的光子路径，
+    //路径上非镜面的顶点存进哈希网格，并各自连接相机，贡献累加到所在的像素。然后每个像素追踪一条相机路径，
+    //它的每个非镜面顶点连接光源上的一个点、连接同一下标的光子路径的每个顶点，再合并半径内的光子。
+    //这些方式按幂启发式组合，MIS权重用逐个顶点递推的dVCM、dVC、dVM计算(Georgiev的技术报告)，不需要保存整条路径。
+    //合并半径在第k次迭代是vcm_radius * k^((vcm_alpha - 1) / 2)，逐渐缩小，所以结果是一致的(consistent)
+    //俄罗斯轮盘赌按顶点的颜色衰减决定继续的概率，这样两个方向的pdf都能算出来。路径在光源上结束，长度超过max_depth + 1的部分不计入
+    //没有scattering_pdf的材质(金属、玻璃)按镜面处理，路径只能穿过，不能在那里连接和合并
+    double vcm_radius = 0.05;
+    double vcm_alpha = 0.75;
+
+    //一条子路径的当前状态：下一段光线、到这里为止的throughput、线段数、是否全是镜面反射，以及MIS的递推量
+    struct VCMState
+    {
+        Ray ray;
+        Color throughput;
+        int length = 1;
+        bool specular_path = true;
+        double dVCM = 0;
+        double dVC = 0;
+        double dVM = 0;
+    };
+
+    //光子路径的一个顶点：击中记录、到达它的光线，和到达时(还没有在这里散射)的路径状态
+    struct VCMVertex
+    {
+        HitRecord rec;
+        Ray ray;
+        Color throughput;
+        int length;
+        double dVCM;
+        double dVC;
+        double dVM;
+    };
+
+    //这次迭代的光子路径顶点，第k条光子路径的顶点在vcm_path_ends[k - 1]和vcm_path_ends[k]之间
+    std::vector<VCMVertex> vcm_light_vertices;
+    std::vector<size_t> vcm_path_ends;
+    HashGrid vcm_grid;
+
+    //这次迭代的合并半径对应的MIS系数和光子的密度估计的归一化系数，见render_vcm
+    double vcm_vm_weight = 0;
+    double vcm_vc_weight = 0;
+    double vcm_vm_normalization = 0;
+
+    //主样本空间的Metropolis光传输(PSSMLT)，按路径长度多路复用(multiplexed，Hachisuka等人的MMLT)：
+    //每条马尔可夫链固定一种路径长度，链的状态是mlt_path用到的全部随机数，像素位置也由其中的前两维决定
+    //先用每种长度mlt_bootstrap条独立的路径自举，它们的平均亮度之和就是整幅图像的亮度，用来归一化；
+    //再按自举路径的亮度选出mlt_chains条链的起点，所有链一共变异samples_per_pixel * 像素数次
+    //链按亮度的比值接受变异，所以样本集中在亮的路径上，难以找到的光路(比如穿过玻璃的焦散)一旦找到就会被反复探索
+    double mlt_sigma = 0.01;
+    double mlt_large_step_probability = 0.3;
+    int mlt_bootstrap = 100000;
+    int mlt_chains = 1024;
+
+    //虚拟点光源(Keller的instant radiosity)：从光源发出vpl_paths条光子路径，路径上每个非镜面的顶点是一个虚拟点光源
+    //相机光线在镜面之后的第一个漫反射表面上，直接光照用光源采样，间接光照按功率从虚拟点光源中随机选vpl_samples个，各用一条阴影光线连接
+    //几何项cos * cos / d^2在虚拟点光源附近趋于无穷，会产生亮斑，所以限制在vpl_geometry_clamp以内，损失的是离得很近的表面之间的一小部分能量
+    //光源和场景不动时虚拟点光源不变，只在set_world之后第一次渲染时生成，相机移动时继续使用
+    int vpl_paths = 256;
+    int vpl_samples = 8;
+    double vpl_geometry_clamp = 20;
+
+    //虚拟点光源所在的顶点、到达它的光线，power是到达时光子路径的throughput除以光子路径的条数
+    struct VirtualPointLight
+    {
+        HitRecord rec;
+        Ray ray;
+        Color power;
+    };
+
+    std::vector<VirtualPointLight> vpls;
+    AliasTable vpl_table;
+    bool vpls_valid = false;
+
+    //环境光遮蔽的预览在主交点上按余弦分布发出ao_samples条长度为ao_radius的光线，亮度是没有被挡住的比例
+    int ao_samples = 4;
+    double ao_radius = 0.5;
+
+    //上一次采样时的视口，用来把主交点重投影到上一次的像素，set_world之后失效
+    Point previous_center;
+    Point previous_pixel00_center;
+    Direction previous_pixel_delta_u;
+    Direction previous_pixel_delta_v;
+    bool restir_history_valid = false;
 private:
     //更新视口， 在相机平移或者旋转后，根据新的相机位置和方向更新视口
     void update_viewport();
+
+    //输出渲染耗时和吞吐量，total_samples是所有像素实际用掉的样本数
+    void report_render_stats(std::chrono::steady_clock::time_point start_time, long long total_samples, long long total_bounces) const;
+
+    //清空像素的累计值，返回第一遍每个像素的样本数
+    int begin_passes();
+
+    //准备好thread_samplers，渲染过程中不再分配内存
+    void prepare_thread_samplers(int num_threads, uint32_t seed);
+
+    //估计每个块的误差，返回下一遍每个像素的样本数，全部收敛或者达到上限时返回0
+    int next_pass();
+
+    //像素(i, j)是否还需要样本
+    bool pixel_active(int i, int j) const;
+
+    //给像素(i, j)再追踪最多count个样本，samples和bounces累加用掉的样本数和反弹次数
+    void render_pixel(int i, int j, int count, Sampler &sampler, long long &samples, long long &bounces);
+
+    //把累计的平均颜色和样本数写入图像和热力图
+    void resolve_image();
+
+    //按当前的算法追踪一条相机光线
+    Color trace_path(const Ray &ray, Sampler &sampler, int &bounces);
+
+    //用ReSTIR渲染，每个样本先对所有像素生成蓄水池，再对所有像素做空间复用和着色
+    void render_restir(bool parallel);
+
+    //像素(i, j)的第s个样本的主光线、初始候选、时间复用和主交点之外的间接光照，bounces累加反弹次数
+    void restir_initial_pass(int i, int j, Sampler &sampler, long long &bounces);
+
+    //像素index的次级路径候选和时间复用，previous_index是重投影到的上一次的像素，没有时为-1
+    void restir_gi_initial_pass(size_t index, const Ray &scattered, int64_t previous_index, Sampler &sampler, int &bounces);
+
+    //像素(i, j)的空间复用，返回这个样本的颜色
+    Color restir_spatial_pass(int i, int j, Sampler &sampler);
+
+    //像素(i, j)的次级路径的空间复用，返回主交点上的间接光照
+    Color restir_gi_spatial_pass(int i, int j, Sampler &sampler);
+
+    //sample在主交点hit处不考虑遮挡时的直接光照contribution，返回它的亮度作为目标函数
+    double restir_target(const PrimaryHit &hit, const LightSample &sample, Color &contribution) const;
+
+    //主交点hit和光源上的sample之间有没有遮挡
+    bool restir_visible(const PrimaryHit &hit, const LightSample &sample) const;
+
+    //次级路径sample在主交点hit处的间接光照contribution，返回它的亮度作为目标函数
+    double restir_gi_target(const PrimaryHit &hit, const PathSample &sample, Color &contribution) const;
+
+    //把from处生成的次级路径换到to处时，to的立体角相对于from的立体角的雅可比行列式，不能复用时返回0
+    double restir_gi_jacobian(const PrimaryHit &from, const PrimaryHit &to, const PathSample &sample) const;
+
+    //主交点hit和次级路径的第一个交点之间有没有遮挡
+    bool restir_gi_visible(const PrimaryHit &hit, const PathSample &sample) const;
+
+    //两个主交点是否在同一个表面附近，可以互相复用蓄水池
+    bool restir_similar(const PrimaryHit &hit, const PrimaryHit &other) const;
+
+    //p在上一次采样的视口中所在的像素，不在视口内时返回false
+    bool reproject(const Point &p, int &i, int &j) const;
+
+    //用VCM渲染，每次迭代先追踪所有光子路径并建立哈希网格，再追踪所有相机路径
+    void render_vcm(bool parallel);
+
+    //从光源发出一条光子路径，非镜面的顶点追加到vertices，连接相机的贡献累加到splats
+    void vcm_light_path(Sampler &sampler, std::vector<VCMVertex> &vertices, std::vector<Color> &splats) const;
+
+    //像素(i, j)的相机路径，index是和它连接的光子路径，返回这个样本的颜色，bounces累加反弹次数
+    Color vcm_camera_path(int i, int j, size_t index, Sampler &sampler, long long &bounces) const;
+
+    //按scatter已经采样的方向继续路径，更新throughput和MIS的递推量，被俄罗斯轮盘赌终止时返回false
+    bool vcm_scatter(const HitRecord &rec, const ScatterRecord &srec, VCMState &state, Sampler &sampler) const;
+
+    //rec处从ray_in散射到direction的BSDF，cos_theta是direction和法线夹角余弦的绝对值
+    //pdf和reverse_pdf是材质朝direction和反过来朝ray_in的来向采样的概率密度，都乘了继续的概率
+    Color vcm_evaluate(const HitRecord &rec, const Ray &ray_in, const Direction &direction,
+                       double &cos_theta, double &pdf, double &reverse_pdf) const;
+
+    //相机路径击中光源rec时发光的MIS权重
+    double vcm_emission_weight(const HitRecord &rec, const VCMState &state) const;
+
+    //相机路径的顶点rec连接光源上随机的一个点，返回不乘throughput的贡献
+    Color vcm_direct_light(const HitRecord &rec, const VCMState &state, Sampler &sampler) const;
+
+    //相机路径的顶点rec连接光子路径的顶点vertex，返回不乘两边throughput的贡献
+    Color vcm_connect(const HitRecord &rec, const VCMState &state, const VCMVertex &vertex) const;
+
+    //光子路径的顶点vertex连接相机，贡献累加到splats中它所在的像素
+    void vcm_connect_camera(const VCMVertex &vertex, std::vector<Color> &splats) const;
+
+    //用多路复用的PSSMLT渲染，先自举，再并行地运行各条马尔可夫链
+    void render_mlt(bool parallel);
+
+    //长度恰好为length(线段数)的路径的贡献，(i, j)是它落在的像素，bounces累加追踪的光线数
+    Color mlt_path(Sampler &sampler, int length, int &i, int &j, long long &bounces) const;
+
+    //虚拟点光源无效时重新从光源发出光子路径生成
+    void trace_vpls();
+
+    //rec处由随机选出的虚拟点光源得到的间接光照，不乘throughput
+    Color estimate_vpl_light(const Ray &ray_in, const HitRecord &rec, Sampler &sampler) const;
+
+    //用样本数1, 2, 4...的若干遍渲染训练路径引导，总共不超过samples_per_pixel的四分之一，返回用掉的每像素样本数
+    int train_path_guiding(bool parallel);
+
+    //像素(i, j)的一条相机光线，像素内的位置和快门时间从sampler取
+    Ray get_ray(int i, int j, Sampler &sampler) const;
+
+    //在着色点p、法线n处用随机数u选一个光源，返回它的下标，pmf是选中它的概率
+    int sample_light(const Point &p, const Direction &n, double u, double &pmf) const;
+
+    //在o、n处选中光源object，再从o沿direction采样到它的概率密度
+    double light_pdf(const Hittable *object, const Point &o, const Direction &n, const Direction &direction) const;
+
+    //在非镜面的rec处选一个光源并对它采样，返回不乘throughput的直接光照
+    //mis为true时用幂启发式和材质采样击中光源的路径结合，为false时光源采样单独负责全部直接光照
+    Color estimate_direct_light(const Ray &ray_in, const HitRecord &rec, const Hittable &world, Sampler &sampler, bool mis) const;
+
+    //从光源发出一条光线，emitted是光源的发光颜色，direct_pdf是起点的面积测度的pdf，emission_pdf再乘上方向的立体角测度的pdf
+    //cos_light是光线和光源法线夹角的余弦，没有光源或者采样失败时返回false
+    bool sample_emission(Sampler &sampler, Ray &ray, Color &emitted, double &direct_pdf, double &emission_pdf, double &cos_light) const;
+
+    //在rec处用分层的余弦半球采样计算一个辐照度缓存记录，只包含间接光照，depth是半球光线的最大深度
+    IrradianceRecord compute_irradiance_record(const HitRecord &rec, double time, int depth, const Hittable &world, Sampler &sampler);
+
+    //在第bounce次反弹的rec处查询辐亮度缓存，cell返回rec所在的格子，没有开启缓存或者rec是镜面时是-1
+    //路径可以在这里结束时返回true，cached是格子的平均辐亮度
+    bool lookup_radiance_cache(const HitRecord &rec, int bounce, int64_t &cell, Color &cached);
+
+    //俄罗斯轮盘赌，路径被终止时返回false，存活时放大throughput
+    //不论是否需要都从sampler取一维，让之后的维度在不同路径间保持对齐
+    bool russian_roulette(Color &throughput, int bounce, Sampler &sampler) const;
 public:
 
     Camera(double aspect_ratio, int image_width, int samples_per_pixel = 100, int max_depth = 10, Point center = Point(0, 1, 0));
@@ -92,6 +437,41 @@ public:
     //设置算法
     void set_algorithm(int algorithm);
 
+    //下一事件估计是否用光源BVH选光源，关闭时按功率用别名表选
+    void set_light_bvh(bool enabled);
+
+    //pdf积分器是否使用路径引导，训练的样本算在samples_per_pixel之内
+    void set_path_guiding(bool enabled);
+
+    //pdf和nee积分器是否使用哈希辐亮度缓存，capacity是哈希表的大小，cell_size是格子在世界空间中的边长
+    //会清空缓存，关闭时释放哈希表
+    void set_radiance_cache(bool enabled, size_t capacity = 1 << 18, double cell_size = 0.25);
+
+    //ReSTIR算法是否也对主交点上的间接光照做蓄水池重采样
+    void set_restir_gi(bool enabled);
+
+    //VCM合并光子的初始半径(世界空间)，和每次迭代半径缩小的速度，alpha越小缩小得越快
+    void set_vcm_radius(double radius, double alpha = 0.75);
+
+    //MLT小步变异的标准差，和每次变异是大步(所有维度重新均匀采样)的概率
+    void set_mlt_mutation(double sigma, double large_step_probability = 0.3);
+
+    //虚拟点光源的光子路径条数，和每个着色点随机连接的虚拟点光源个数，修改后下一次渲染重新生成
+    void set_vpl(int paths, int samples = 8);
+
+    //环境光遮蔽预览每个样本的光线数和光线的长度
+    void set_ambient_occlusion(int samples, double radius);
+
+    //设置采样器的类型，见SamplerType
+    void set_sampler(int sampler_type);
+
+    //设置每个像素的样本数，开启自适应采样时是样本数的上限
+    void set_samples_per_pixel(int samples_per_pixel);
+
+    //开启自适应采样，min_samples是每个像素的最少样本数，也是每一遍的样本数，
+    //取2的幂时Sobol采样器每次停下来的样本仍然是分层的；max_error是目标相对误差，min_samples为0时关闭
+    void set_adaptive_sampling(int min_samples, double max_error = 0.05);
+
     //渲染
     void render();
 
@@ -104,15 +484,31 @@ public:
     //光子映射渲染
     void render_photons(Photomap &photomap);
 
-    //获取像素颜色
-    Color ray_color(const Ray &ray, int depth, const Hittable &world);
+    //获取像素颜色，bounces返回这条路径的反弹次数
+    Color ray_color(const Ray &ray, int depth, const Hittable &world, Sampler &sampler, int &bounces);
 
     //获取像素颜色pdf
-    Color ray_color_pdf(const Ray &ray, int depth, const Hittable &world);
+    Color ray_color_pdf(const Ray &ray, int depth, const Hittable &world, Sampler &sampler, int &bounces);
+
+    //获取像素颜色，每个顶点对光源直接采样，并用多重重要性采样和材质采样结合
+    Color ray_color_nee(const Ray &ray, int depth, const Hittable &world, Sampler &sampler, int &bounces);
+
+    //获取像素颜色，镜面反射之后的第一个漫反射表面上直接光照用光源采样，间接光照从辐照度缓存插值
+    Color ray_color_irradiance_cache(const Ray &ray, int depth, const Hittable &world, Sampler &sampler, int &bounces);
+
+    //获取像素颜色，镜面反射之后的第一个漫反射表面上直接光照用光源采样，间接光照由虚拟点光源照亮
+    Color ray_color_vpl(const Ray &ray, int depth, const Hittable &world, Sampler &sampler, int &bounces);
+
+    //移动相机时用的快速预览：Normals显示主交点的法线，Albedo显示镜面之后第一个漫反射表面的颜色，
+    //AmbientOcclusion显示主交点的环境光遮蔽，DirectLighting只在镜面之后第一个漫反射表面上用一个光源样本计算直接光照
+    Color ray_color_preview(const Ray &ray, int depth, const Hittable &world, Sampler &sampler, int &bounces);
 
     //获取像素颜色光子映射
-    Color ray_color_photons(const Ray &ray, int depth, const Hittable &world, Photomap &photomap);
+    Color ray_color_photons(const Ray &ray, int depth, const Hittable &world, Sampler &sampler, Photomap &photomap);
 
     //以ppm格式写入图像
     void write_image(std::ostream &out) const;
+
+    //以ppm格式写入上一次渲染每个像素的样本数，蓝色最少，红色是samples_per_pixel
+    void write_sample_heatmap(std::ostream &out) const;
 };
\ No newline at end of file
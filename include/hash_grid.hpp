@@ -0,0 +1,84 @@
+#pragma once
+
+#include "basic_types.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+//查询半径固定的点集哈希网格，VCM每次迭代用它找到着色点附近的光子(光子路径的顶点)
+//格子的边长是半径的两倍，所以半径内的点只可能在离查询点最近的2 x 2 x 2个格子里
+//格子坐标哈希到和点数一样多的桶里，点的下标按桶排好序(计数排序)，每个桶是其中连续的一段
+class HashGrid
+{
+private:
+    std::vector<Point> points;
+
+    //按桶排序的点的下标，桶b的点是indices[cell_ends[b - 1], cell_ends[b])
+    std::vector<uint32_t> indices;
+    std::vector<uint32_t> cell_ends;
+
+    Point minimum;
+    double radius = 0;
+    double radius_squared = 0;
+    double inverse_cell_size = 0;
+
+    uint32_t cell_index(int64_t x, int64_t y, int64_t z) const;
+
+public:
+    //重新建立网格，points会被复制，不是线程安全的
+    void build(const std::vector<Point> &points, double radius);
+
+    double get_radius() const
+    {
+        return radius;
+    }
+
+    //对和p的距离不超过半径的每个点调用visit(点的下标)，可以在多个线程里同时查询
+    template <typename Visit>
+    void query(const Point &p, Visit &&visit) const
+    {
+        if (cell_ends.empty())
+        {
+            return;
+        }
+
+        //p所在的格子，和每个轴上离p更近的那个相邻格子
+        Direction offset = (p - minimum) * inverse_cell_size;
+        int64_t base[3];
+        int64_t neighbor[3];
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            double coordinate = offset[axis];
+            base[axis] = static_cast<int64_t>(std::floor(coordinate));
+            neighbor[axis] = base[axis] + (coordinate - base[axis] < 0.5 ? -1 : 1);
+        }
+
+        //不同的格子可能哈希到同一个桶，同一个桶只访问一次
+        uint32_t visited[8];
+        int visited_count = 0;
+        for (int k = 0; k < 8; ++k)
+        {
+            uint32_t cell = cell_index((k & 1) ? neighbor[0] : base[0], (k & 2) ? neighbor[1] : base[1], (k & 4) ? neighbor[2] : base[2]);
+            bool seen = false;
+            for (int v = 0; v < visited_count; ++v)
+            {
+                seen = seen || visited[v] == cell;
+            }
+            if (seen)
+            {
+                continue;
+            }
+            visited[visited_count++] = cell;
+
+            uint32_t begin = cell > 0 ? cell_ends[cell - 1] : 0;
+            for (uint32_t i = begin; i < cell_ends[cell]; ++i)
+            {
+                if ((points[indices[i]] - p).length_squared() <= radius_squared)
+                {
+                    visit(indices[i]);
+                }
+            }
+        }
+    }
+};
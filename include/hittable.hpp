@@ -4,14 +4,17 @@
 #include "aabb.hpp"
 #include "ray.hpp"
 
+#include <cmath>
 #include <memory>
 
-class RandomGenerator;
+class Sampler;
 
 class PDF;
 
 class Material;
 
+class Hittable;
+
 class HitRecord {
 public:
     Point p;
@@ -19,21 +22,117 @@ public:
     double t;
     std::shared_ptr<Material> material;
     std::shared_ptr<PDF> pdf;
+
+    //击中的图元，用来判断阴影光线击中的是不是采样的那个光源
+    const Hittable *object = nullptr;
+
+    //p每个分量的绝对误差上界，由各个hit()根据自己的计算过程给出
+    Direction p_error;
+
+    //几何法线，用来偏移光线起点
+    //normal可能是插值得到的着色法线，和真实的表面不一定垂直
+    Direction geometric_normal;
+
+    //把交点沿几何法线推到误差范围之外，推向w所在的一侧
+    //从这里出发的光线不会再和交点所在的表面相交，所以t_min可以是0
+    inline Point spawn_origin(const Direction &w) const
+    {
+        double d = std::fabs(geometric_normal.x()) * p_error.x()
+                 + std::fabs(geometric_normal.y()) * p_error.y()
+                 + std::fabs(geometric_normal.z()) * p_error.z();
+
+        Direction offset = geometric_normal * d;
+        if (w.dot(geometric_normal) < 0)
+        {
+            offset = -offset;
+        }
+
+        Point origin = p + offset;
+
+        //加法本身也会舍入，再往偏移的方向多走一个ulp
+        double e[3];
+        for (int i = 0; i < 3; ++i)
+        {
+            e[i] = origin[i];
+            if (offset[i] > 0)
+            {
+                e[i] = next_double_up(e[i]);
+            }
+            else if (offset[i] < 0)
+            {
+                e[i] = next_double_down(e[i]);
+            }
+        }
+
+        return Point(e[0], e[1], e[2]);
+    }
+
+    //t_max是求交范围的上界，阴影光线传到光源的距离
+    inline Ray spawn_ray(const Direction &w, double time, double t_max = std::numeric_limits<double>::infinity()) const
+    {
+        Ray ray(spawn_origin(w), w, t_max);
+        ray.set_time(time);
+        return ray;
+    }
 };
 
 class Hittable {
 public:
-    virtual bool hit(const Ray &ray, double t_min, double t_max, HitRecord &rec) const = 0;
+    //求交范围是(t_min, ray.get_t_max()]，击中时把光线的t_max收缩到交点，后面的物体只需要找更近的交点
+    virtual bool hit(const Ray &ray, double t_min, HitRecord &rec) const = 0;
 
     virtual AABB bounding_box() const = 0;
 
+    //某个快门时间的包围盒，静止的物体就是bounding_box()
+    //运动的物体在bounding_box()中返回整个快门时间内的包围盒
+    virtual AABB bounding_box_at(double /*time*/) const
+    {
+        return bounding_box();
+    }
+
     virtual double pdf_value(const Point &o, const Direction &v) const 
     {
         return 0.0;
     }
 
-    virtual Point random(RandomGenerator &random_generator) const
+    virtual Point random(Sampler &sampler) const
     {
         return Point(0, 0, 0);
     }
+
+    //在表面上按面积均匀取一个点，normal返回那里的几何法线(球朝外，三角形按顶点顺序)，VCM从光源发出光线时用
+    //默认用random取点，法线未知时是0
+    virtual Point sample_area(Sampler &sampler, Direction &normal) const
+    {
+        normal = Direction(0, 0, 0);
+        return random(sampler);
+    }
+
+    //从o出发采样一个指向物体的方向，同时给出它在立体角上的pdf，和pdf_value(o, 方向)一致
+    //默认在表面上取一个点，再用pdf_value计算pdf
+    virtual Direction sample_direction(const Point &o, Sampler &sampler, double &pdf) const
+    {
+        Direction direction = random(sampler) - o;
+        pdf = pdf_value(o, direction);
+        return direction;
+    }
+
+    //表面积和材质，用来估计光源的功率
+    virtual double area() const
+    {
+        return 0.0;
+    }
+
+    virtual std::shared_ptr<Material> get_material() const
+    {
+        return nullptr;
+    }
+
+    //作为光源时发光方向的范围，发光方向都在以axis为轴、半角余弦为cos_theta的圆锥内
+    //默认是整个球面
+    virtual void emission_cone(Direction &axis, double &cos_theta) const
+    {
+        axis = Direction(0, 0, 1);
+        cos_theta = -1;
+    }
 };
\ No newline at end of file
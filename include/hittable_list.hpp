@@ -19,7 +19,9 @@ public:
 
     void add(std::shared_ptr<Hittable> object);
 
-    bool hit(const Ray &ray, double t_min, double t_max, HitRecord &rec) const override;
+    bool hit(const Ray &ray, double t_min, HitRecord &rec) const override;
 
     AABB bounding_box() const override;
+
+    AABB bounding_box_at(double time) const override;
 };
\ No newline at end of file
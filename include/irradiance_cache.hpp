@@ -0,0 +1,69 @@
+#pragma once
+
+#include "aabb.hpp"
+#include "basic_types.hpp"
+
+#include <memory>
+#include <shared_mutex>
+#include <vector>
+
+//一个缓存的辐照度样本(Ward的irradiance caching)
+//radius是采样时半球光线击中距离的调和平均，表示辐照度在这附近变化的快慢
+//梯度按Ward和Heckbert的方法从同一组半球样本估计，每个颜色通道一个，用来把辐照度外推到附近的点和法线
+class IrradianceRecord
+{
+public:
+    Point position;
+    Direction normal;
+    Color irradiance;
+    double radius = 0;
+
+    Direction translation_gradient[3];
+    Direction rotation_gradient[3];
+
+    //外推到位置p、法线n处的辐照度
+    Color extrapolate(const Point &p, const Direction &n) const;
+};
+
+//世界空间的八叉树，每个记录放在包含它、且边长的一半不小于它有效半径的最深的节点里
+//查询时只需要进入扩大了自身半边长之后仍然包含查询点的子节点
+//渲染时多个线程同时查询和插入，查询共享读锁，插入独占写锁，新记录在锁外计算
+//缓存的是和视点无关的辐照度，相机移动后仍然有效，只在场景改变时清空
+class IrradianceCache
+{
+private:
+    struct Node
+    {
+        Point center;
+        double half_size;
+        std::vector<IrradianceRecord> records;
+        std::unique_ptr<Node> children[8];
+
+        Node(const Point &center, double half_size) : center(center), half_size(half_size) {}
+    };
+
+    std::unique_ptr<Node> root;
+    mutable std::shared_mutex mutex;
+    size_t record_count = 0;
+
+    //有效区域的误差阈值a：|p - p_i| / R_i + sqrt(1 - n·n_i) < a的记录才参与插值
+    double accuracy;
+
+    //记录半径的上下限，太小时缓存过密，太大时会把光照的细节抹掉
+    double min_radius;
+    double max_radius;
+
+public:
+    explicit IrradianceCache(double accuracy = 0.3, double min_radius = 0.05, double max_radius = 2.0);
+
+    //清空缓存，bounds是场景的包围盒
+    void reset(const AABB &bounds);
+
+    //用附近的有效记录插值p、n处的辐照度，没有有效的记录时返回false
+    bool lookup(const Point &p, const Direction &n, Color &irradiance) const;
+
+    //限制记录的半径后插入，线程安全
+    void insert(IrradianceRecord record);
+
+    size_t size() const;
+};
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "aabb.hpp"
+#include "basic_types.hpp"
+#include "hittable.hpp"
+
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <vector>
+
+//一组光源的范围：包围盒、总功率，以及发光方向的圆锥
+//所有发光方向都在以axis为轴、半角余弦为cos_theta_o的圆锥内，
+//每个方向再向外最多偏cos_theta_e(面光源是90度)
+//这个项目里的光源都是双面发光的，所以计算时方向取绝对值
+class LightBounds
+{
+public:
+    AABB bounds;
+    double phi = 0;
+    Direction axis = Direction(0, 0, 1);
+    double cos_theta_o = 1;
+    double cos_theta_e = 1;
+
+    LightBounds() = default;
+    LightBounds(const AABB &bounds, double phi, const Direction &axis, double cos_theta_o, double cos_theta_e)
+        : bounds(bounds), phi(phi), axis(axis), cos_theta_o(cos_theta_o), cos_theta_e(cos_theta_e) {}
+
+    //对位置p、法线n处的着色点，这组光源贡献的上界
+    double importance(const Point &p, const Direction &n) const;
+
+    static LightBounds merge(const LightBounds &a, const LightBounds &b);
+};
+
+//光源的层次包围体
+//叶子是单个光源，内部节点保存子树的LightBounds
+//采样时从根开始，按两个子节点的importance随机选一个往下走，
+//所以选中某个光源的概率可以沿同样的路径重新算出来，用于MIS
+class LightBVH
+{
+private:
+    struct Node
+    {
+        LightBounds light_bounds;
+
+        //内部节点：左孩子是下一个节点，右孩子的下标是child_or_light
+        //叶子：child_or_light是光源的下标
+        uint32_t child_or_light;
+        bool is_leaf;
+
+        //根节点的parent是-1
+        int parent;
+    };
+
+    std::vector<Node> nodes;
+
+    //每个光源所在的叶子，功率为0的光源不在树里，记为-1
+    //计算pmf时从叶子往根走，把每一层选中这个孩子的概率乘起来
+    std::vector<int> light_to_leaf;
+
+    struct BuildLight
+    {
+        int index;
+        LightBounds light_bounds;
+        Point centroid;
+    };
+
+    int build(std::vector<BuildLight> &build_lights, int begin, int end, int parent);
+
+    //按表面积、方向范围和功率估计一个子树的代价，用来选择分割位置
+    static double evaluate_cost(const LightBounds &b, const AABB &bounds, int axis);
+
+public:
+    LightBVH() = default;
+
+    //powers[i]是lights[i]的功率
+    LightBVH(const std::vector<std::shared_ptr<Hittable>> &lights, const std::vector<double> &powers);
+
+    //按着色点p、法线n选一个光源，返回光源下标，pmf是选中它的概率
+    //所有光源的贡献都为0时返回-1
+    int sample(const Point &p, const Direction &n, double u, double &pmf) const;
+
+    //在p、n处选中第light个光源的概率
+    double pmf(const Point &p, const Direction &n, int light) const;
+
+    bool empty() const
+    {
+        return nodes.empty();
+    }
+};
@@ -4,7 +4,7 @@
 #include "ray.hpp"
 #include "hittable.hpp"
 
-#include "random_generator.hpp"
+#include "sampler.hpp"
 #include <sstream>
 
 class ScatterRecord{
@@ -17,18 +17,51 @@ public:
 class Material
 {
 protected:
-    static RandomGenerator random_generator;
     Color light_color;
 public:
-    virtual void scatter(const Ray &ray_in, const HitRecord &rec, ScatterRecord &srec) const = 0;
+    //散射用到的随机数都从sampler取，这样材质的采样也能分层
+    //固定用3维：先2D采样方向，再1D选择反射或折射，用不到的维度要跳过
+    virtual void scatter(const Ray &ray_in, const HitRecord &rec, ScatterRecord &srec, Sampler &sampler) const = 0;
 
     //负责重要性采样时的pdf计算
     virtual double scattering_pdf(const Ray &ray_in, const HitRecord &rec, const Ray &scattered) const
     {
         return 0;
     }
+
+    //BSDF乘以出射方向和法线夹角的余弦(f * cos)，颜色按[0, 1]计算
+    //漫反射材质的f * cos正好是albedo乘以scattering_pdf，光泽材质两者的比值随方向变化，所以需要单独计算
+    virtual Color evaluate(const Ray &, const HitRecord &, const Ray &) const
+    {
+        return Color(0, 0, 0);
+    }
+
+    //和方向无关的颜色(0到255)，scatter给出的颜色衰减随方向变化时用它估计材质整体反射多少光，玻璃是白色
+    virtual Color get_albedo() const
+    {
+        return Color(255, 255, 255);
+    }
     
+    //没有scattering_pdf的材质(金属、玻璃)按镜面处理，不能对光源直接采样
+    virtual bool is_specular() const
+    {
+        return true;
+    }
+
+    //出射辐亮度和观察方向无关(理想漫反射)，只有这样的表面上才能按位置和法线缓存或复用辐照度、辐亮度
+    //光泽材质不是镜面，但也不满足这一点
+    virtual bool is_diffuse() const
+    {
+        return false;
+    }
+
     void set_light_color(const Color &light_color);
+
+    //不散射，只查询自发光，给阴影光线用
+    Color emitted() const
+    {
+        return light_color;
+    }
 };
 
 class Lambertian : public Material
@@ -37,8 +70,21 @@ private:
     Color albedo;
 public:
     Lambertian(const Color &albedo) : albedo(albedo) {}
-    virtual void scatter(const Ray &ray_in, const HitRecord &rec, ScatterRecord &srec) const override;
+    virtual void scatter(const Ray &ray_in, const HitRecord &rec, ScatterRecord &srec, Sampler &sampler) const override;
     virtual double scattering_pdf(const Ray &ray_in, const HitRecord &rec, const Ray &scattered) const override;
+    virtual Color evaluate(const Ray &ray_in, const HitRecord &rec, const Ray &scattered) const override;
+    virtual Color get_albedo() const override
+    {
+        return albedo;
+    }
+    virtual bool is_specular() const override
+    {
+        return false;
+    }
+    virtual bool is_diffuse() const override
+    {
+        return true;
+    }
 };
 
 class Metal : public Material
@@ -49,7 +95,11 @@ private:
     static Direction reflect(const Direction &v, const Direction &n);
 public:
     Metal(const Color &albedo, double fuzz) : albedo(albedo), fuzz(fuzz) {}
-    virtual void scatter(const Ray &ray_in, const HitRecord &rec, ScatterRecord &srec) const override;
+    virtual void scatter(const Ray &ray_in, const HitRecord &rec, ScatterRecord &srec, Sampler &sampler) const override;
+    virtual Color get_albedo() const override
+    {
+        return albedo;
+    }
 };
 
 class Dielectric : public Material
@@ -61,5 +111,49 @@ private:
     static double schlick(double cosine, double refraction_index);
 public:
     Dielectric(double refraction_index) : refraction_index(refraction_index) {}
-    virtual void scatter(const Ray &ray_in, const HitRecord &rec, ScatterRecord &srec) const override;
+    virtual void scatter(const Ray &ray_in, const HitRecord &rec, ScatterRecord &srec, Sampler &sampler) const override;
+};
+
+//GGX(Trowbridge-Reitz)微表面导体，albedo是法向入射时的反射率，Fresnel项用Schlick近似
+//roughness在0到1之间，alpha = roughness^2，按可见法线的分布采样(Heitz 2018)，
+//所以scatter给出的颜色衰减F * G2 / G1不超过albedo，scattering_pdf是精确的采样pdf，evaluate是解析的f * cos
+//从背面看时按另一面处理，和三角形翻转后的法线一致
+class GGXMetal : public Material
+{
+private:
+    Color albedo;
+    double alpha;
+public:
+    GGXMetal(const Color &albedo, double roughness);
+    virtual void scatter(const Ray &ray_in, const HitRecord &rec, ScatterRecord &srec, Sampler &sampler) const override;
+    virtual double scattering_pdf(const Ray &ray_in, const HitRecord &rec, const Ray &scattered) const override;
+    virtual Color evaluate(const Ray &ray_in, const HitRecord &rec, const Ray &scattered) const override;
+    virtual Color get_albedo() const override
+    {
+        return albedo;
+    }
+    virtual bool is_specular() const override
+    {
+        return false;
+    }
+};
+
+//GGX微表面电介质(Walter等人的粗糙玻璃)，按可见法线采样一个微表面法线，再按精确的Fresnel项选择反射或折射
+//和Dielectric一样，光线和法线同向时认为从内部射出
+//折射的BSDF乘的是两侧折射率的乘积而不是出射一侧折射率的平方，交换wo和wi时不变，光子路径和相机路径可以用同一个BSDF
+//穿过封闭物体的路径进出各一次，结果和不考虑辐亮度压缩的Dielectric一样
+class GGXDielectric : public Material
+{
+private:
+    double refraction_index;
+    double alpha;
+public:
+    GGXDielectric(double refraction_index, double roughness);
+    virtual void scatter(const Ray &ray_in, const HitRecord &rec, ScatterRecord &srec, Sampler &sampler) const override;
+    virtual double scattering_pdf(const Ray &ray_in, const HitRecord &rec, const Ray &scattered) const override;
+    virtual Color evaluate(const Ray &ray_in, const HitRecord &rec, const Ray &scattered) const override;
+    virtual bool is_specular() const override
+    {
+        return false;
+    }
 };
\ No newline at end of file
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "hittable.hpp"
+#include "material.hpp"
+#include "basic_types.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+//网格顶点的存储格式
+//FullPrecision: 每个顶点保存完整的Point和Direction
+//Quantized16: 位置按网格包围盒量化为3个16位整数，法线用八面体映射编码为2个16位整数
+enum VertexFormat
+{
+    FullPrecision,
+    Quantized16
+};
+
+//三角形网格，顶点和索引共享存储，内部有自己的BVH
+//和把每个三角形都做成一个Triangle相比，不需要为每个三角形分配一个对象
+class Mesh : public Hittable
+{
+private:
+    struct QuantizedVertex
+    {
+        uint16_t position[3];
+        int16_t normal[2];
+    };
+
+    //扁平的BVH节点，count为0时是内部节点，右孩子下标是first，左孩子紧跟在当前节点后面
+    struct Node
+    {
+        AABB box;
+        uint32_t first;
+        uint32_t count;
+    };
+
+    VertexFormat format;
+
+    std::vector<Point> positions;
+    std::vector<Direction> normals;
+    std::vector<QuantizedVertex> quantized;
+
+    std::vector<uint32_t> indices;
+    std::vector<Node> nodes;
+
+    AABB box;
+    Direction quantize_scale;
+
+    std::shared_ptr<Material> material;
+
+    uint32_t build(std::vector<uint32_t> &triangles, std::vector<Point> &centroids, uint32_t start, uint32_t end);
+
+    Point vertex_position(uint32_t i) const;
+    Direction vertex_normal(uint32_t i) const;
+
+    static void encode_octahedral(const Direction &n, int16_t out[2]);
+    static Direction decode_octahedral(const int16_t in[2]);
+
+public:
+    Mesh(const std::vector<Point> &positions, const std::vector<Direction> &normals, const std::vector<uint32_t> &indices,
+         std::shared_ptr<Material> material, VertexFormat format = VertexFormat::FullPrecision);
+
+    //从obj文件加载网格，先缩放再平移
+    static std::shared_ptr<Mesh> load_obj(const std::string &path, std::shared_ptr<Material> material,
+                                          double scale = 1.0, const Direction &offset = Direction(0, 0, 0),
+                                          VertexFormat format = VertexFormat::FullPrecision);
+
+    bool hit(const Ray &ray, double t_min, HitRecord &rec) const override;
+
+    AABB bounding_box() const override;
+
+    size_t triangle_count() const
+    {
+        return indices.size() / 3;
+    }
+
+    //顶点数据占用的字节数，以及同样的顶点用FullPrecision存储时占用的字节数
+    size_t vertex_bytes() const;
+    size_t full_vertex_bytes() const;
+
+    //总占用，包括索引和BVH节点
+    size_t memory_bytes() const;
+};
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "hittable.hpp"
+#include "transform.hpp"
+
+#include <memory>
+
+//让一个物体(通常是Mesh)在快门时间内从start变换运动到end变换
+//物体本身不复制，求交时把光线变换到物体空间
+//变换按矩阵元素线性插值，所以物体上每个点都沿直线匀速运动
+class MovingInstance : public Hittable
+{
+private:
+    std::shared_ptr<Hittable> object;
+    Transform start;
+    Transform end;
+
+    //start和end相同时不需要每次求交都求逆
+    bool is_static;
+    Transform start_inverse;
+
+public:
+    MovingInstance(std::shared_ptr<Hittable> object, const Transform &start, const Transform &end);
+
+    bool hit(const Ray &ray, double t_min, HitRecord &rec) const override;
+
+    //整个快门时间内的包围盒
+    AABB bounding_box() const override;
+
+    AABB bounding_box_at(double time) const override;
+};
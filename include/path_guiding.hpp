@@ -0,0 +1,151 @@
+#pragma once
+
+#include "aabb.hpp"
+#include "basic_types.hpp"
+#include "pdf.h"
+#include "sampler.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+//方向四叉树(Müller等人的Practical Path Guiding)
+//单位球面用等面积的柱面映射(cos_theta, phi)展开成单位正方形，再递归地四等分
+//每个节点保存四个子象限里记录到的入射辐亮度之和，所以按这些和往下走就能按辐亮度采样方向
+//记录在渲染时由多个线程同时进行，和用原子操作累加
+class DTree
+{
+private:
+    struct Node
+    {
+        std::atomic<double> sums[4];
+
+        //子象限对应的节点下标，0表示这个象限是叶子(根节点不会是任何节点的孩子)
+        uint32_t children[4] = {0, 0, 0, 0};
+
+        Node();
+        Node(const Node &other);
+        Node &operator=(const Node &other);
+
+        double total() const;
+    };
+
+    std::vector<Node> nodes;
+
+    //记录的次数，空间树据此决定是否细分
+    std::atomic<uint32_t> record_count{0};
+
+public:
+    DTree();
+    DTree(const DTree &other);
+    DTree &operator=(const DTree &other);
+
+    //在单位方向direction上记录一次入射辐亮度的估计，值是辐亮度除以采样这个方向的pdf
+    void record(const Direction &direction, double value);
+
+    //按记录的辐亮度分布采样方向的概率密度(立体角)，还没有记录时是均匀球面分布
+    double pdf(const Direction &direction) const;
+
+    //按记录的辐亮度分布采样一个单位方向
+    Direction sample(double u1, double u2) const;
+
+    //按这棵树记录的能量重新划分结构，能量占比超过threshold的象限继续四分，其余的合并成叶子
+    //返回的树结构细化了，但所有的和都是0，用来记录下一轮
+    DTree refined(double threshold, int max_depth) const;
+
+    double total() const;
+
+    //没有任何记录的树，不使用路径引导时给GuidedPDF占位
+    static const DTree &empty_tree();
+
+    uint32_t get_record_count() const
+    {
+        return record_count.load(std::memory_order_relaxed);
+    }
+
+    void set_record_count(uint32_t count)
+    {
+        record_count.store(count, std::memory_order_relaxed);
+    }
+};
+
+//空间二叉树，每次沿x、y、z轴轮流从中间分开，每个叶子有两棵方向树：
+//sampling是上一轮训练学到的分布，渲染时从它采样；building记录这一轮的样本
+//每轮训练结束时调用refine：记录数多的叶子继续分裂，building细化后变成新的sampling
+class SDTree
+{
+private:
+    struct Node
+    {
+        int axis;
+
+        //内部节点的两个孩子，叶子的dtree是它在dtrees中的下标，内部节点是-1
+        uint32_t children[2];
+        int dtree;
+    };
+
+    struct DTreePair
+    {
+        DTree sampling;
+        DTree building;
+    };
+
+    AABB bounds;
+    std::vector<Node> nodes;
+    std::vector<DTreePair> dtrees;
+
+    int leaf(const Point &p) const;
+
+    void split(uint32_t node, uint32_t threshold);
+
+public:
+    //叶子记录数超过spatial_threshold * sqrt(2^iteration)时分裂，方向树中能量占比超过directional_threshold的象限细分
+    static constexpr uint32_t spatial_threshold = 12000;
+    static constexpr double directional_threshold = 0.01;
+    static constexpr int max_directional_depth = 20;
+
+    SDTree() = default;
+
+    //bounds是场景的包围盒，空间树覆盖包住它的立方体
+    explicit SDTree(const AABB &bounds);
+
+    const DTree &sampling_tree(const Point &p) const
+    {
+        return dtrees[leaf(p)].sampling;
+    }
+
+    DTree &building_tree(const Point &p)
+    {
+        return dtrees[leaf(p)].building;
+    }
+
+    //第iteration轮训练(从0开始)结束时调用
+    void refine(int iteration);
+
+    bool empty() const
+    {
+        return nodes.empty();
+    }
+};
+
+//按位置所在叶子学到的入射辐亮度分布采样方向
+class GuidedPDF : public PDF
+{
+private:
+    const DTree &tree;
+
+public:
+    explicit GuidedPDF(const DTree &tree) : tree(tree) {}
+
+    double value(const Direction &direction) const override
+    {
+        return tree.pdf(direction.unit());
+    }
+
+    Direction generate(Sampler &sampler) const override
+    {
+        double u1, u2;
+        sampler.get_2d(u1, u2);
+        return tree.sample(u1, u2);
+    }
+};
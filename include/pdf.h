@@ -1,21 +1,25 @@
 #pragma once
 
+#include "alias_table.hpp"
 #include "basic_types.hpp"
-#include "random_generator.hpp"
+#include "sampler.hpp"
+#include "sampling.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <cstdlib>
 #include <memory>
 #include <vector>
 
 #include "hittable.hpp"
+#include "material.hpp"
 
 class PDF
 {
 public:
     virtual ~PDF() = default;
     virtual double value(const Direction &direction) const = 0;
-    virtual Direction generate(RandomGenerator &random_generator) = 0;
+    virtual Direction generate(Sampler &sampler) const = 0;
 };
 
 class SpherePDF : public PDF
@@ -30,9 +34,11 @@ public:
         return INV_4PI;
     }
 
-    Direction generate(RandomGenerator &random_generator) override
+    Direction generate(Sampler &sampler) const override
     {
-        return random_generator.sample_direction_sphere();
+        double u1, u2;
+        sampler.get_2d(u1, u2);
+        return sample_uniform_sphere(u1, u2);
     }
 
 };
@@ -54,88 +60,174 @@ public:
         return (exponent + 1) * std::pow(cosine, exponent) / (2 * M_PI);
     }
 
-    Direction generate(RandomGenerator &random_generator) override
+    Direction generate(Sampler &sampler) const override
     {
-        double r1 = random_generator.get_random_double(0, 1);
-        double r2 = random_generator.get_random_double(0, 1);
+        double r1, r2;
+        sampler.get_2d(r1, r2);
+        OrthonormalBasis basis(normal);
+
+        //exponent为1时就是余弦分布，用同心圆盘映射，不需要pow
+        if (exponent == 1)
+        {
+            return basis.to_world(sample_cosine_hemisphere(r1, r2));
+        }
 
         double phi = 2 * M_PI * r1;
         double cos_theta = std::pow(r2, 1.0 / (exponent + 1));
-        double sin_theta = sqrt(1 - cos_theta * cos_theta);
+        double sin_theta = std::sqrt(std::max(0.0, 1 - cos_theta * cos_theta));
+
+        return basis.to_world(Direction(sin_theta * std::cos(phi), sin_theta * std::sin(phi), cos_theta));
+    }
+};
+
+//下面的pdf都是值类型，只引用物体，不拥有物体
+//在栈上构造即可，每次反弹不需要分配内存
+class HittablePDF : public PDF
+{
+private:
+    Point origin;
+    const Hittable &object;
 
-        double x = sin_theta * cos(phi);
-        double y = sin_theta * sin(phi);
-        double z = cos_theta;
+public:
 
-        Direction w = normal.unit();
-        Direction a = (fabs(w.x()) > 0.9) ? Direction(0, 1, 0) : Direction(1, 0, 0);
-        Direction v = w.cross(a).unit();
-        Direction u = v.cross(w);
+    HittablePDF(const Point &origin, const Hittable &object)
+        : origin(origin), object(object) {}
 
-        Direction sampled_direction = u * x + v * y + w * z;
+    double value(const Direction &direction) const override
+    {
+        return object.pdf_value(origin, direction);
+    }
 
-        return sampled_direction.unit();
+    Direction generate(Sampler &sampler) const override
+    {
+        double pdf;
+        return object.sample_direction(origin, sampler, pdf);
     }
+
 };
 
-class HittablePDF : public PDF
+//材质自己的重要性采样，value()是材质的scattering_pdf
+//方向在scatter()里已经采样好了，generate()直接返回它，不再消耗随机数
+class MaterialPDF : public PDF
+{
+private:
+    const Ray &ray_in;
+    const HitRecord &rec;
+    Direction sampled_direction;
+
+public:
+
+    MaterialPDF(const Ray &ray_in, const HitRecord &rec, const Direction &sampled_direction)
+        : ray_in(ray_in), rec(rec), sampled_direction(sampled_direction.unit()) {}
+
+    double value(const Direction &direction) const override
+    {
+        return rec.material->scattering_pdf(ray_in, rec, rec.spawn_ray(direction.unit(), ray_in.get_time()));
+    }
+
+    Direction generate(Sampler &) const override
+    {
+        return sampled_direction;
+    }
+
+};
+
+//按别名表里的概率(通常正比于光源功率)选一个光源，再对它采样
+//选光源是O(1)的，但value()要得到这个方向真正的概率密度，仍然要把所有光源加起来
+class LightPDF : public PDF
 {
 private:
     Point origin;
-    std::shared_ptr<Hittable> object;
+    const std::vector<std::shared_ptr<Hittable>> &lights;
+    const AliasTable &table;
 
 public:
 
-    HittablePDF(const Point &origin, std::shared_ptr<Hittable> object)
-        : origin(origin), object(object) {}
+    LightPDF(const Point &origin, const std::vector<std::shared_ptr<Hittable>> &lights, const AliasTable &table)
+        : origin(origin), lights(lights), table(table) {}
 
     double value(const Direction &direction) const override
     {
-        return object->pdf_value(origin, direction);
+        double sum = 0;
+        for (int i = 0; i < table.size(); ++i) {
+            sum += table.get_pmf(i) * lights[i]->pdf_value(origin, direction);
+        }
+        return sum;
     }
 
-    Direction generate(RandomGenerator &random_generator) override
+    Direction generate(Sampler &sampler) const override
     {
-        return object->random(random_generator) - origin;
+        int i = table.sample(sampler.get_1d());
+        double pdf;
+        return lights[i]->sample_direction(origin, sampler, pdf);
     }
 
 };
 
+//固定容量的混合pdf，只保存指向其他pdf的指针
+//被混合的pdf必须比MixturePDF活得久，一般都是同一个作用域里的局部变量
 class MixturePDF : public PDF
 {
+public:
+
+    static constexpr int capacity = 4;
+
 private:
 
-    std::vector<PDF*> pdfs;
+    const PDF *pdfs[capacity];
 
-    std::vector<double> weights;
+    double weights[capacity];
+
+    int count = 0;
 
 public:
 
-    MixturePDF(std::vector<PDF*> pdfs, std::vector<double> weights)
-        : pdfs(pdfs), weights(weights)
+    MixturePDF() = default;
+
+    MixturePDF(const PDF &a, double weight_a, const PDF &b, double weight_b)
+    {
+        add(a, weight_a);
+        add(b, weight_b);
+    }
+
+    void add(const PDF &pdf, double weight)
     {
-        assert(pdfs.size() == weights.size());
+        assert(count < capacity);
+        pdfs[count] = &pdf;
+        weights[count] = weight;
+        ++count;
     }
 
     double value(const Direction &direction) const override
     {
         double sum = 0;
-        for (int i = 0; i < pdfs.size(); ++i) {
+        for (int i = 0; i < count; ++i) {
             sum += weights[i] * pdfs[i]->value(direction);
         }
         return sum;
     }
 
-    Direction generate(RandomGenerator &random_generator) override
+    //每个分量都生成一个方向，只返回选中的那个，这样不管选中哪个分量，用掉的维度数都一样
+    Direction generate(Sampler &sampler) const override
     {
-        double r = random_generator.get_random_double(0, 1);
+        double r = sampler.get_1d();
+        int chosen = count - 1;
         double sum = 0;
-        for (int i = 0; i < pdfs.size(); ++i) {
+        for (int i = 0; i < count; ++i) {
             sum += weights[i];
             if (r < sum) {
-                return pdfs[i]->generate(random_generator);
+                chosen = i;
+                break;
+            }
+        }
+
+        Direction result;
+        for (int i = 0; i < count; ++i) {
+            Direction direction = pdfs[i]->generate(sampler);
+            if (i == chosen) {
+                result = direction;
             }
         }
-        return pdfs.back()->generate(random_generator);
+        return result;
     }
-};
\ No newline at end of file
+};
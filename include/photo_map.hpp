@@ -6,6 +6,7 @@
 #include "ray.hpp"
 #include "hittable.hpp"
 #include "material.hpp"
+#include "sampler.hpp"
 
 #include <memory>
 #include <queue>
@@ -113,5 +114,8 @@ private:
 
     // Random number generator
     mutable std::default_random_engine generator;
+
+    // Supplies the scattering decisions, one "pixel" per photon
+    IndependentSampler sampler{1, 0};
 };
 
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "basic_types.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+//路径上一个等待写入缓存的顶点：它所在的格子，以及到达这个顶点时路径已经累计的radiance和throughput
+//路径结束后，(最终的radiance - radiance) / throughput就是这个顶点朝上一个顶点发出的辐亮度
+struct RadianceCacheVertex
+{
+    int64_t cell;
+    Color radiance;
+    Color throughput;
+};
+
+//世界空间的哈希辐亮度缓存
+//位置按cell_size量化成网格，法线量化成最接近的坐标轴方向(6个)，两者拼成64位的键，开放寻址地存在固定大小的表里
+//每个格子累计路径顶点发出的辐亮度的和与样本数，路径走了几次反弹之后可以在有足够样本的格子里停下来，用平均值代替剩下的路径
+//插入和查询都不加锁：键用比较交换占据空位，辐亮度用定点数的整数原子加法累计
+//表满或者探测了max_probes个位置都被其他键占据时，这个位置不缓存
+class RadianceCache
+{
+private:
+    struct Entry
+    {
+        //0表示空位，有效的键最高位是1
+        std::atomic<uint64_t> key{0};
+        std::atomic<uint64_t> sums[3];
+        std::atomic<uint32_t> count{0};
+    };
+
+    std::unique_ptr<Entry[]> entries;
+
+    //表的大小，2的幂
+    size_t capacity = 0;
+    double inverse_cell_size = 20;
+
+    uint64_t make_key(const Point &p, const Direction &n) const;
+
+public:
+    //线性探测的最大长度
+    static constexpr int max_probes = 8;
+
+    //辐亮度按1 / fixed_point_scale的精度存成整数
+    static constexpr double fixed_point_scale = 1 << 20;
+
+    //空的缓存，不分配表
+    RadianceCache() = default;
+
+    //capacity向上取到2的幂，cell_size是世界空间中格子的边长
+    RadianceCache(size_t capacity, double cell_size);
+
+    //重新分配表，capacity为0时释放，不是线程安全的
+    void reset(size_t capacity, double cell_size);
+
+    //清空所有格子，不是线程安全的
+    void clear();
+
+    //p、n所在的格子在表中的下标，还没有时占据一个空位，表里放不下时返回-1
+    //路径在一个顶点上先用它查询，没有停下来时再用同一个下标写入，只需要找一次
+    int64_t locate(const Point &p, const Direction &n);
+
+    //格子的平均辐亮度，样本数不到min_samples时返回false
+    bool lookup(int64_t cell, int min_samples, Color &radiance) const;
+
+    //在格子里累计一个辐亮度样本
+    void insert(int64_t cell, const Color &radiance);
+
+    //一条路径结束时，把它的前count个顶点发出的辐亮度写入缓存，path_radiance是路径最终的radiance
+    void update(const RadianceCacheVertex *vertices, int count, const Color &path_radiance);
+
+    //被占据的格子数
+    size_t size() const;
+};
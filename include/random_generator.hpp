@@ -8,19 +8,24 @@ class RandomGenerator
 {
 public:
 
-    RandomGenerator() : gen(rd()) {}
+    RandomGenerator() : gen(rd()), distribution(0.0, 1.0) {}
 
     double get_random_double(double min, double max);
 
     //以center为中心，边长为side_length的正方形上随机采样一个点
     Point sample_point_square(Point center, double side_length, Direction u_direction, Direction v_direction);
 
+    //球面上均匀采样一个点
     Point sample_point_sphere(Point center, double radius);
 
+    //单位球面上均匀采样一个方向
     Direction sample_direction_sphere();
 
     Point sample_point_sphere_surface(Point center, double radius);
 private:
     std::random_device rd;
     std::mt19937 gen;
+
+    //[0, 1)上的分布只构造一次，其他区间由它线性变换得到
+    std::uniform_real_distribution<> distribution;
 };
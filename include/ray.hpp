@@ -2,6 +2,8 @@
 
 #include "basic_types.hpp"
 
+#include <limits>
+
 class Ray
 {
 private:
@@ -9,13 +11,85 @@ private:
     Point origin;
     Direction direction;
 
+    //方向的倒数和每个轴上方向的符号(1表示负方向)，构造时算好
+    //AABB求交时直接用它们，不需要每访问一个节点就做三次除法
+    Direction inv_direction;
+    int sign[3];
+
+    //求交范围的上界，遍历时击中物体就收缩到交点的t，之后的包围盒和物体只和更近的范围比较
+    //hit只拿到const Ray &，所以是mutable
+    mutable double t_max;
+
+    //快门时间，范围是[0, 1]，0是快门打开，1是快门关闭
+    double time;
+
+    void precompute();
+
 public:
 
     Ray();
-    Ray(const Point &origin, const Direction &direction);
+    Ray(const Point &origin, const Direction &direction, double t_max = std::numeric_limits<double>::infinity());
+
+    inline const Point &get_origin() const
+    {
+        return origin;
+    }
+
+    inline const Direction &get_direction() const
+    {
+        return direction;
+    }
+
+    inline const Direction &get_inv_direction() const
+    {
+        return inv_direction;
+    }
+
+    inline const int *get_sign() const
+    {
+        return sign;
+    }
+
+    inline double get_t_max() const
+    {
+        return t_max;
+    }
+
+    inline void set_t_max(double t) const
+    {
+        t_max = t;
+    }
+
+    inline double get_time() const
+    {
+        return time;
+    }
+
+    //time不在构造函数里，避免和t_max混淆
+    inline void set_time(double t)
+    {
+        time = t;
+    }
+
+    inline Point at(double t) const
+    {
+        return origin + direction * t;
+    }
+};
+
+//光线流使用的紧凑格式，单精度，一条光线正好32字节
+//两条光线占满一个cache line，适合批量存放和传输
+struct PackedRay
+{
+    float origin[3];
+    float time;
+    float direction[3];
+    float t_max;
+
+    PackedRay() = default;
+    PackedRay(const Ray &ray);
 
-    Point get_origin() const;
-    Direction get_direction() const;
+    Ray unpack() const;
+};
 
-    Point at(double t) const;
-};
\ No newline at end of file
+static_assert(sizeof(PackedRay) == 32, "PackedRay must stay 32 bytes");
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "basic_types.hpp"
+
+#include <algorithm>
+
+//光源上的一个采样点，ReSTIR在像素之间和帧之间复用的就是它
+//用光源表面上的点(面积测度)表示，换到另一个着色点上只需要重新计算目标函数，不需要额外的雅可比行列式
+struct LightSample
+{
+    Point position;
+    Direction normal;
+    Color emitted;
+
+    //在lights中的下标，-1表示没有样本
+    int light = -1;
+};
+
+//ReSTIR GI复用的次级路径：主交点沿采样方向击中的第一个点，以及从那里朝主交点发出的辐亮度
+//辐亮度按漫反射表面处理，换到另一个主交点上时认为不变，只需要乘上立体角之间的雅可比行列式
+//没有击中时样本放在远处，法线朝向主交点；第一个点是镜面时法线记为0，它在别的主交点上的雅可比行列式是0，不会被复用
+struct PathSample
+{
+    Point position;
+    Direction normal;
+    Color radiance;
+};
+
+//加权蓄水池抽样(weighted reservoir sampling)：依次看到的候选只保存一个，第k个候选最终被选中的概率是w_k / weight_sum
+//M是见过的候选数，W是选中样本的贡献权重，积分的估计是 f(sample) * W
+//合并两个蓄水池时，另一个蓄水池的样本以 目标函数 * W * M 作为权重参与抽样，相当于把它见过的候选都重新看了一遍
+template <typename Sample>
+class Reservoir
+{
+public:
+    Sample sample;
+    double weight_sum = 0;
+    int M = 0;
+    double W = 0;
+
+    //加入一个候选，u是[0, 1)上的随机数，选中时返回true
+    bool update(const Sample &candidate, double weight, double u)
+    {
+        weight_sum += weight;
+        M += 1;
+        if (weight > 0 && u * weight_sum < weight)
+        {
+            sample = candidate;
+            return true;
+        }
+        return false;
+    }
+
+    //合并另一个蓄水池，target是它的样本在当前着色点的目标函数值(测度不同时已经乘上雅可比行列式)，M最多按max_M计算
+    void merge(const Reservoir &other, double target, double u, int max_M)
+    {
+        int other_M = std::min(other.M, max_M);
+        int current_M = M;
+        update(other.sample, target * other.W * other_M, u);
+        M = current_M + other_M;
+    }
+
+    //加入所有候选之后计算W，target是选中的样本在当前着色点的目标函数值
+    void finalize(double target)
+    {
+        finalize(target, M);
+    }
+
+    //合并过其他着色点的蓄水池时，那些着色点上目标函数为0的样本不可能来自它们，它们的M不应该计入
+    //count是选中的样本在各自着色点上目标函数大于0的那些蓄水池的M之和，用它代替M才不会让结果偏暗
+    void finalize(double target, int count)
+    {
+        W = (target > 0 && count > 0) ? weight_sum / (count * target) : 0;
+    }
+};
@@ -0,0 +1,229 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+enum SamplerType
+{
+    Independent,
+    Stratified,
+    Halton,
+    Sobol,
+    BlueNoise
+};
+
+//采样器为每个像素样本提供一串[0, 1)上的随机数，每取一个数维度加一
+//同一个像素的不同样本在同一维度上的取值互相分层，所以误差比独立采样下降得快
+//
+//维度的使用顺序是固定的：先是像素内的位置(2D)和快门时间(1D)，
+//之后每次反弹依次是选光源(1D)、光源上的采样(2D)、材质的采样(2D + 1D)、俄罗斯轮盘赌(1D)
+//ray_color_pdf先是材质的采样，再是混合pdf选分量(1D)和每个分量的采样
+//分支用不到的维度也要取出或者跳过，比如镜面不对光源采样、玻璃只用1D选择反射或折射，
+//这样每次反弹用掉的维度数固定，各个样本的同一次反弹总是落在同样的维度上，分层才有效果
+//
+//所有的值都由(像素, 样本序号, 维度, 种子)哈希得到，没有内部的随机数状态，
+//所以每个线程复制一份就可以并行使用
+class Sampler
+{
+protected:
+    int samples_per_pixel;
+    uint32_t seed;
+
+    //当前像素的坐标，和像素坐标与种子的哈希，每个样本开始时算一次
+    int pixel_x = 0;
+    int pixel_y = 0;
+    uint64_t pixel_hash = 0;
+    int sample_index = 0;
+    int dimension = 0;
+
+    //当前像素、当前维度的哈希，用来打乱样本顺序和加扰
+    uint64_t dimension_hash() const;
+
+public:
+    Sampler(int samples_per_pixel, uint32_t seed) : samples_per_pixel(samples_per_pixel), seed(seed) {}
+    virtual ~Sampler() = default;
+
+    //开始像素(x, y)的第index个样本，维度从0开始重新计数
+    void start_pixel_sample(int x, int y, int index);
+
+    virtual double get_1d() = 0;
+
+    virtual void get_2d(double &u1, double &u2) = 0;
+
+    //跳过count个维度，和取出之后不用的效果一样
+    void skip_dimensions(int count)
+    {
+        dimension += count;
+    }
+
+    virtual std::unique_ptr<Sampler> clone() const = 0;
+
+    int get_samples_per_pixel() const
+    {
+        return samples_per_pixel;
+    }
+
+    //种子只在取值时参与哈希，换种子不需要重新创建采样器
+    void set_seed(uint32_t new_seed)
+    {
+        seed = new_seed;
+    }
+
+    //按SamplerType创建采样器，seed不同时得到不同的随机数，比如逐帧渲染时
+    static std::unique_ptr<Sampler> create(int type, int samples_per_pixel, uint32_t seed = 0);
+};
+
+//每次反弹中对光源采样用掉的维度数，选光源(1D)和光源上的采样(2D)
+static constexpr int light_sample_dimensions = 3;
+
+//每个维度都独立均匀分布，相当于原来直接用随机数生成器
+class IndependentSampler : public Sampler
+{
+public:
+    using Sampler::Sampler;
+
+    double get_1d() override;
+    void get_2d(double &u1, double &u2) override;
+
+    std::unique_ptr<Sampler> clone() const override
+    {
+        return std::make_unique<IndependentSampler>(*this);
+    }
+};
+
+//每个维度分成samples_per_pixel层，每层一个抖动的样本，样本和层的对应关系在每个维度上随机打乱
+//2D时分成尽量接近正方形的网格
+class StratifiedSampler : public Sampler
+{
+private:
+    int x_strata;
+    int y_strata;
+
+public:
+    StratifiedSampler(int samples_per_pixel, uint32_t seed);
+
+    double get_1d() override;
+    void get_2d(double &u1, double &u2) override;
+
+    std::unique_ptr<Sampler> clone() const override
+    {
+        return std::make_unique<StratifiedSampler>(*this);
+    }
+};
+
+//第d维用第d个素数为底的Halton序列，每个像素每个维度独立做Owen加扰
+//只做随机平移的话，底数大于样本数的维度上同一像素的样本会挤在一小段区间里
+//维度多于素数表时退化为独立采样
+class HaltonSampler : public Sampler
+{
+public:
+    using Sampler::Sampler;
+
+    double get_1d() override;
+    void get_2d(double &u1, double &u2) override;
+
+    std::unique_ptr<Sampler> clone() const override
+    {
+        return std::make_unique<HaltonSampler>(*this);
+    }
+};
+
+//Owen加扰的Sobol序列
+//每一对维度都用Sobol序列的前两维，样本序号在每对维度上随机打乱，再分别做Owen加扰，
+//这样不需要高维的方向数表，任意维度都保持良好的分层
+class SobolSampler : public Sampler
+{
+public:
+    using Sampler::Sampler;
+
+    double get_1d() override;
+    void get_2d(double &u1, double &u2) override;
+
+    std::unique_ptr<Sampler> clone() const override
+    {
+        return std::make_unique<SobolSampler>(*this);
+    }
+};
+
+//屏幕空间的蓝噪声采样，用于交互预览时的低样本数
+//每个维度把一张平铺的蓝噪声掩码平移一个随机的量，作为该维度上像素之间的随机偏移，
+//再加到所有像素共用的Owen加扰Sobol点集上(Georgiev和Fajardo的抖动采样)
+//相邻像素的偏移相差很大，误差表现为高频噪声，1spp时看起来比白噪声平滑得多；
+//像素内仍然是分层的Sobol点集，样本多时和SobolSampler一样收敛
+class BlueNoiseSampler : public Sampler
+{
+public:
+    using Sampler::Sampler;
+
+    double get_1d() override;
+    void get_2d(double &u1, double &u2) override;
+
+    std::unique_ptr<Sampler> clone() const override
+    {
+        return std::make_unique<BlueNoiseSampler>(*this);
+    }
+
+private:
+    //当前维度上当前像素的偏移，掩码的平移量只由种子和维度决定
+    double mask_offset(uint64_t hash) const;
+};
+
+//Metropolis光传输用的主样本空间(primary sample space)采样器(Kelemen等人，实现参照pbrt-v3)
+//它不按像素和样本序号哈希，而是保存一条马尔可夫链的当前状态：路径用到的每一维随机数
+//每次迭代以large_step_probability的概率把所有维度换成新的均匀随机数(大步)，否则每一维加上标准差为sigma的正态扰动并绕回[0, 1)(小步)
+//维度在被用到时才更新，多次迭代没有用到的维度一次补上对应次数的扰动；被拒绝时恢复这次迭代改过的维度
+//所以它有内部状态，每条链一个，不能像其他采样器那样复制给多个线程共用
+class MLTSampler : public Sampler
+{
+private:
+    struct PrimarySample
+    {
+        double value = 0;
+        int64_t last_modification = 0;
+
+        //这次迭代修改之前的值，被拒绝时恢复
+        double value_backup = 0;
+        int64_t modification_backup = 0;
+    };
+
+    std::vector<PrimarySample> samples;
+    uint64_t rng_state;
+    double sigma;
+    double large_step_probability;
+
+    int64_t current_iteration = 0;
+    bool large_step = true;
+    int64_t last_large_step_iteration = 0;
+
+    //把第index维更新到当前迭代
+    void ensure_ready(int index);
+
+public:
+    //seed相同的两个采样器产生同样的状态序列，渲染时用它重建自举阶段选中的路径
+    MLTSampler(uint64_t seed, double sigma, double large_step_probability);
+
+    double get_1d() override;
+    void get_2d(double &u1, double &u2) override;
+
+    std::unique_ptr<Sampler> clone() const override
+    {
+        return std::make_unique<MLTSampler>(*this);
+    }
+
+    //链自己的均匀随机数，用于选择变异方式和决定是否接受
+    double uniform();
+
+    //开始一次变异，之后用get_1d取的就是提议的状态
+    void start_iteration();
+
+    //接受或者拒绝提议的状态
+    void accept();
+    void reject();
+
+    //按同一个状态重新计算路径时，维度从0开始
+    void restart_path()
+    {
+        dimension = 0;
+    }
+};
@@ -0,0 +1,122 @@
+#pragma once
+
+#include "basic_types.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+//采样函数都接收[0, 1)上的均匀随机数，返回局部坐标系(z轴朝上)中的方向
+//随机数从哪里来由调用者决定，再用OrthonormalBasis转换到世界坐标
+
+//以单位向量n为z轴的正交基，用Duff等人的无分支构造，不需要归一化和叉乘
+class OrthonormalBasis
+{
+public:
+    Direction u;
+    Direction v;
+    Direction w;
+
+    explicit OrthonormalBasis(const Direction &n) : w(n)
+    {
+        double sign = std::copysign(1.0, n.z());
+        double a = -1 / (sign + n.z());
+        double b = n.x() * n.y() * a;
+        u = Direction(1 + sign * n.x() * n.x() * a, sign * b, -sign * n.x());
+        v = Direction(b, sign + n.y() * n.y() * a, -n.y());
+    }
+
+    Direction to_world(const Direction &local) const
+    {
+        return u * local.x() + v * local.y() + w * local.z();
+    }
+
+    Direction to_local(const Direction &d) const
+    {
+        return Direction(d.dot(u), d.dot(v), d.dot(w));
+    }
+};
+
+//单位球面上均匀采样，z均匀分布时面积也是均匀的
+inline Direction sample_uniform_sphere(double u1, double u2)
+{
+    double z = 1 - 2 * u1;
+    double r = std::sqrt(std::max(0.0, 1 - z * z));
+    double phi = 2 * M_PI * u2;
+    return Direction(r * std::cos(phi), r * std::sin(phi), z);
+}
+
+inline double uniform_sphere_pdf()
+{
+    return 1 / (4 * M_PI);
+}
+
+//z >= 0的半球上均匀采样
+inline Direction sample_uniform_hemisphere(double u1, double u2)
+{
+    double z = u1;
+    double r = std::sqrt(std::max(0.0, 1 - z * z));
+    double phi = 2 * M_PI * u2;
+    return Direction(r * std::cos(phi), r * std::sin(phi), z);
+}
+
+inline double uniform_hemisphere_pdf()
+{
+    return 1 / (2 * M_PI);
+}
+
+//Shirley-Chiu同心映射，把正方形映射到单位圆盘上，面积均匀且形变小
+inline void sample_concentric_disk(double u1, double u2, double &x, double &y)
+{
+    double ox = 2 * u1 - 1;
+    double oy = 2 * u2 - 1;
+    if (ox == 0 && oy == 0)
+    {
+        x = 0;
+        y = 0;
+        return;
+    }
+
+    double r, theta;
+    if (std::fabs(ox) > std::fabs(oy))
+    {
+        r = ox;
+        theta = M_PI / 4 * (oy / ox);
+    }
+    else
+    {
+        r = oy;
+        theta = M_PI / 2 - M_PI / 4 * (ox / oy);
+    }
+    x = r * std::cos(theta);
+    y = r * std::sin(theta);
+}
+
+//余弦加权的半球采样：圆盘上均匀的点投影到半球上(Malley方法)
+inline Direction sample_cosine_hemisphere(double u1, double u2)
+{
+    double x, y;
+    sample_concentric_disk(u1, u2, x, y);
+    double z = std::sqrt(std::max(0.0, 1 - x * x - y * y));
+    return Direction(x, y, z);
+}
+
+inline double cosine_hemisphere_pdf(double cos_theta)
+{
+    return cos_theta > 0 ? cos_theta / M_PI : 0;
+}
+
+//以z轴为中心的圆锥内均匀采样，圆锥由1 - cos_theta_max给出
+//很小的圆锥(比如远处的小光源)的cos_theta_max非常接近1，用它算1 - cos只剩下舍入误差，所以调用者直接传入1 - cos
+inline Direction sample_uniform_cone(double u1, double u2, double one_minus_cos_max)
+{
+    double one_minus_cos = u1 * one_minus_cos_max;
+    double cos_theta = 1 - one_minus_cos;
+    double sin_theta = std::sqrt(std::max(0.0, one_minus_cos * (1 + cos_theta)));
+    double phi = 2 * M_PI * u2;
+    return Direction(sin_theta * std::cos(phi), sin_theta * std::sin(phi), cos_theta);
+}
+
+inline double uniform_cone_pdf(double one_minus_cos_max)
+{
+    return 1 / (2 * M_PI * one_minus_cos_max);
+}
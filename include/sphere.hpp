@@ -1,7 +1,6 @@
 #include "hittable.hpp"
 #include "material.hpp"
 #include "basic_types.hpp"
-#include "random_generator.hpp"
 #include <memory>
 
 class Sphere : public Hittable
@@ -13,7 +12,7 @@ private:
 public:
     Sphere(const Point &center, double radius, std::shared_ptr<Material> material);
 
-    bool hit(const Ray &ray, double t_min, double t_max, HitRecord &rec) const override;
+    bool hit(const Ray &ray, double t_min, HitRecord &rec) const override;
 
     AABB bounding_box() const override;
 
@@ -29,5 +28,47 @@ public:
 
     double pdf_value(const Point &o, const Direction &v) const override;
 
-    Point random(RandomGenerator &random_generator) const override;
+    //在从o看球所张的圆锥内均匀采样，只会采到朝向o的那一半球面
+    Direction sample_direction(const Point &o, Sampler &sampler, double &pdf) const override;
+
+    Point random(Sampler &sampler) const override;
+
+    Point sample_area(Sampler &sampler, Direction &normal) const override;
+
+    double area() const override
+    {
+        return 4 * M_PI * radius * radius;
+    }
+
+    std::shared_ptr<Material> get_material() const override
+    {
+        return material;
+    }
+
+    //只做求交测试，不填写HitRecord，也不收缩光线的t_max
+    static bool intersect(const Point &center, double radius, const Ray &ray, double t_min, double &t);
+
+    //根据rec.t填写交点、误差界和法线
+    static void fill_hit_point(const Point &center, double radius, const Ray &ray, HitRecord &rec);
+};
+
+//从快门打开到关闭，球心从center0匀速移动到center1
+class MovingSphere : public Hittable
+{
+private:
+    Point center0;
+    Point center1;
+    double radius;
+    std::shared_ptr<Material> material;
+
+    Point center(double time) const;
+public:
+    MovingSphere(const Point &center0, const Point &center1, double radius, std::shared_ptr<Material> material);
+
+    bool hit(const Ray &ray, double t_min, HitRecord &rec) const override;
+
+    //整个快门时间内的包围盒
+    AABB bounding_box() const override;
+
+    AABB bounding_box_at(double time) const override;
 };
\ No newline at end of file
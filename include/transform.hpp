@@ -0,0 +1,170 @@
+#pragma once
+
+#include "basic_types.hpp"
+#include "aabb.hpp"
+
+#include <cmath>
+
+//仿射变换，3x4矩阵，最后一列是平移
+class Transform
+{
+private:
+    double m[3][4];
+
+public:
+    Transform() : m{{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}} {}
+
+    static Transform translate(const Direction &offset)
+    {
+        Transform t;
+        t.m[0][3] = offset.x();
+        t.m[1][3] = offset.y();
+        t.m[2][3] = offset.z();
+        return t;
+    }
+
+    static Transform scale(double s)
+    {
+        Transform t;
+        t.m[0][0] = t.m[1][1] = t.m[2][2] = s;
+        return t;
+    }
+
+    //绕过原点的axis旋转angle弧度
+    static Transform rotate(const Direction &axis, double angle)
+    {
+        Direction u = axis.unit();
+        double c = std::cos(angle);
+        double s = std::sin(angle);
+        double k = 1 - c;
+        double x = u.x(), y = u.y(), z = u.z();
+
+        Transform t;
+        t.m[0][0] = k * x * x + c;     t.m[0][1] = k * x * y - z * s; t.m[0][2] = k * x * z + y * s;
+        t.m[1][0] = k * x * y + z * s; t.m[1][1] = k * y * y + c;     t.m[1][2] = k * y * z - x * s;
+        t.m[2][0] = k * x * z - y * s; t.m[2][1] = k * y * z + x * s; t.m[2][2] = k * z * z + c;
+        return t;
+    }
+
+    //先做other，再做this
+    Transform operator*(const Transform &other) const
+    {
+        Transform t;
+        for (int i = 0; i < 3; ++i)
+        {
+            for (int j = 0; j < 4; ++j)
+            {
+                t.m[i][j] = m[i][0] * other.m[0][j] + m[i][1] * other.m[1][j] + m[i][2] * other.m[2][j] + (j == 3 ? m[i][3] : 0);
+            }
+        }
+        return t;
+    }
+
+    Point apply(const Point &p) const
+    {
+        return Point(m[0][0] * p.x() + m[0][1] * p.y() + m[0][2] * p.z() + m[0][3],
+                     m[1][0] * p.x() + m[1][1] * p.y() + m[1][2] * p.z() + m[1][3],
+                     m[2][0] * p.x() + m[2][1] * p.y() + m[2][2] * p.z() + m[2][3]);
+    }
+
+    //变换一个带误差界p_error的点，变换后的误差界写入out_error
+    Point apply(const Point &p, const Direction &p_error, Direction &out_error) const
+    {
+        double g3 = error_gamma(3);
+        double e[3];
+        for (int i = 0; i < 3; ++i)
+        {
+            double propagated = std::fabs(m[i][0]) * p_error.x() + std::fabs(m[i][1]) * p_error.y() + std::fabs(m[i][2]) * p_error.z();
+            double rounding = std::fabs(m[i][0] * p.x()) + std::fabs(m[i][1] * p.y()) + std::fabs(m[i][2] * p.z()) + std::fabs(m[i][3]);
+            e[i] = (g3 + 1) * propagated + g3 * rounding;
+        }
+        out_error = Direction(e[0], e[1], e[2]);
+        return apply(p);
+    }
+
+    Direction apply(const Direction &d) const
+    {
+        return Direction(m[0][0] * d.x() + m[0][1] * d.y() + m[0][2] * d.z(),
+                         m[1][0] * d.x() + m[1][1] * d.y() + m[1][2] * d.z(),
+                         m[2][0] * d.x() + m[2][1] * d.y() + m[2][2] * d.z());
+    }
+
+    //用线性部分的转置变换，对逆矩阵调用它就得到法线的变换
+    Direction apply_transposed(const Direction &d) const
+    {
+        return Direction(m[0][0] * d.x() + m[1][0] * d.y() + m[2][0] * d.z(),
+                         m[0][1] * d.x() + m[1][1] * d.y() + m[2][1] * d.z(),
+                         m[0][2] * d.x() + m[1][2] * d.y() + m[2][2] * d.z());
+    }
+
+    //变换后的包围盒，取8个角点变换后的包围盒
+    AABB apply(const AABB &box) const
+    {
+        AABB result;
+        for (int i = 0; i < 8; ++i)
+        {
+            Point corner((i & 1) ? box.maximum.x() : box.minimum.x(),
+                         (i & 2) ? box.maximum.y() : box.minimum.y(),
+                         (i & 4) ? box.maximum.z() : box.minimum.z());
+            Point p = apply(corner);
+            result = (i == 0) ? AABB(p, p) : AABB::surrounding_box(result, AABB(p, p));
+        }
+        return result;
+    }
+
+    Transform inverse() const
+    {
+        double a = m[0][0], b = m[0][1], c = m[0][2];
+        double d = m[1][0], e = m[1][1], f = m[1][2];
+        double g = m[2][0], h = m[2][1], k = m[2][2];
+
+        double det = a * (e * k - f * h) - b * (d * k - f * g) + c * (d * h - e * g);
+        double inv_det = 1.0 / det;
+
+        Transform t;
+        t.m[0][0] = (e * k - f * h) * inv_det;
+        t.m[0][1] = (c * h - b * k) * inv_det;
+        t.m[0][2] = (b * f - c * e) * inv_det;
+        t.m[1][0] = (f * g - d * k) * inv_det;
+        t.m[1][1] = (a * k - c * g) * inv_det;
+        t.m[1][2] = (c * d - a * f) * inv_det;
+        t.m[2][0] = (d * h - e * g) * inv_det;
+        t.m[2][1] = (b * g - a * h) * inv_det;
+        t.m[2][2] = (a * e - b * d) * inv_det;
+
+        for (int i = 0; i < 3; ++i)
+        {
+            t.m[i][3] = -(t.m[i][0] * m[0][3] + t.m[i][1] * m[1][3] + t.m[i][2] * m[2][3]);
+        }
+        return t;
+    }
+
+    bool operator==(const Transform &other) const
+    {
+        for (int i = 0; i < 3; ++i)
+        {
+            for (int j = 0; j < 4; ++j)
+            {
+                if (m[i][j] != other.m[i][j])
+                {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    //逐个元素线性插值，每个点的运动轨迹都是直线
+    static Transform lerp(const Transform &a, const Transform &b, double t)
+    {
+        Transform result;
+        for (int i = 0; i < 3; ++i)
+        {
+            for (int j = 0; j < 4; ++j)
+            {
+                result.m[i][j] = a.m[i][j] + (b.m[i][j] - a.m[i][j]) * t;
+            }
+        }
+        return result;
+    }
+};
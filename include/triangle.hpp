@@ -12,14 +12,50 @@ private:
     Point v1;
     Point v2;
     std::shared_ptr<Material> material;
+
+    double area_pdf(const Point &o, const Direction &v) const;
+
+    bool use_spherical_sampling(const Point &o) const;
 public:
     Triangle(const Point &v0, const Point &v1, const Point &v2, std::shared_ptr<Material> material);
 
-    bool hit(const Ray &ray, double t_min, double t_max, HitRecord &rec) const override;
+    bool hit(const Ray &ray, double t_min, HitRecord &rec) const override;
 
     AABB bounding_box() const override;
 
     double pdf_value(const Point &o, const Direction &v) const override;
 
-    Point random(RandomGenerator &random_generator) const override;
+    //立体角适中时在球面三角形上均匀采样，否则在面积上均匀采样
+    Direction sample_direction(const Point &o, Sampler &sampler, double &pdf) const override;
+
+    Point random(Sampler &sampler) const override;
+
+    Point sample_area(Sampler &sampler, Direction &normal) const override;
+
+    //从o看三角形所张的立体角
+    double solid_angle(const Point &o) const;
+
+    double area() const override
+    {
+        return 0.5 * (v1 - v0).cross(v2 - v0).length();
+    }
+
+    std::shared_ptr<Material> get_material() const override
+    {
+        return material;
+    }
+
+    //平面光源只沿法线方向发光，另一面由LightBounds按双面处理
+    void emission_cone(Direction &axis, double &cos_theta) const override
+    {
+        axis = (v1 - v0).cross(v2 - v0).unit();
+        cos_theta = 1;
+    }
+
+    //只做求交测试，不填写HitRecord，也不收缩光线的t_max，Mesh的叶子节点也使用它
+    static bool intersect(const Point &v0, const Point &v1, const Point &v2, const Ray &ray, double t_min, double &t, double &u, double &v);
+
+    //用重心坐标计算交点和误差界，比ray.at(t)精确得多
+    //几何法线取面法线，朝向光线来的一侧
+    static void fill_hit_point(const Point &v0, const Point &v1, const Point &v2, const Ray &ray, double u, double v, HitRecord &rec);
 };
\ No newline at end of file
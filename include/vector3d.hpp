@@ -2,17 +2,44 @@
 
 #include <cmath>
 #include <iostream>
+
+//向量按4个double打包存放，第4个分量恒为0，只用于填充SIMD寄存器
+//这里用GCC/Clang的向量扩展，由编译器根据-march生成AVX或者SSE2指令
+//比起手写intrinsics，分量的读写(x(), y(), z())不需要经过内存中转
+//对齐只要求16字节，和operator new默认的对齐一致，避免走对齐分配的慢路径
 class Vector3d
 {
 private:
 
-    double e[3];
+    typedef double Lanes __attribute__((vector_size(32), aligned(16)));
+    typedef long long Mask __attribute__((vector_size(32)));
+
+    Lanes e;
+
+    explicit Vector3d(Lanes e) : e(e) {}
+
+    //(x, y, z, 0) -> (y, z, x, 0)
+    static inline Lanes yzx(Lanes a)
+    {
+#if defined(__clang__)
+        return __builtin_shufflevector(a, a, 1, 2, 0, 3);
+#else
+        return __builtin_shuffle(a, Mask{1, 2, 0, 3});
+#endif
+    }
+
+    //报错路径单独拿出来且不内联，否则每个运算符都会因为内联了iostream代码而变大
+    __attribute__((noinline, cold)) static void division_by_zero(const char *where)
+    {
+        std::cerr << "ERROR: division by zero in " << where << std::endl;
+        exit(1);
+    }
 
 public:
 
-    Vector3d() : e{0, 0, 0} {}
+    Vector3d() : e{0, 0, 0, 0} {}
 
-    Vector3d(double e0, double e1, double e2) : e{e0, e1, e2} {}
+    Vector3d(double e0, double e1, double e2) : e{e0, e1, e2, 0} {}
     
     inline double x() const
     {
@@ -31,7 +58,7 @@ public:
 
     inline double length_squared() const
     {
-        return e[0] * e[0] + e[1] * e[1] + e[2] * e[2];
+        return this->dot(*this);
     }   
 
     inline double length() const
@@ -46,12 +73,12 @@ public:
 
     inline double& operator[](int i)
     {
-        return e[i];
+        return reinterpret_cast<double *>(&e)[i];
     }
 
     inline Vector3d operator-() const
     {
-        return Vector3d(-e[0], -e[1], -e[2]);
+        return Vector3d(-e);
     }
 
     inline Vector3d operator+() const
@@ -61,27 +88,21 @@ public:
 
     inline Vector3d& operator+=(const Vector3d &v)
     {
-        e[0] += v.e[0];
-        e[1] += v.e[1];
-        e[2] += v.e[2];
+        e += v.e;
 
         return *this;
     }
 
     inline Vector3d& operator-=(const Vector3d &v)
     {
-        e[0] -= v.e[0];
-        e[1] -= v.e[1];
-        e[2] -= v.e[2];
+        e -= v.e;
 
         return *this;
     }
 
     inline Vector3d& operator*=(const Vector3d &v)
     {
-        e[0] *= v.e[0];
-        e[1] *= v.e[1];
-        e[2] *= v.e[2];
+        e *= v.e;
 
         return *this;
     }
@@ -90,122 +111,118 @@ public:
     {
         if (v.e[0] == 0 || v.e[1] == 0 || v.e[2] == 0)
         {
-            std::cerr << "ERROR: division by zero in Vector3d::operator/=(const Vector3d &v)" << std::endl;
-            exit(1);
+            division_by_zero("Vector3d::operator/=(const Vector3d &v)");
         }
 
-        e[0] /= v.e[0];
-        e[1] /= v.e[1];
-        e[2] /= v.e[2];
+        //第4个分量做0/0会得到NaN，所以除数的第4个分量换成1
+        e /= Lanes{v.e[0], v.e[1], v.e[2], 1};
 
         return *this;
     }
 
+    //标量加减不能写到第4个分量上，否则会破坏dot的结果
     inline Vector3d& operator+=(double t)
     {
-        e[0] += t;
-        e[1] += t;
-        e[2] += t;
+        e += Lanes{t, t, t, 0};
 
         return *this;
     }
 
     inline Vector3d& operator-=(double t)
     {
-        e[0] -= t;
-        e[1] -= t;
-        e[2] -= t;
+        e -= Lanes{t, t, t, 0};
 
         return *this;
     }
 
     inline Vector3d& operator*=(double t)
     {
-        e[0] *= t;
-        e[1] *= t;
-        e[2] *= t;
+        e *= t;
 
         return *this;
     }
 
+    //除以标量时先求倒数，再做一次乘法
     inline Vector3d& operator/=(double t)
     {
 
         if (t == 0)
         {
-            std::cerr << "ERROR: division by zero in Vector3d::operator/=(double t)" << std::endl;
-            exit(1);
+            division_by_zero("Vector3d::operator/=(double t)");
         }
 
-        e[0] /= t;
-        e[1] /= t;
-        e[2] /= t;
+        e *= 1.0 / t;
 
         return *this;
     }
 
     inline Vector3d operator+(const Vector3d &v) const
     {
-        return Vector3d(e[0] + v.e[0], e[1] + v.e[1], e[2] + v.e[2]);
+        return Vector3d(e + v.e);
     }
 
     inline Vector3d operator-(const Vector3d &v) const
     {
-        return Vector3d(e[0] - v.e[0], e[1] - v.e[1], e[2] - v.e[2]);
+        return Vector3d(e - v.e);
     }
 
     inline Vector3d operator*(const Vector3d &v) const
     {
-        return Vector3d(e[0] * v.e[0], e[1] * v.e[1], e[2] * v.e[2]);
+        return Vector3d(e * v.e);
     }
 
     inline Vector3d operator/(const Vector3d &v) const
     {
         if (v.e[0] == 0 || v.e[1] == 0 || v.e[2] == 0)
         {
-            std::cerr << "ERROR: division by zero in Vector3d::operator/(const Vector3d &v)" << std::endl;
-            exit(1);
+            division_by_zero("Vector3d::operator/(const Vector3d &v)");
         }
 
-        return Vector3d(e[0] / v.e[0], e[1] / v.e[1], e[2] / v.e[2]);
+        return Vector3d(e / Lanes{v.e[0], v.e[1], v.e[2], 1});
     }
 
     inline Vector3d operator+(double t) const
     {
-        return Vector3d(e[0] + t, e[1] + t, e[2] + t);
+        return Vector3d(e + Lanes{t, t, t, 0});
     }
 
     inline Vector3d operator-(double t) const
     {
-        return Vector3d(e[0] - t, e[1] - t, e[2] - t);
+        return Vector3d(e - Lanes{t, t, t, 0});
     }
 
     inline Vector3d operator*(double t) const
     {
-        return Vector3d(e[0] * t, e[1] * t, e[2] * t);
+        return Vector3d(e * t);
     }
 
     inline Vector3d operator/(double t) const
     {
         if (t == 0)
         {
-            std::cerr << "ERROR: division by zero in Vector3d::operator/(double t)" << std::endl;
-            exit(1);
+            division_by_zero("Vector3d::operator/(double t)");
         }
 
-        return Vector3d(e[0] / t, e[1] / t, e[2] / t);
+        return Vector3d(e * (1.0 / t));
     }
 
+    //一次打包乘法，再把前3个分量加起来
     inline double dot(const Vector3d &v) const
     {
-        return e[0] * v.e[0] + e[1] * v.e[1] + e[2] * v.e[2];
+        Lanes m = e * v.e;
+        return m[0] + m[1] + m[2];
     }
 
+    //a x b = (a * b.yzx - a.yzx * b).yzx，只需要3次重排
     inline Vector3d cross(const Vector3d &v) const
     {
-        return Vector3d(e[1] * v.e[2] - e[2] * v.e[1],
-                        e[2] * v.e[0] - e[0] * v.e[2],
-                        e[0] * v.e[1] - e[1] * v.e[0]);
+        Lanes c = e * yzx(v.e) - yzx(e) * v.e;
+        return Vector3d(yzx(c));
+    }
+
+    inline Vector3d abs() const
+    {
+        return Vector3d(std::fabs(e[0]), std::fabs(e[1]), std::fabs(e[2]));
     }
 
     inline Vector3d unit() const
@@ -0,0 +1,85 @@
+#include "alias_table.hpp"
+
+#include <algorithm>
+
+AliasTable::AliasTable(const std::vector<double> &weights)
+{
+    int n = static_cast<int>(weights.size());
+    if (n == 0)
+    {
+        return;
+    }
+
+    double sum = 0;
+    for (double w : weights)
+    {
+        sum += w;
+    }
+
+    pmf.resize(n);
+    for (int i = 0; i < n; ++i)
+    {
+        pmf[i] = sum > 0 ? weights[i] / sum : 1.0 / n;
+    }
+
+    //把概率放大n倍，小于1的格子需要从大于1的格子借概率
+    probability.resize(n);
+    alias.resize(n);
+
+    std::vector<double> scaled(n);
+    std::vector<uint32_t> small;
+    std::vector<uint32_t> large;
+    for (int i = 0; i < n; ++i)
+    {
+        scaled[i] = pmf[i] * n;
+        if (scaled[i] < 1)
+        {
+            small.push_back(i);
+        }
+        else
+        {
+            large.push_back(i);
+        }
+    }
+
+    while (!small.empty() && !large.empty())
+    {
+        uint32_t s = small.back();
+        small.pop_back();
+        uint32_t l = large.back();
+
+        probability[s] = scaled[s];
+        alias[s] = l;
+
+        scaled[l] = (scaled[l] + scaled[s]) - 1;
+        if (scaled[l] < 1)
+        {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+
+    //剩下的格子只会因为浮点误差偏离1，直接当作1
+    for (uint32_t i : large)
+    {
+        probability[i] = 1;
+        alias[i] = i;
+    }
+    for (uint32_t i : small)
+    {
+        probability[i] = 1;
+        alias[i] = i;
+    }
+}
+
+int AliasTable::sample(double u) const
+{
+    int n = static_cast<int>(probability.size());
+
+    //u的整数部分选格子，小数部分决定是否取别名
+    double scaled = u * n;
+    int i = std::min(static_cast<int>(scaled), n - 1);
+    double remainder = scaled - i;
+
+    return remainder < probability[i] ? i : static_cast<int>(alias[i]);
+}
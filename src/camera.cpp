@@ -1,15 +1,21 @@
 #include "camera.hpp"
 #include "basic_types.hpp"
+#include "hash_grid.hpp"
 #include "hittable.hpp"
 #include "hittable_list.hpp"
 #include "material.hpp"
 #include "pdf.h"
 #include "photo_map.hpp"
-#include "random_generator.hpp"
+#include "sampler.hpp"
+#include "sampling.hpp"
 #include "sphere.hpp"
 #include "triangle.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <cstddef>
 #include <iostream>
+#include <limits>
 #include <omp.h>
 #include <vector>
 
@@ -19,6 +25,10 @@ Camera::Camera(double aspect_ratio, int image_width, int samples_per_pixel, int
     image_height = static_cast<int>(image_width / aspect_ratio);
     image_height = (image_height < 1) ? 1 : image_height;
     image = Image(image_width, image_height);
+    sample_heatmap = Image(image_width, image_height);
+    pixel_statistics.resize(static_cast<size_t>(image_width) * image_height);
+    tiles_x = (image_width + adaptive_tile_size - 1) / adaptive_tile_size;
+    active_tiles.resize(static_cast<size_t>(tiles_x) * ((image_height + adaptive_tile_size - 1) / adaptive_tile_size));
 
     //maybe change these to be parameters
     focal_length = 1.0;
@@ -106,208 +116,2508 @@ void Camera::set_world(std::shared_ptr<Hittable> world, std::vector<std::shared_
 {
     this->world = world;
     this->lights = lights;
+
+    //按功率(面积 × 发光颜色的亮度)建立光源的别名表
+    std::vector<double> powers;
+    light_indices.clear();
+    for (size_t i = 0; i < lights.size(); ++i)
+    {
+        double power = 0;
+        auto material = lights[i]->get_material();
+        if (material)
+        {
+            Color color = material->emitted();
+            power = lights[i]->area() * (0.2126 * color.r() + 0.7152 * color.g() + 0.0722 * color.b());
+        }
+        powers.push_back(power);
+        light_indices[lights[i].get()] = static_cast<int>(i);
+    }
+    light_table = AliasTable(powers);
+    light_bvh = LightBVH(lights, powers);
+
+    irradiance_cache.reset(this->world->bounding_box());
+    radiance_cache.clear();
+    restir_history_valid = false;
+    vpls_valid = false;
+}
+
+void Camera::set_light_bvh(bool enabled)
+{
+    use_light_bvh = enabled;
+}
+
+void Camera::set_path_guiding(bool enabled)
+{
+    path_guiding = enabled;
+}
+
+void Camera::set_radiance_cache(bool enabled, size_t capacity, double cell_size)
+{
+    radiance_cache_enabled = enabled;
+    radiance_cache.reset(enabled ? capacity : 0, cell_size);
+}
+
+void Camera::set_restir_gi(bool enabled)
+{
+    restir_gi = enabled;
+    gi_reservoirs.clear();
+}
+
+void Camera::set_vcm_radius(double radius, double alpha)
+{
+    vcm_radius = radius;
+    vcm_alpha = alpha;
+}
+
+void Camera::set_mlt_mutation(double sigma, double large_step_probability)
+{
+    mlt_sigma = sigma;
+    mlt_large_step_probability = large_step_probability;
+}
+
+void Camera::set_vpl(int paths, int samples)
+{
+    vpl_paths = paths;
+    vpl_samples = samples;
+    vpls_valid = false;
+}
+
+void Camera::set_ambient_occlusion(int samples, double radius)
+{
+    ao_samples = samples;
+    ao_radius = radius;
+}
+
+void Camera::set_sampler(int sampler_type)
+{
+    this->sampler_type = sampler_type;
+}
+
+void Camera::set_samples_per_pixel(int samples_per_pixel)
+{
+    this->samples_per_pixel = std::max(samples_per_pixel, 1);
+}
+
+void Camera::set_adaptive_sampling(int min_samples, double max_error)
+{
+    adaptive_min_samples = std::max(min_samples, 0);
+    adaptive_max_error = max_error;
+}
+
+Ray Camera::get_ray(int i, int j, Sampler &sampler) const
+{
+    //在像素内取一个点，光线的方向就是从相机中心指向这个点的方向
+    double u1, u2;
+    sampler.get_2d(u1, u2);
+    auto pixel_point = pixel00_center + pixel_delta_u * (i + u1 - 0.5) + pixel_delta_v * (j + u2 - 0.5);
+    Direction direction = Direction(pixel_point - center).unit();
+
+    //每个采样在快门时间内取一个时刻，用于动态模糊
+    Ray ray(center, direction);
+    ray.set_time(sampler.get_1d());
+    return ray;
+}
+
+//在p、n处选一个光源，光源BVH会考虑光源的远近和朝向，别名表只考虑功率
+int Camera::sample_light(const Point &p, const Direction &n, double u, double &pmf) const
+{
+    if (use_light_bvh)
+    {
+        return light_bvh.sample(p, n, u, pmf);
+    }
+
+    if (light_table.empty())
+    {
+        return -1;
+    }
+
+    int light = light_table.sample(u);
+    pmf = light_table.get_pmf(light);
+    return light;
+}
+
+//从o沿direction击中object的概率密度，object不是光源时为0
+double Camera::light_pdf(const Hittable *object, const Point &o, const Direction &n, const Direction &direction) const
+{
+    auto it = light_indices.find(object);
+    if (it == light_indices.end())
+    {
+        return 0;
+    }
+
+    double pmf = use_light_bvh ? light_bvh.pmf(o, n, it->second) : light_table.get_pmf(it->second);
+    if (pmf == 0)
+    {
+        return 0;
+    }
+
+    return pmf * lights[it->second]->pdf_value(o, direction);
+}
+
+void Camera::render()
+{
+    if (algorithm == Algorithm::ReSTIR)
+    {
+        render_restir(false);
+        return;
+    }
+    if (algorithm == Algorithm::VCM)
+    {
+        render_vcm(false);
+        return;
+    }
+    if (algorithm == Algorithm::MLT)
+    {
+        render_mlt(false);
+        return;
+    }
+    if (algorithm == Algorithm::VPL)
+    {
+        trace_vpls();
+    }
+
+    auto start_time = std::chrono::steady_clock::now();
+    long long total_samples = 0;
+    long long total_bounces = 0;
+
+    //路径引导的训练用掉一部分样本，最终的图像用剩下的
+    int budget = samples_per_pixel;
+    samples_per_pixel -= train_path_guiding(false);
+
+    auto sampler = Sampler::create(sampler_type, samples_per_pixel, frame_index++);
+
+    //不开自适应采样时只有一遍
+    for (int count = begin_passes(); count > 0; count = next_pass())
+    {
+        for (int j = 0; j < image_height; ++j)
+        {
+            for (int i = 0; i < image_width; ++i)
+            {
+                if (pixel_active(i, j))
+                {
+                    render_pixel(i, j, count, *sampler, total_samples, total_bounces);
+                }
+            }
+            std::clog << "Scanlines remaining: " << image_height - j << '\n';
+        }
+    }
+
+    //将颜色写入图像
+    resolve_image();
+    samples_per_pixel = budget;
+    report_render_stats(start_time, total_samples, total_bounces);
+}
+
+//并行渲染，和上面的区别是使用了OpenMP
+//基本上一模一样，只是加了#pragma omp parallel for schedule(guided)
+void Camera::render_parallel()
+{
+    if (algorithm == Algorithm::ReSTIR)
+    {
+        render_restir(true);
+        return;
+    }
+    if (algorithm == Algorithm::VCM)
+    {
+        render_vcm(true);
+        return;
+    }
+    if (algorithm == Algorithm::MLT)
+    {
+        render_mlt(true);
+        return;
+    }
+    if (algorithm == Algorithm::VPL)
+    {
+        trace_vpls();
+    }
+
+    auto start_time = std::chrono::steady_clock::now();
+
+    int num_threads = omp_get_max_threads();
+    omp_set_num_threads(num_threads);
+
+    long long total_samples = 0;
+    long long total_bounces = 0;
+
+    int budget = samples_per_pixel;
+    samples_per_pixel -= train_path_guiding(true);
+
+    prepare_thread_samplers(num_threads, frame_index++);
+
+    for (int count = begin_passes(); count > 0; count = next_pass())
+    {
+        for (int j = 0; j < image_height; ++j)
+        {
+            #pragma omp parallel for schedule(guided) reduction(+:total_samples, total_bounces)
+            for (int i = 0; i < image_width; ++i)
+            {
+                if (pixel_active(i, j))
+                {
+                    render_pixel(i, j, count, *thread_samplers[omp_get_thread_num()], total_samples, total_bounces);
+                }
+            }
+            std::clog << "Scanlines remaining: " << image_height - j << '\n';
+        }
+    }
+
+    resolve_image();
+    samples_per_pixel = budget;
+    report_render_stats(start_time, total_samples, total_bounces);
+}
+
+//采样器没有共享的状态，每个线程一份
+void Camera::prepare_thread_samplers(int num_threads, uint32_t seed)
+{
+    bool reusable = static_cast<int>(thread_samplers.size()) == num_threads && thread_sampler_type == sampler_type &&
+                    thread_samplers[0]->get_samples_per_pixel() == samples_per_pixel;
+    if (!reusable)
+    {
+        auto prototype = Sampler::create(sampler_type, samples_per_pixel, seed);
+        thread_samplers.clear();
+        for (int t = 0; t < num_threads; ++t)
+        {
+            thread_samplers.push_back(prototype->clone());
+        }
+        thread_sampler_type = sampler_type;
+    }
+
+    for (auto &sampler : thread_samplers)
+    {
+        sampler->set_seed(seed);
+    }
+}
+
+//空间复用读取邻居像素的蓄水池，所以每个样本分成两遍，第二遍开始前所有像素的第一遍都已经完成
+//直接光照空间复用的结果留给下一个样本(或者下一帧)做时间复用，间接光照留下的是时间复用之后的蓄水池
+void Camera::render_restir(bool parallel)
+{
+    auto start_time = std::chrono::steady_clock::now();
+    long long total_samples = 0;
+    long long total_bounces = 0;
+
+    size_t pixel_count = static_cast<size_t>(image_width) * image_height;
+    if (primary_hits.size() != pixel_count || (restir_gi && gi_reservoirs.size() != pixel_count))
+    {
+        primary_hits.assign(pixel_count, PrimaryHit());
+        previous_primary_hits.assign(pixel_count, PrimaryHit());
+        reservoirs.assign(pixel_count, Reservoir<LightSample>());
+        reused_reservoirs.assign(pixel_count, Reservoir<LightSample>());
+        previous_reservoirs.assign(pixel_count, Reservoir<LightSample>());
+        if (restir_gi)
+        {
+            gi_reservoirs.assign(pixel_count, Reservoir<PathSample>());
+            previous_gi_reservoirs.assign(pixel_count, Reservoir<PathSample>());
+        }
+        restir_history_valid = false;
+    }
+    begin_passes();
+
+    //第一遍用像素的采样器，第二遍选邻居的随机数来自独立的采样器，两遍的随机数不相关
+    uint32_t seed = frame_index++;
+    auto prototype = Sampler::create(sampler_type, samples_per_pixel, seed);
+    IndependentSampler reuse_prototype(samples_per_pixel, ~seed);
+    std::vector<std::unique_ptr<Sampler>> samplers;
+    std::vector<std::unique_ptr<Sampler>> reuse_samplers;
+    for (int t = 0; t < omp_get_max_threads(); ++t)
+    {
+        samplers.push_back(prototype->clone());
+        reuse_samplers.push_back(reuse_prototype.clone());
+    }
+
+    for (int s = 0; s < samples_per_pixel; ++s)
+    {
+        #pragma omp parallel for schedule(dynamic) reduction(+:total_bounces) if(parallel)
+        for (int j = 0; j < image_height; ++j)
+        {
+            Sampler &sampler = *samplers[omp_get_thread_num()];
+            for (int i = 0; i < image_width; ++i)
+            {
+                sampler.start_pixel_sample(i, j, s);
+                restir_initial_pass(i, j, sampler, total_bounces);
+            }
+        }
+
+        #pragma omp parallel for schedule(dynamic) if(parallel)
+        for (int j = 0; j < image_height; ++j)
+        {
+            Sampler &sampler = *reuse_samplers[omp_get_thread_num()];
+            for (int i = 0; i < image_width; ++i)
+            {
+                sampler.start_pixel_sample(i, j, s);
+                Color color = restir_spatial_pass(i, j, sampler);
+
+                PixelStatistics &pixel = pixel_statistics[static_cast<size_t>(j) * image_width + i];
+                pixel.sum = pixel.sum + color;
+                double luminance = 0.2126 * color.r() + 0.7152 * color.g() + 0.0722 * color.b();
+                double delta = luminance - pixel.mean;
+                pixel.mean += delta / (pixel.samples + 1);
+                pixel.squared_deviation += delta * (luminance - pixel.mean);
+                ++pixel.samples;
+            }
+        }
+
+        std::swap(previous_reservoirs, reused_reservoirs);
+        std::swap(previous_gi_reservoirs, gi_reservoirs);
+        std::swap(previous_primary_hits, primary_hits);
+        previous_center = center;
+        previous_pixel00_center = pixel00_center;
+        previous_pixel_delta_u = pixel_delta_u;
+        previous_pixel_delta_v = pixel_delta_v;
+        restir_history_valid = true;
+
+        total_samples += static_cast<long long>(pixel_count);
+        std::clog << "Samples remaining: " << samples_per_pixel - s << '\n';
+    }
+
+    resolve_image();
+    report_render_stats(start_time, total_samples, total_bounces);
+}
+
+//每一遍训练结束后细化SD树，下一遍从新学到的分布采样，样本数翻倍
+//训练的图像直接丢掉，最终的图像只用训练好的分布渲染
+int Camera::train_path_guiding(bool parallel)
+{
+    if (!path_guiding || algorithm != Algorithm::PathTracingPDF)
+    {
+        return 0;
+    }
+
+    guiding_tree = SDTree(world->bounding_box());
+    guiding_training = true;
+
+    int used = 0;
+    int iteration = 0;
+    for (int count = 1; used + count <= samples_per_pixel / 4; count *= 2, ++iteration)
+    {
+        auto prototype = Sampler::create(sampler_type, count, frame_index++);
+        std::vector<std::unique_ptr<Sampler>> samplers;
+        for (int t = 0; t < omp_get_max_threads(); ++t)
+        {
+            samplers.push_back(prototype->clone());
+        }
+
+        #pragma omp parallel for schedule(dynamic) if(parallel)
+        for (int j = 0; j < image_height; ++j)
+        {
+            Sampler &sampler = *samplers[omp_get_thread_num()];
+            for (int i = 0; i < image_width; ++i)
+            {
+                for (int s = 0; s < count; ++s)
+                {
+                    sampler.start_pixel_sample(i, j, s);
+                    Ray ray = get_ray(i, j, sampler);
+                    int bounces = 0;
+                    ray_color_pdf(ray, max_depth, *world, sampler, bounces);
+                }
+            }
+        }
+
+        guiding_tree.refine(iteration);
+        used += count;
+    }
+
+    guiding_training = false;
+    std::clog << "Path guiding: " << iteration << " training passes, " << used << " samples/pixel\n";
+    return used;
+}
+
+int Camera::begin_passes()
+{
+    std::fill(pixel_statistics.begin(), pixel_statistics.end(), PixelStatistics());
+    std::fill(active_tiles.begin(), active_tiles.end(), 1);
+
+    bool adaptive = adaptive_min_samples > 0 && adaptive_min_samples < samples_per_pixel;
+    return adaptive ? adaptive_min_samples : samples_per_pixel;
+}
+
+int Camera::next_pass()
+{
+    bool adaptive = adaptive_min_samples > 0 && adaptive_min_samples < samples_per_pixel;
+    if (!adaptive)
+    {
+        return 0;
+    }
+
+    //块的误差取块内像素相对误差的最大值
+    std::vector<double> tile_errors(active_tiles.size(), 0);
+    for (int j = 0; j < image_height; ++j)
+    {
+        for (int i = 0; i < image_width; ++i)
+        {
+            const PixelStatistics &pixel = pixel_statistics[static_cast<size_t>(j) * image_width + i];
+            if (pixel.samples >= samples_per_pixel)
+            {
+                continue;
+            }
+
+            //只有一个样本时无法估计方差
+            double error = std::numeric_limits<double>::infinity();
+            if (pixel.samples > 1)
+            {
+                double standard_error = std::sqrt(pixel.squared_deviation / (pixel.samples - 1) / pixel.samples);
+                error = standard_error / std::max(pixel.mean, adaptive_dark_luminance);
+            }
+            double &tile_error = tile_errors[(j / adaptive_tile_size) * tiles_x + i / adaptive_tile_size];
+            tile_error = std::max(tile_error, error);
+        }
+    }
+
+    int active = 0;
+    for (size_t t = 0; t < active_tiles.size(); ++t)
+    {
+        active_tiles[t] = active_tiles[t] && tile_errors[t] > adaptive_max_error;
+        active += active_tiles[t];
+    }
+    std::clog << "Adaptive sampling: " << active << " / " << active_tiles.size() << " tiles active\n";
+
+    return active > 0 ? adaptive_min_samples : 0;
+}
+
+bool Camera::pixel_active(int i, int j) const
+{
+    return active_tiles[(j / adaptive_tile_size) * tiles_x + i / adaptive_tile_size]
+        && pixel_statistics[static_cast<size_t>(j) * image_width + i].samples < samples_per_pixel;
+}
+
+//像素的颜色就是所有采样点的颜色的平均值，同时用Welford算法累计亮度的均值和方差
+void Camera::render_pixel(int i, int j, int count, Sampler &sampler, long long &samples, long long &bounces)
+{
+    PixelStatistics &pixel = pixel_statistics[static_cast<size_t>(j) * image_width + i];
+    int end = std::min(pixel.samples + count, samples_per_pixel);
+
+    for (int s = pixel.samples; s < end; ++s)
+    {
+        //生成光线，同一像素的各个样本在像素内和快门时间上互相分层
+        sampler.start_pixel_sample(i, j, s);
+        Ray ray = get_ray(i, j, sampler);
+
+        int path_bounces = 0;
+        Color color = trace_path(ray, sampler, path_bounces);
+        pixel.sum = pixel.sum + color;
+        bounces += path_bounces;
+
+        double luminance = 0.2126 * color.r() + 0.7152 * color.g() + 0.0722 * color.b();
+        double delta = luminance - pixel.mean;
+        pixel.mean += delta / (s + 1);
+        pixel.squared_deviation += delta * (luminance - pixel.mean);
+    }
+
+    samples += end - pixel.samples;
+    pixel.samples = end;
+}
+
+void Camera::resolve_image()
+{
+    for (int j = 0; j < image_height; ++j)
+    {
+        for (int i = 0; i < image_width; ++i)
+        {
+            const PixelStatistics &pixel = pixel_statistics[static_cast<size_t>(j) * image_width + i];
+
+            //计算平均值
+            image.set_pixel(i, j, pixel.sum / pixel.samples);
+
+            double t = static_cast<double>(pixel.samples) / samples_per_pixel;
+            sample_heatmap.set_pixel(i, j, Color(255 * t, 0, 255 * (1 - t)));
+        }
+    }
+}
+
+Color Camera::trace_path(const Ray &ray, Sampler &sampler, int &bounces)
+{
+    switch (algorithm)
+    {
+        case Algorithm::PathTracing:
+            return ray_color(ray, max_depth, *world, sampler, bounces);
+        case Algorithm::PathTracingPDF:
+            return ray_color_pdf(ray, max_depth, *world, sampler, bounces);
+        case Algorithm::PathTracingNEE:
+            return ray_color_nee(ray, max_depth, *world, sampler, bounces);
+        case Algorithm::IrradianceCaching:
+            return ray_color_irradiance_cache(ray, max_depth, *world, sampler, bounces);
+        case Algorithm::VPL:
+            return ray_color_vpl(ray, max_depth, *world, sampler, bounces);
+        case Algorithm::Normals:
+        case Algorithm::Albedo:
+        case Algorithm::AmbientOcclusion:
+        case Algorithm::DirectLighting:
+            return ray_color_preview(ray, max_depth, *world, sampler, bounces);
+        case Algorithm::PhotonMapping:
+            //TODO
+            return Color(0, 0, 0);
+        default:
+            return Color(0, 0, 0);
+    }
+}
+
+//输出渲染耗时和吞吐量，用来比较不同场景设置(比如网格的顶点格式)的性能
+//以及每条路径的平均反弹次数，用来观察俄罗斯轮盘赌的效果
+void Camera::report_render_stats(std::chrono::steady_clock::time_point start_time, long long total_samples, long long total_bounces) const
+{
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    double samples = static_cast<double>(total_samples);
+
+    std::clog << "Render time: " << seconds << " s, " << samples / seconds / 1e6 << " M samples/s, "
+              << total_bounces / samples << " bounces/path, "
+              << samples / (static_cast<double>(image_width) * image_height) << " samples/pixel\n";
+}
+
+//镜面和光泽表面上的辐亮度随方向变化，不能按位置和法线缓存
+//cell为-1时这个顶点既不查询也不记录，所以也不会更新缓存
+bool Camera::lookup_radiance_cache(const HitRecord &rec, int bounce, int64_t &cell, Color &cached)
+{
+    cell = -1;
+    if (!radiance_cache_enabled || !rec.material->is_diffuse())
+    {
+        return false;
+    }
+
+    cell = radiance_cache.locate(rec.p, rec.normal);
+    return bounce >= radiance_cache_min_bounces && radiance_cache.lookup(cell, radiance_cache_min_samples, cached);
+}
+
+//俄罗斯轮盘赌：路径的throughput小于1以后，按1 - throughput的概率提前结束路径
+//没有结束的路径把throughput除以存活概率，所以结果仍然是无偏的
+//返回false表示路径被终止
+bool Camera::russian_roulette(Color &throughput, int bounce, Sampler &sampler) const
+{
+    double u = sampler.get_1d();
+
+    if (bounce < russian_roulette_min_bounces)
+    {
+        return true;
+    }
+
+    double max_component = std::max(throughput.r(), std::max(throughput.g(), throughput.b()));
+    if (max_component >= 1)
+    {
+        return true;
+    }
+
+    double q = std::max(0.05, 1 - max_component);
+    if (u < q)
+    {
+        return false;
+    }
+
+    throughput = throughput / (1 - q);
+    return true;
+}
+
+//通过路径追踪来计算像素的颜色
+//每次碰撞后，根据材质的散射函数随即获取一个散射光线
+//用循环代替递归，throughput记录路径到目前为止的颜色衰减
+Color Camera::ray_color(const Ray &ray, int depth, const Hittable &world, Sampler &sampler, int &bounces)
+{
+    Color radiance(0, 0, 0);
+    Color throughput(1, 1, 1);
+    Ray current_ray = ray;
+
+    for (bounces = 0; ; ++bounces)
+    {
+        if (bounces >= depth)
+        {
+            //如果达到最大深度，返回溢出颜色
+            return radiance + throughput * overflows_color;
+        }
+
+        HitRecord rec;
+
+        if (!world.hit(current_ray, 0, rec))
+        {
+            //如果没有碰撞，返回背景色
+            Color background = Color(100, 100, 100);
+            return radiance + throughput * background;
+        }
+
+        //如果碰撞，计算碰撞点是如何散射的光线
+        ScatterRecord srec;
+        rec.material->scatter(current_ray, rec, srec, sampler);
+
+        //像素的颜色 = 碰撞点发出的光线的颜色 + 碰撞点反射的光线的颜色 * 碰撞点的颜色衰减
+        radiance = radiance + throughput * srec.emitted;
+        throughput = throughput * srec.attenuation / 255.0;
+        current_ray = srec.scattered_ray;
+
+        if (!russian_roulette(throughput, bounces, sampler))
+        {
+            ++bounces;
+            return radiance;
+        }
+    }
+}
+
+//通过pdf来计算像素的颜色
+//与ray_color的区别是，我们只根据材料的特性来随即生成散射光线
+//而是根据pdf来生成散射光线，也就是重要性采样
+Color Camera::ray_color_pdf(const Ray &ray, int depth, const Hittable &world, Sampler &sampler, int &bounces)
+{
+    Color radiance(0, 0, 0);
+    Color throughput(1, 1, 1);
+    Ray current_ray = ray;
+
+    //训练路径引导时记下每个顶点的位置、采样的方向和此时的radiance、throughput，
+    //路径结束后用之后累计的radiance除以throughput得到这个方向上入射辐亮度的估计
+    //超过max_guiding_vertices的顶点不记录，这样不需要分配内存
+    struct GuidingVertex
+    {
+        DTree *tree;
+        Direction direction;
+        Color radiance;
+        Color throughput;
+        double pdf;
+    };
+    static constexpr int max_guiding_vertices = 32;
+    GuidingVertex vertices[max_guiding_vertices];
+    int vertex_count = 0;
+    bool guided = path_guiding && !guiding_tree.empty();
+
+    //使用辐亮度缓存时记下每个非镜面顶点，路径结束后写入缓存
+    RadianceCacheVertex cache_vertices[max_radiance_cache_vertices];
+    int cache_vertex_count = 0;
+
+    //路径结束时的颜色，深度超限时的overflows_color只是标记，不作为入射辐亮度记录，也不写入缓存
+    Color result;
+    Color recorded;
+
+    for (bounces = 0; ; ++bounces)
+    {
+        if (bounces >= depth)
+        {
+            result = radiance + throughput * overflows_color;
+            recorded = radiance;
+            break;
+        }
+
+        HitRecord rec;
+
+        if (!world.hit(current_ray, 0, rec))
+        {
+            //如果没有碰撞，返回背景色
+            result = radiance + throughput * background_color;
+            recorded = result;
+            break;
+        }
+
+        auto srec = ScatterRecord();
+        rec.material->scatter(current_ray, rec, srec, sampler);
+        radiance = radiance + throughput * srec.emitted;
+
+        //在pdf采样中，我们放弃了记录光源之间的光照。
+        //因为光源可能会对自己采样，会导致光线与自己相交。
+        if (srec.emitted.r() > 0 || srec.emitted.g() > 0 || srec.emitted.b() > 0) {
+            ++bounces;
+            result = radiance;
+            recorded = result;
+            break;
+        }
+
+        int64_t cell;
+        Color cached;
+        if (lookup_radiance_cache(rec, bounces, cell, cached)) {
+            ++bounces;
+            result = radiance + throughput * cached;
+            recorded = result;
+            break;
+        }
+        if (cell >= 0 && cache_vertex_count < max_radiance_cache_vertices) {
+            cache_vertices[cache_vertex_count++] = RadianceCacheVertex{cell, radiance, throughput};
+        }
+
+        //光源的pdf和材质的pdf各占一半
+        //使用路径引导时，学到的分布占一半，材质和光源分掉另一半
+        //所有pdf都在栈上，每次反弹不分配内存
+        MaterialPDF material_pdf(current_ray, rec, srec.scattered_ray.get_direction());
+        LightPDF light_pdf(rec.p, lights, light_table);
+        GuidedPDF guided_pdf(guided ? guiding_tree.sampling_tree(rec.p) : DTree::empty_tree());
+
+        MixturePDF mixture_pdf;
+        if (guided) {
+            mixture_pdf.add(guided_pdf, 0.5);
+            if (light_table.empty()) {
+                mixture_pdf.add(material_pdf, 0.5);
+            } else {
+                mixture_pdf.add(material_pdf, 0.25);
+                mixture_pdf.add(light_pdf, 0.25);
+            }
+        } else if (light_table.empty()) {
+            mixture_pdf.add(material_pdf, 1.0);
+        } else {
+            mixture_pdf.add(material_pdf, 0.5);
+            mixture_pdf.add(light_pdf, 0.5);
+        }
+
+        //光源的pdf生成的方向没有归一化，scattering_pdf需要单位向量来计算余弦
+        auto scattered_direction = mixture_pdf.generate(sampler).unit();
+
+        Ray scattered_ray = rec.spawn_ray(scattered_direction, current_ray.get_time());
+
+        double pdf_value = mixture_pdf.value(scattered_direction);
+
+        //光线起点已经偏移到误差范围之外，光源的pdf不会再因为求交误差变成0
+        //剩下的0或NaN只可能来自退化的采样，直接丢掉这条路径的间接光
+        if (!(pdf_value > 0)) {
+            ++bounces;
+            result = radiance;
+            recorded = result;
+            break;
+        }
+
+        //重要性采样
+        throughput = throughput * rec.material->evaluate(current_ray, rec, scattered_ray) / pdf_value;
+        current_ray = scattered_ray;
+
+        //记录轮盘赌之前的throughput，路径被终止时入射辐亮度的估计是0，存活时除以存活概率，期望不变
+        if (guiding_training && vertex_count < max_guiding_vertices) {
+            vertices[vertex_count++] = GuidingVertex{&guiding_tree.building_tree(rec.p), scattered_direction, radiance, throughput, pdf_value};
+        }
+
+        if (!russian_roulette(throughput, bounces, sampler))
+        {
+            ++bounces;
+            result = radiance;
+            recorded = result;
+            break;
+        }
+    }
+
+    //记录的值是入射辐亮度的亮度除以采样这个方向的pdf
+    for (int k = 0; k < vertex_count; ++k) {
+        const GuidingVertex &vertex = vertices[k];
+        Color incident = recorded - vertex.radiance;
+        const Color &t = vertex.throughput;
+        double value = (t.r() > 0 ? 0.2126 * incident.r() / t.r() : 0)
+                     + (t.g() > 0 ? 0.7152 * incident.g() / t.g() : 0)
+                     + (t.b() > 0 ? 0.0722 * incident.b() / t.b() : 0);
+        vertex.tree->record(vertex.direction, value / vertex.pdf);
+    }
+
+    if (radiance_cache_enabled) {
+        radiance_cache.update(cache_vertices, cache_vertex_count, recorded);
+    }
+
+    return result;
+}
+
+//多重重要性采样的power heuristic，beta = 2
+static double power_heuristic(double pdf_f, double pdf_g)
+{
+    double f = pdf_f * pdf_f;
+    double g = pdf_g * pdf_g;
+    return (f + g > 0) ? f / (f + g) : 0;
+}
+
+//选一个光源并对它采样，阴影光线先击中的正好是这个光源时，才是它的直接光照
+//被其他光源挡住的样本由那个光源自己被选中时负责，所以只需要计算选中光源的pdf
+Color Camera::estimate_direct_light(const Ray &ray_in, const HitRecord &rec, const Hittable &world, Sampler &sampler, bool mis) const
+{
+    double light_pmf = 0;
+    int light = sample_light(rec.p, rec.normal, sampler.get_1d(), light_pmf);
+    if (light < 0)
+    {
+        sampler.skip_dimensions(light_sample_dimensions - 1);
+        return Color(0, 0, 0);
+    }
+
+    //采样时直接得到方向的pdf，不用再和光源求交
+    double direction_pdf = 0;
+    Direction light_direction = lights[light]->sample_direction(rec.p, sampler, direction_pdf).unit();
+    Ray shadow_ray = rec.spawn_ray(light_direction, ray_in.get_time());
+
+    HitRecord light_rec;
+    if (!(direction_pdf > 0) || !world.hit(shadow_ray, 0, light_rec) || light_rec.object != lights[light].get())
+    {
+        return Color(0, 0, 0);
+    }
+
+    Color light_emitted = light_rec.material->emitted();
+    double light_pdf_value = light_pmf * direction_pdf;
+    double bsdf_pdf_value = rec.material->scattering_pdf(ray_in, rec, shadow_ray);
+    if (!(light_pdf_value > 0) || !(bsdf_pdf_value > 0))
+    {
+        return Color(0, 0, 0);
+    }
+
+    double weight = mis ? power_heuristic(light_pdf_value, bsdf_pdf_value) : 1;
+    return rec.material->evaluate(ray_in, rec, shadow_ray) * light_emitted * (weight / light_pdf_value);
+}
+
+//下一事件估计(next event estimation)
+//每个漫反射顶点都向光源采样一条阴影光线，同时按材质采样下一个方向
+//两种采样都可能得到同一个光源的贡献，用power heuristic给它们分配权重
+//这样小光源不会只靠偶然击中，也不会因为直接返回emitted而产生大量噪点
+Color Camera::ray_color_nee(const Ray &ray, int depth, const Hittable &world, Sampler &sampler, int &bounces)
+{
+    Color radiance(0, 0, 0);
+    Color throughput(1, 1, 1);
+    Ray current_ray = ray;
+
+    //上一个顶点的位置和材质采样的pdf，用来给击中光源的路径计算MIS权重
+    //相机光线和镜面反射后击中光源时没有别的采样方式，权重是1
+    Point previous_point;
+    Direction previous_normal;
+    double previous_bsdf_pdf = 0;
+    bool previous_specular = true;
+
+    //使用辐亮度缓存时记下每个非镜面顶点，路径结束后写入缓存
+    RadianceCacheVertex cache_vertices[max_radiance_cache_vertices];
+    int cache_vertex_count = 0;
+
+    //路径结束时的颜色，深度超限时的overflows_color只是标记，不写入缓存
+    Color result;
+    Color recorded;
+
+    for (bounces = 0; ; ++bounces)
+    {
+        if (bounces >= depth)
+        {
+            result = radiance + throughput * overflows_color;
+            recorded = radiance;
+            break;
+        }
+
+        HitRecord rec;
+
+        if (!world.hit(current_ray, 0, rec))
+        {
+            result = radiance + throughput * background_color;
+            recorded = result;
+            break;
+        }
+
+        Color emitted = rec.material->emitted();
+        if (emitted.r() > 0 || emitted.g() > 0 || emitted.b() > 0)
+        {
+            //和ray_color_pdf一样，光源不再继续散射
+            double weight = 1;
+            if (!previous_specular)
+            {
+                weight = power_heuristic(previous_bsdf_pdf, light_pdf(rec.object, previous_point, previous_normal, current_ray.get_direction()));
+            }
+
+            ++bounces;
+            result = radiance + throughput * emitted * weight;
+            recorded = result;
+            break;
+        }
+
+        //缓存的辐亮度已经包含这个顶点的直接光照，所以在光源采样之前结束
+        int64_t cell;
+        Color cached;
+        if (lookup_radiance_cache(rec, bounces, cell, cached))
+        {
+            ++bounces;
+            result = radiance + throughput * cached;
+            recorded = result;
+            break;
+        }
+        if (cell >= 0 && cache_vertex_count < max_radiance_cache_vertices)
+        {
+            cache_vertices[cache_vertex_count++] = RadianceCacheVertex{cell, radiance, throughput};
+        }
+
+        //镜面不对光源采样，但仍然跳过光源采样的维度，每次反弹用掉的维度数不变
+        bool specular = rec.material->is_specular();
+
+        if (!specular)
+        {
+            radiance = radiance + throughput * estimate_direct_light(current_ray, rec, world, sampler, true);
+        }
+        else
+        {
+            sampler.skip_dimensions(light_sample_dimensions);
+        }
+
+        ScatterRecord srec;
+        rec.material->scatter(current_ray, rec, srec, sampler);
+
+        //按材质采样下一个方向，scatter已经按材质的分布采样，所以throughput只乘以颜色衰减
+        previous_point = rec.p;
+        previous_normal = rec.normal;
+        previous_bsdf_pdf = specular ? 0 : rec.material->scattering_pdf(current_ray, rec, srec.scattered_ray);
+        previous_specular = specular;
+
+        throughput = throughput * srec.attenuation / 255.0;
+        current_ray = srec.scattered_ray;
+
+        if (!russian_roulette(throughput, bounces, sampler))
+        {
+            ++bounces;
+            result = radiance;
+            recorded = result;
+            break;
+        }
+    }
+
+    if (radiance_cache_enabled)
+    {
+        radiance_cache.update(cache_vertices, cache_vertex_count, recorded);
+    }
+
+    return result;
+}
+
+//辐照度缓存(Ward等人)：漫反射表面上的间接光照变化平缓，所以只在稀疏的点上计算辐照度，其他点从附近的记录插值
+//相机光线按材质采样穿过镜面和光泽表面(光泽表面同时对光源采样)，在第一个漫反射表面上：
+//直接光照每个样本都用光源采样计算，保证阴影的细节；间接光照是albedo / pi乘以缓存中插值得到的辐照度
+Color Camera::ray_color_irradiance_cache(const Ray &ray, int depth, const Hittable &world, Sampler &sampler, int &bounces)
+{
+    Color radiance(0, 0, 0);
+    Color throughput(1, 1, 1);
+    Ray current_ray = ray;
+
+    //和ray_color_nee一样，光泽表面上击中光源的路径按MIS加权，镜面反射后击中光源时权重是1
+    Point previous_point;
+    Direction previous_normal;
+    double previous_bsdf_pdf = 0;
+    bool previous_specular = true;
+
+    for (bounces = 0; ; ++bounces)
+    {
+        if (bounces >= depth)
+        {
+            return radiance + throughput * overflows_color;
+        }
+
+        HitRecord rec;
+
+        if (!world.hit(current_ray, 0, rec))
+        {
+            return radiance + throughput * background_color;
+        }
+
+        //光源不再继续散射
+        Color emitted = rec.material->emitted();
+        if (emitted.r() > 0 || emitted.g() > 0 || emitted.b() > 0)
+        {
+            double weight = 1;
+            if (!previous_specular)
+            {
+                weight = power_heuristic(previous_bsdf_pdf, light_pdf(rec.object, previous_point, previous_normal, current_ray.get_direction()));
+            }
+
+            ++bounces;
+            return radiance + throughput * emitted * weight;
+        }
+
+        //漫反射表面的间接光照来自缓存，不会再击中光源，所以直接光照不需要MIS
+        //镜面不对光源采样，但仍然跳过光源采样的维度，每次反弹用掉的维度数不变
+        bool diffuse = rec.material->is_diffuse();
+        bool specular = rec.material->is_specular();
+        if (!specular)
+        {
+            radiance = radiance + throughput * estimate_direct_light(current_ray, rec, world, sampler, !diffuse);
+        }
+        else
+        {
+            sampler.skip_dimensions(light_sample_dimensions);
+        }
+
+        ScatterRecord srec;
+        rec.material->scatter(current_ray, rec, srec, sampler);
+
+        //辐照度乘以albedo / pi只对漫反射成立，镜面和光泽表面按材质采样继续追踪
+        //光泽表面和ray_color_nee一样对光源采样，小光源不会只靠偶然击中
+        if (!diffuse)
+        {
+            previous_point = rec.p;
+            previous_normal = rec.normal;
+            previous_bsdf_pdf = specular ? 0 : rec.material->scattering_pdf(current_ray, rec, srec.scattered_ray);
+            previous_specular = specular;
+
+            throughput = throughput * srec.attenuation / 255.0;
+            current_ray = srec.scattered_ray;
+            continue;
+        }
+
+        //缓存里没有有效的记录时计算一个新的，计算过程不持有锁，其他线程可以同时查询和插入
+        Color irradiance;
+        if (!irradiance_cache.lookup(rec.p, rec.normal, irradiance))
+        {
+            IrradianceRecord record = compute_irradiance_record(rec, current_ray.get_time(), depth - bounces - 1, world, sampler);
+            irradiance = record.irradiance;
+            irradiance_cache.insert(record);
+        }
+
+        ++bounces;
+        return radiance + throughput * srec.attenuation / 255.0 * irradiance / M_PI;
+    }
+}
+
+//半球按sin^2(theta)和phi等分成M * N格，每格一条余弦分布的光线，辐照度E = pi / (M * N) * sum(L)
+//梯度用Ward和Heckbert的公式，根据相邻格子之间辐亮度的差和击中距离估计：
+//旋转梯度 = pi / (M * N) * sum_k(v_k * sum_j(tan(theta_j) * L_jk))，外推时和n_i x n点乘
+//平移梯度 = sum_k(u_k * 2pi / N * sum_j(sin(theta_j-) * cos^2(theta_j-) / min(r) * (L_jk - L_j-1,k))
+//              + v_k- * sum_j((sin(theta_j+) - sin(theta_j-)) / min(r) * (L_jk - L_j,k-1)))
+//半球光线第一次击中光源时记为0，这部分由直接光照负责
+IrradianceRecord Camera::compute_irradiance_record(const HitRecord &rec, double time, int depth, const Hittable &world, Sampler &sampler)
+{
+    const int m = irradiance_theta_strata;
+    const int n = irradiance_phi_strata;
+    OrthonormalBasis basis(rec.normal);
+
+    //每条半球光线的随机数来自一个独立的采样器，种子从像素的采样器取，记录之间互不相关
+    IndependentSampler record_sampler(1, static_cast<uint32_t>(sampler.get_1d() * 4294967296.0));
+
+    std::vector<Color> radiances(static_cast<size_t>(m) * n);
+    std::vector<double> distances(static_cast<size_t>(m) * n);
+    //每条光线的tan(theta)，theta在格子内随机，同一行的各条光线也不相同
+    std::vector<double> tangents(static_cast<size_t>(m) * n);
+    double inverse_distance_sum = 0;
+
+    for (int j = 0; j < m; ++j)
+    {
+        for (int k = 0; k < n; ++k)
+        {
+            record_sampler.start_pixel_sample(j, k, 0);
+            double u1, u2;
+            record_sampler.get_2d(u1, u2);
+
+            double sin2_theta = (j + u1) / m;
+            double sin_theta = std::sqrt(sin2_theta);
+            double cos_theta = std::sqrt(std::max(0.0, 1 - sin2_theta));
+            double phi = 2 * M_PI * (k + u2) / n;
+            Direction direction = basis.to_world(Direction(sin_theta * std::cos(phi), sin_theta * std::sin(phi), cos_theta));
+            Ray hemisphere_ray = rec.spawn_ray(direction, time);
+
+            Color radiance(0, 0, 0);
+            double distance = std::numeric_limits<double>::infinity();
+            HitRecord hit;
+            //击中非光源时ray_color_nee还要从头追踪这条光线，所以用一份拷贝求交，不收缩它的t_max
+            if (world.hit(Ray(hemisphere_ray), 0, hit))
+            {
+                distance = hit.t;
+                Color emitted = hit.material->emitted();
+                if (depth > 0 && emitted.r() <= 0 && emitted.g() <= 0 && emitted.b() <= 0)
+                {
+                    int path_bounces = 0;
+                    radiance = ray_color_nee(hemisphere_ray, depth, world, record_sampler, path_bounces);
+                }
+                inverse_distance_sum += 1 / distance;
+            }
+            else
+            {
+                radiance = background_color;
+            }
+
+            radiances[j * n + k] = radiance;
+            distances[j * n + k] = distance;
+            tangents[j * n + k] = sin_theta / std::max(cos_theta, 1e-3);
+        }
+    }
+
+    IrradianceRecord record;
+    record.position = rec.p;
+    record.normal = rec.normal;
+    record.radius = inverse_distance_sum > 0 ? m * n / inverse_distance_sum : std::numeric_limits<double>::infinity();
+
+    Color sum(0, 0, 0);
+    for (const Color &radiance : radiances)
+    {
+        sum = sum + radiance;
+    }
+    record.irradiance = sum * (M_PI / (m * n));
+
+    for (int c = 0; c < 3; ++c)
+    {
+        auto channel = [&](int j, int k) {
+            const Color &radiance = radiances[j * n + ((k + n) % n)];
+            return c == 0 ? radiance.r() : (c == 1 ? radiance.g() : radiance.b());
+        };
+        auto min_distance = [&](int j0, int k0, int j1, int k1) {
+            return std::min(distances[j0 * n + ((k0 + n) % n)], distances[j1 * n + ((k1 + n) % n)]);
+        };
+
+        Direction rotation(0, 0, 0);
+        Direction translation(0, 0, 0);
+        for (int k = 0; k < n; ++k)
+        {
+            //phi_k取格子中心，phi_k-是格子的起始边
+            double phi = 2 * M_PI * (k + 0.5) / n;
+            double phi_minus = 2 * M_PI * k / n;
+            Direction u_k = basis.to_world(Direction(std::cos(phi), std::sin(phi), 0));
+            Direction v_k = basis.to_world(Direction(-std::sin(phi), std::cos(phi), 0));
+            Direction v_minus = basis.to_world(Direction(-std::sin(phi_minus), std::cos(phi_minus), 0));
+
+            double rotation_sum = 0;
+            double theta_sum = 0;
+            double phi_sum = 0;
+            for (int j = 0; j < m; ++j)
+            {
+                rotation_sum += tangents[j * n + k] * channel(j, k);
+
+                double sin_minus = std::sqrt(static_cast<double>(j) / m);
+                double sin_plus = std::sqrt(static_cast<double>(j + 1) / m);
+                if (j > 0)
+                {
+                    double cos2_minus = 1 - static_cast<double>(j) / m;
+                    theta_sum += sin_minus * cos2_minus / min_distance(j, k, j - 1, k) * (channel(j, k) - channel(j - 1, k));
+                }
+                phi_sum += (sin_plus - sin_minus) / min_distance(j, k, j, k - 1) * (channel(j, k) - channel(j, k - 1));
+            }
+
+            rotation = rotation + v_k * rotation_sum;
+            translation = translation + u_k * (theta_sum * 2 * M_PI / n) + v_minus * phi_sum;
+        }
+        record.rotation_gradient[c] = rotation * (M_PI / (m * n));
+        record.translation_gradient[c] = translation;
+    }
+
+    return record;
+}
+
+//第一遍：主光线击中非镜面的表面时，生成初始候选并和上一次采样的蓄水池合并，
+//再按材质采样一个方向追踪间接光照，这条路径第一次击中光源时不计入，那部分由蓄水池负责
+//其他情况(没有击中、击中光源或者镜面)整条路径交给ray_color_nee
+void Camera::restir_initial_pass(int i, int j, Sampler &sampler, long long &bounces)
+{
+    size_t index = static_cast<size_t>(j) * image_width + i;
+    PrimaryHit &hit = primary_hits[index];
+    Reservoir<LightSample> &reservoir = reservoirs[index];
+    reservoir = Reservoir<LightSample>();
+    hit.valid = false;
+
+    Ray ray = get_ray(i, j, sampler);
+    HitRecord rec;
+    int path_bounces = 0;
+    //下面几种情况ray_color_nee要从头追踪这条光线，所以用一份拷贝求交，不收缩它的t_max
+    if (!world->hit(Ray(ray), 0, rec) || rec.material->is_specular())
+    {
+        hit.radiance = ray_color_nee(ray, max_depth, *world, sampler, path_bounces);
+        bounces += path_bounces;
+        return;
+    }
+    Color emitted = rec.material->emitted();
+    if (emitted.r() > 0 || emitted.g() > 0 || emitted.b() > 0)
+    {
+        hit.radiance = ray_color_nee(ray, max_depth, *world, sampler, path_bounces);
+        bounces += path_bounces;
+        return;
+    }
+
+    ScatterRecord srec;
+    rec.material->scatter(ray, rec, srec, sampler);
+    hit.rec = rec;
+    hit.ray = ray;
+    hit.radiance = Color(0, 0, 0);
+    hit.valid = true;
+
+    //初始候选要便宜，好的分布交给重采样：选一个光源，在它的表面上均匀取一个点，面积测度下的pdf是pmf / area
+    //光源一半按功率从别名表选，一半均匀地选，最亮的几个光源都在着色点背后时其他光源也能成为候选
+    //从着色点看到的不是这个点(比如球形光源的背面)时，它的贡献一定是0，权重也记为0
+    int light_count = light_table.size();
+    for (int k = 0; k < restir_candidates; ++k)
+    {
+        double u_light = sampler.get_1d();
+        int light = -1;
+        if (light_count > 0)
+        {
+            light = u_light < 0.5 ? light_table.sample(u_light * 2) : std::min(static_cast<int>((u_light - 0.5) * 2 * light_count), light_count - 1);
+        }
+        Point point = light >= 0 ? lights[light]->random(sampler) : rec.p;
+        double u = sampler.get_1d();
+
+        LightSample candidate;
+        double weight = 0;
+        Direction to_light = point - rec.p;
+        double distance = to_light.length();
+        HitRecord light_rec;
+        if (light >= 0 && distance > 0 && lights[light]->hit(rec.spawn_ray(to_light / distance, ray.get_time()), 0, light_rec)
+            && std::fabs(light_rec.t - distance) <= 1e-3 * distance)
+        {
+            candidate = LightSample{light_rec.p, light_rec.normal, light_rec.material->emitted(), light};
+            double area_pdf = (0.5 * light_table.get_pmf(light) + 0.5 / light_count) / lights[light]->area();
+            Color contribution;
+            weight = area_pdf > 0 ? restir_target(hit, candidate, contribution) / area_pdf : 0;
+        }
+        reservoir.update(candidate, weight, u);
+    }
+    Color contribution;
+    reservoir.finalize(restir_target(hit, reservoir.sample, contribution));
+
+    //时间复用：主交点重投影到上一次的像素，那里是同一个表面时合并它的蓄水池
+    int previous_i, previous_j;
+    int64_t previous_index = -1;
+    if (restir_history_valid && reproject(rec.p, previous_i, previous_j)
+        && restir_similar(hit, previous_primary_hits[static_cast<size_t>(previous_j) * image_width + previous_i]))
+    {
+        previous_index = static_cast<int64_t>(previous_j) * image_width + previous_i;
+    }
+    if (previous_index >= 0)
+    {
+        const PrimaryHit &previous_hit = previous_primary_hits[previous_index];
+        const Reservoir<LightSample> &previous = previous_reservoirs[previous_index];
+        int history = std::min(previous.M, restir_temporal_history * restir_candidates);
+        Reservoir<LightSample> combined;
+        combined.merge(reservoir, restir_target(hit, reservoir.sample, contribution), sampler.get_1d(), reservoir.M);
+        combined.merge(previous, restir_target(hit, previous.sample, contribution), sampler.get_1d(), history);
+        int count = reservoir.M + (restir_target(previous_hit, combined.sample, contribution) > 0 ? history : 0);
+        combined.finalize(restir_target(hit, combined.sample, contribution), count);
+        reservoir = combined;
+    }
+
+    //间接光照
+    if (restir_gi)
+    {
+        restir_gi_initial_pass(index, srec.scattered_ray, previous_index, sampler, path_bounces);
+        bounces += path_bounces + 1;
+        return;
+    }
+    HitRecord next;
+    if (max_depth > 1 && world->hit(Ray(srec.scattered_ray), 0, next))
+    {
+        Color next_emitted = next.material->emitted();
+        if (next_emitted.r() <= 0 && next_emitted.g() <= 0 && next_emitted.b() <= 0)
+        {
+            hit.radiance = srec.attenuation / 255.0 * ray_color_nee(srec.scattered_ray, max_depth - 1, *world, sampler, path_bounces);
+        }
+    }
+    else if (max_depth > 1)
+    {
+        hit.radiance = srec.attenuation / 255.0 * background_color;
+    }
+    bounces += path_bounces + 1;
+}
+
+//ReSTIR GI的第一遍：沿材质采样的方向追踪一条次级路径作为唯一的候选，再和上一次采样的蓄水池合并
+//次级路径第一次击中光源时辐亮度记为0，那部分由直接光照的蓄水池负责
+void Camera::restir_gi_initial_pass(size_t index, const Ray &scattered, int64_t previous_index, Sampler &sampler, int &bounces)
+{
+    const PrimaryHit &hit = primary_hits[index];
+    Reservoir<PathSample> &reservoir = gi_reservoirs[index];
+    reservoir = Reservoir<PathSample>();
+
+    Direction direction = scattered.get_direction();
+    PathSample candidate{hit.rec.p + direction * 1000, -direction, Color(0, 0, 0)};
+    HitRecord next;
+    if (max_depth > 1 && world->hit(Ray(scattered), 0, next))
+    {
+        candidate.position = next.p;
+        candidate.normal = next.material->is_diffuse() ? next.normal : Direction(0, 0, 0);
+        Color next_emitted = next.material->emitted();
+        if (next_emitted.r() <= 0 && next_emitted.g() <= 0 && next_emitted.b() <= 0)
+        {
+            candidate.radiance = ray_color_nee(scattered, max_depth - 1, *world, sampler, bounces);
+        }
+    }
+    else if (max_depth > 1)
+    {
+        candidate.radiance = background_color;
+    }
+
+    //非镜面材质按scattering_pdf采样方向，它就是候选在立体角测度下的pdf
+    Color contribution;
+    double pdf = hit.rec.material->scattering_pdf(hit.ray, hit.rec, scattered);
+    double target = restir_gi_target(hit, candidate, contribution);
+    reservoir.update(candidate, pdf > 0 ? target / pdf : 0, sampler.get_1d());
+    reservoir.finalize(target);
+
+    //上一次的样本是另一个主交点生成的，换到这里要乘上雅可比行列式
+    if (previous_index < 0)
+    {
+        return;
+    }
+
+    //雅可比行列式超出范围时只把权重记为0，上一次的M照常计入，跳过它会让有样本的蓄水池比没有样本的更常被合并，结果偏亮
+    //选中的样本在上一次的主交点上目标函数大于0，并且从那里换过来时雅可比行列式在范围内，才可能来自上一次的蓄水池
+    const PrimaryHit &previous_hit = previous_primary_hits[previous_index];
+    const Reservoir<PathSample> &previous = previous_gi_reservoirs[previous_index];
+    int history = std::min(previous.M, restir_temporal_history);
+    Reservoir<PathSample> combined;
+    combined.merge(reservoir, restir_gi_target(hit, reservoir.sample, contribution), sampler.get_1d(), reservoir.M);
+    combined.merge(previous, restir_gi_target(hit, previous.sample, contribution) * restir_gi_jacobian(previous_hit, hit, previous.sample),
+                   sampler.get_1d(), history);
+    bool reachable = restir_gi_target(previous_hit, combined.sample, contribution) > 0 && restir_gi_jacobian(previous_hit, hit, combined.sample) > 0;
+    int count = reservoir.M + (reachable ? history : 0);
+    combined.finalize(restir_gi_target(hit, combined.sample, contribution), count);
+    reservoir = combined;
+}
+
+//第二遍：和半径内随机的几个邻居合并蓄水池，邻居的样本在这个像素的主交点上重新计算目标函数
+//只为最终选中的样本追踪一条阴影光线
+Color Camera::restir_spatial_pass(int i, int j, Sampler &sampler)
+{
+    size_t index = static_cast<size_t>(j) * image_width + i;
+    const PrimaryHit &hit = primary_hits[index];
+    Reservoir<LightSample> &reused = reused_reservoirs[index];
+    Color color = restir_gi ? hit.radiance + restir_gi_spatial_pass(i, j, sampler) : hit.radiance;
+    if (!hit.valid)
+    {
+        reused = Reservoir<LightSample>();
+        return color;
+    }
+
+    Color contribution;
+    const Reservoir<LightSample> &own = reservoirs[index];
+    Reservoir<LightSample> combined;
+    combined.merge(own, restir_target(hit, own.sample, contribution), sampler.get_1d(), own.M);
+
+    size_t merged[max_restir_spatial_neighbors];
+    int merged_count = 0;
+    for (int k = 0; k < std::min(restir_spatial_neighbors, max_restir_spatial_neighbors); ++k)
+    {
+        double u1, u2;
+        sampler.get_2d(u1, u2);
+        double radius = restir_spatial_radius * std::sqrt(u1);
+        int neighbor_i = i + static_cast<int>(std::lround(radius * std::cos(2 * M_PI * u2)));
+        int neighbor_j = j + static_cast<int>(std::lround(radius * std::sin(2 * M_PI * u2)));
+        double u = sampler.get_1d();
+        if (neighbor_i < 0 || neighbor_i >= image_width || neighbor_j < 0 || neighbor_j >= image_height || (neighbor_i == i && neighbor_j == j))
+        {
+            continue;
+        }
+
+        size_t neighbor_index = static_cast<size_t>(neighbor_j) * image_width + neighbor_i;
+        const Reservoir<LightSample> &neighbor = reservoirs[neighbor_index];
+        if (!restir_similar(hit, primary_hits[neighbor_index]))
+        {
+            continue;
+        }
+        combined.merge(neighbor, restir_target(hit, neighbor.sample, contribution), u, neighbor.M);
+        merged[merged_count++] = neighbor_index;
+    }
+
+    //选中的样本在哪些邻居的主交点上目标函数大于0，只计入它们的M
+    int count = own.M;
+    for (int k = 0; k < merged_count; ++k)
+    {
+        if (restir_target(primary_hits[merged[k]], combined.sample, contribution) > 0)
+        {
+            count += reservoirs[merged[k]].M;
+        }
+    }
+    double target = restir_target(hit, combined.sample, contribution);
+    combined.finalize(target, count);
+    reused = combined;
+    if (!(combined.W > 0))
+    {
+        return color;
+    }
+
+    if (!restir_visible(hit, combined.sample))
+    {
+        return color;
+    }
+    return color + contribution * combined.W;
+}
+
+//和直接光照一样在半径内选邻居，邻居的次级路径换到这个主交点上要乘雅可比行列式
+//复用来的样本在这个主交点可能被挡住，最终的样本追踪一条光线确认可见
+Color Camera::restir_gi_spatial_pass(int i, int j, Sampler &sampler)
+{
+    size_t index = static_cast<size_t>(j) * image_width + i;
+    const PrimaryHit &hit = primary_hits[index];
+    if (!hit.valid)
+    {
+        return Color(0, 0, 0);
+    }
+
+    Color contribution;
+    const Reservoir<PathSample> &own = gi_reservoirs[index];
+    Reservoir<PathSample> combined;
+    combined.merge(own, restir_gi_target(hit, own.sample, contribution), sampler.get_1d(), own.M);
+
+    size_t merged[max_restir_spatial_neighbors];
+    int merged_count = 0;
+    for (int k = 0; k < std::min(restir_spatial_neighbors, max_restir_spatial_neighbors); ++k)
+    {
+        double u1, u2;
+        sampler.get_2d(u1, u2);
+        double radius = restir_spatial_radius * std::sqrt(u1);
+        int neighbor_i = i + static_cast<int>(std::lround(radius * std::cos(2 * M_PI * u2)));
+        int neighbor_j = j + static_cast<int>(std::lround(radius * std::sin(2 * M_PI * u2)));
+        double u = sampler.get_1d();
+        if (neighbor_i < 0 || neighbor_i >= image_width || neighbor_j < 0 || neighbor_j >= image_height || (neighbor_i == i && neighbor_j == j))
+        {
+            continue;
+        }
+
+        size_t neighbor_index = static_cast<size_t>(neighbor_j) * image_width + neighbor_i;
+        const PrimaryHit &neighbor_hit = primary_hits[neighbor_index];
+        const Reservoir<PathSample> &neighbor = gi_reservoirs[neighbor_index];
+        if (!restir_similar(hit, neighbor_hit))
+        {
+            continue;
+        }
+        double jacobian = restir_gi_jacobian(neighbor_hit, hit, neighbor.sample);
+        combined.merge(neighbor, restir_gi_target(hit, neighbor.sample, contribution) * jacobian, u, neighbor.M);
+        merged[merged_count++] = neighbor_index;
+    }
+
+    //和时间复用一样，邻居还要能把选中的样本换过来(雅可比行列式在范围内)才计入它的M
+    //目标函数不含可见性，邻居看不到这个点时样本也不可能来自它，不检查的话结果偏暗，所以这里每个邻居多追踪一条光线
+    int count = own.M;
+    for (int k = 0; k < merged_count; ++k)
+    {
+        const PrimaryHit &neighbor_hit = primary_hits[merged[k]];
+        if (restir_gi_target(neighbor_hit, combined.sample, contribution) > 0 && restir_gi_jacobian(neighbor_hit, hit, combined.sample) > 0
+            && restir_gi_visible(neighbor_hit, combined.sample))
+        {
+            count += gi_reservoirs[merged[k]].M;
+        }
+    }
+    double target = restir_gi_target(hit, combined.sample, contribution);
+    combined.finalize(target, count);
+    if (!(combined.W > 0))
+    {
+        return Color(0, 0, 0);
+    }
+
+    if (!restir_gi_visible(hit, combined.sample))
+    {
+        return Color(0, 0, 0);
+    }
+    return contribution * combined.W;
+}
+
+//阴影光线先击中的必须是这个光源上的这个点，球形光源背面的点会被正面挡住
+bool Camera::restir_visible(const PrimaryHit &hit, const LightSample &sample) const
+{
+    Direction to_light = sample.position - hit.rec.p;
+    double distance = to_light.length();
+    HitRecord light_rec;
+    Ray shadow_ray = hit.rec.spawn_ray(to_light / distance, hit.ray.get_time());
+    return world->hit(shadow_ray, 0, light_rec) && light_rec.object == lights[sample.light].get()
+        && std::fabs(light_rec.t - distance) <= 1e-3 * distance;
+}
+
+//f * cos_surface * Le * cos_light / distance^2
+double Camera::restir_target(const PrimaryHit &hit, const LightSample &sample, Color &contribution) const
+{
+    contribution = Color(0, 0, 0);
+    if (sample.light < 0)
+    {
+        return 0;
+    }
+
+    Direction to_light = sample.position - hit.rec.p;
+    double distance_squared = to_light.length_squared();
+    if (!(distance_squared > 0))
+    {
+        return 0;
+    }
+
+    Direction direction = to_light / std::sqrt(distance_squared);
+    double cos_light = std::fabs(sample.normal.dot(direction));
+    Color bsdf = hit.rec.material->evaluate(hit.ray, hit.rec, hit.rec.spawn_ray(direction, hit.ray.get_time()));
+    contribution = bsdf * sample.emitted * (cos_light / distance_squared);
+    return 0.2126 * contribution.r() + 0.7152 * contribution.g() + 0.0722 * contribution.b();
+}
+
+//f * cos_surface * 辐亮度
+double Camera::restir_gi_target(const PrimaryHit &hit, const PathSample &sample, Color &contribution) const
+{
+    contribution = Color(0, 0, 0);
+    Direction offset = sample.position - hit.rec.p;
+    double distance = offset.length();
+    if (!(distance > 0))
+    {
+        return 0;
+    }
+
+    Color bsdf = hit.rec.material->evaluate(hit.ray, hit.rec, hit.rec.spawn_ray(offset / distance, hit.ray.get_time()));
+    contribution = bsdf * sample.radiance;
+    return 0.2126 * contribution.r() + 0.7152 * contribution.g() + 0.0722 * contribution.b();
+}
+
+//同一块面积dA在x处张成的立体角是cos * dA / distance^2，两个立体角之比就是雅可比行列式
+//太大或太小的(两个主交点到这个点的距离或者角度相差很多)不复用，否则少数像素会得到很大的权重，变成亮点
+double Camera::restir_gi_jacobian(const PrimaryHit &from, const PrimaryHit &to, const PathSample &sample) const
+{
+    Direction from_offset = from.rec.p - sample.position;
+    Direction to_offset = to.rec.p - sample.position;
+    double from_distance_squared = from_offset.length_squared();
+    double to_distance_squared = to_offset.length_squared();
+    if (!(from_distance_squared > 0) || !(to_distance_squared > 0))
+    {
+        return 0;
+    }
+
+    double from_cos = std::fabs(sample.normal.dot(from_offset)) / std::sqrt(from_distance_squared);
+    double to_cos = std::fabs(sample.normal.dot(to_offset)) / std::sqrt(to_distance_squared);
+    if (!(from_cos > 0))
+    {
+        return 0;
+    }
+
+    double jacobian = (to_cos * from_distance_squared) / (from_cos * to_distance_squared);
+    return (jacobian >= 0.1 && jacobian <= 10) ? jacobian : 0;
+}
+
+//次级路径的第一个交点本身在distance处，稍微提前一点结束，没有击中时样本在远处，整条光线都要检查
+bool Camera::restir_gi_visible(const PrimaryHit &hit, const PathSample &sample) const
+{
+    Direction offset = sample.position - hit.rec.p;
+    double distance = offset.length();
+    HitRecord rec;
+    Ray ray = hit.rec.spawn_ray(offset / distance, hit.ray.get_time(), distance * (1 - 1e-3));
+    return !world->hit(ray, 0, rec);
+}
+
+//法线接近，并且other到hit的切平面的距离相对于hit到相机的距离足够小
+bool Camera::restir_similar(const PrimaryHit &hit, const PrimaryHit &other) const
+{
+    return other.valid && hit.rec.normal.dot(other.rec.normal) > 0.9
+        && std::fabs((other.rec.p - hit.rec.p).dot(hit.rec.normal)) < 0.05 * hit.rec.t;
+}
+
+//从上一次的相机中心沿p的方向与视口平面求交，再换算成像素坐标
+bool Camera::reproject(const Point &p, int &i, int &j) const
+{
+    Direction normal = previous_pixel_delta_u.cross(previous_pixel_delta_v);
+    double plane = (previous_pixel00_center - previous_center).dot(normal);
+    double along = (p - previous_center).dot(normal);
+    if (plane == 0 || !(along / plane > 0))
+    {
+        return false;
+    }
+
+    Direction offset = (previous_center + (p - previous_center) * (plane / along)) - previous_pixel00_center;
+    double x = offset.dot(previous_pixel_delta_u) / previous_pixel_delta_u.length_squared();
+    double y = offset.dot(previous_pixel_delta_v) / previous_pixel_delta_v.length_squared();
+    i = static_cast<int>(std::floor(x + 0.5));
+    j = static_cast<int>(std::floor(y + 0.5));
+    return i >= 0 && i < image_width && j >= 0 && j < image_height;
+}
+
+//光源按功率从别名表选，在表面上按面积均匀取一个点，两面各以一半的概率按余弦分布发光
+//球形光源朝内发出的光子马上又击中光源自己，被丢掉，这样光源的pdf不需要区分形状
+bool Camera::sample_emission(Sampler &sampler, Ray &ray, Color &emitted, double &direct_pdf, double &emission_pdf, double &cos_light) const
+{
+    if (light_table.empty())
+    {
+        return false;
+    }
+
+    int light = light_table.sample(sampler.get_1d());
+    double light_pmf = light_table.get_pmf(light);
+    double area = lights[light]->area();
+
+    HitRecord origin;
+    origin.p = lights[light]->sample_area(sampler, origin.normal);
+    double u1, u2;
+    sampler.get_2d(u1, u2);
+    if (sampler.get_1d() < 0.5)
+    {
+        origin.normal = -origin.normal;
+    }
+    if (!(light_pmf > 0) || !(area > 0) || !(origin.normal.length_squared() > 0))
+    {
+        return false;
+    }
+
+    //采样点不是求交得到的，误差界按坐标的大小保守地估计
+    origin.geometric_normal = origin.normal;
+    origin.p_error = Direction(origin.p.get_vector().abs() * error_gamma(8));
+
+    Direction local = sample_cosine_hemisphere(u1, u2);
+    cos_light = local.z();
+    direct_pdf = light_pmf / area;
+    emission_pdf = direct_pdf * 0.5 * cosine_hemisphere_pdf(cos_light);
+    if (!(emission_pdf > 0))
+    {
+        return false;
+    }
+
+    ray = origin.spawn_ray(OrthonormalBasis(origin.normal).to_world(local), sampler.get_1d());
+    emitted = lights[light]->get_material()->emitted();
+    return true;
+}
+
+//VCM的MIS都用幂启发式(beta = 2)，递推量里保存的是pdf之比的平方
+static double vcm_mis(double ratio)
+{
+    return ratio * ratio;
+}
+
+//继续的概率只和顶点的材质有关，和路径从哪个方向经过这个顶点无关，所以正反两个方向的pdf都可以乘上它
+//光泽材质的颜色衰减随采样的方向变化，不能用它，否则同一条路径在不同的采样方式下继续的概率不同，MIS的权重加起来不是1
+static double vcm_continuation(const Material &material)
+{
+    Color albedo = material.get_albedo();
+    return std::min(1.0, std::max(albedo.r(), std::max(albedo.g(), albedo.b())) / 255.0);
+}
+
+//光子路径的条数等于像素数，第k条光子路径和第k个像素的相机路径相连
+//路径的长度(线段数)最多是max_depth + 1，和ray_color_nee一样，相机路径最多在max_depth个顶点上采样光源
+//光子路径连接相机的贡献落在任意像素上，每个线程累加到自己的缓冲区，所有迭代结束后再加到像素上
+void Camera::render_vcm(bool parallel)
+{
+    auto start_time = std::chrono::steady_clock::now();
+    long long total_samples = 0;
+    long long total_bounces = 0;
+
+    size_t pixel_count = static_cast<size_t>(image_width) * image_height;
+    begin_passes();
+
+    //光子路径和相机路径用种子不同的两个采样器，同一个像素的两条路径的随机数不相关
+    uint32_t seed = frame_index++;
+    auto camera_prototype = Sampler::create(sampler_type, samples_per_pixel, seed);
+    auto light_prototype = Sampler::create(sampler_type, samples_per_pixel, ~seed);
+    std::vector<std::unique_ptr<Sampler>> camera_samplers;
+    std::vector<std::unique_ptr<Sampler>> light_samplers;
+    std::vector<std::vector<Color>> splats;
+    for (int t = 0; t < omp_get_max_threads(); ++t)
+    {
+        camera_samplers.push_back(camera_prototype->clone());
+        light_samplers.push_back(light_prototype->clone());
+        splats.emplace_back(pixel_count, Color(0, 0, 0));
+    }
+
+    //每一行的光子路径先存到这一行自己的数组里，再按行的顺序拼起来
+    std::vector<std::vector<VCMVertex>> row_vertices(image_height);
+    vcm_path_ends.assign(pixel_count, 0);
+
+    for (int s = 0; s < samples_per_pixel; ++s)
+    {
+        //eta是合并相对于连接的pdf之比，合并一个光子相当于在半径为radius的圆盘上对光子路径的顶点做了一次面积采样
+        double radius = vcm_radius * std::pow(s + 1, 0.5 * (vcm_alpha - 1));
+        double eta = M_PI * radius * radius * pixel_count;
+        vcm_vm_weight = vcm_mis(eta);
+        vcm_vc_weight = vcm_mis(1 / eta);
+        vcm_vm_normalization = 1 / eta;
+
+        #pragma omp parallel for schedule(dynamic) if(parallel)
+        for (int j = 0; j < image_height; ++j)
+        {
+            Sampler &sampler = *light_samplers[omp_get_thread_num()];
+            std::vector<Color> &thread_splats = splats[omp_get_thread_num()];
+            row_vertices[j].clear();
+            for (int i = 0; i < image_width; ++i)
+            {
+                sampler.start_pixel_sample(i, j, s);
+                vcm_light_path(sampler, row_vertices[j], thread_splats);
+                vcm_path_ends[static_cast<size_t>(j) * image_width + i] = row_vertices[j].size();
+            }
+        }
+
+        vcm_light_vertices.clear();
+        for (int j = 0; j < image_height; ++j)
+        {
+            size_t offset = vcm_light_vertices.size();
+            for (int i = 0; i < image_width; ++i)
+            {
+                vcm_path_ends[static_cast<size_t>(j) * image_width + i] += offset;
+            }
+            vcm_light_vertices.insert(vcm_light_vertices.end(), row_vertices[j].begin(), row_vertices[j].end());
+        }
+
+        std::vector<Point> positions;
+        positions.reserve(vcm_light_vertices.size());
+        for (const VCMVertex &vertex : vcm_light_vertices)
+        {
+            positions.push_back(vertex.rec.p);
+        }
+        vcm_grid.build(positions, radius);
+
+        #pragma omp parallel for schedule(dynamic) reduction(+:total_bounces) if(parallel)
+        for (int j = 0; j < image_height; ++j)
+        {
+            Sampler &sampler = *camera_samplers[omp_get_thread_num()];
+            for (int i = 0; i < image_width; ++i)
+            {
+                size_t index = static_cast<size_t>(j) * image_width + i;
+                sampler.start_pixel_sample(i, j, s);
+                Color color = vcm_camera_path(i, j, index, sampler, total_bounces);
+
+                PixelStatistics &pixel = pixel_statistics[index];
+                pixel.sum = pixel.sum + color;
+                double luminance = 0.2126 * color.r() + 0.7152 * color.g() + 0.0722 * color.b();
+                double delta = luminance - pixel.mean;
+                pixel.mean += delta / (pixel.samples + 1);
+                pixel.squared_deviation += delta * (luminance - pixel.mean);
+                ++pixel.samples;
+            }
+        }
+
+        total_samples += static_cast<long long>(pixel_count);
+        std::clog << "Samples remaining: " << samples_per_pixel - s << '\n';
+    }
+
+    //光子路径连接相机的贡献没有计入亮度的统计，VCM不做自适应采样
+    for (const std::vector<Color> &thread_splats : splats)
+    {
+        for (size_t index = 0; index < pixel_count; ++index)
+        {
+            pixel_statistics[index].sum = pixel_statistics[index].sum + thread_splats[index];
+        }
+    }
+
+    resolve_image();
+    report_render_stats(start_time, total_samples, total_bounces);
+}
+
+//光子路径的起点和VPL一样用sample_emission采样，MIS的递推量从它的两个pdf开始
+void Camera::vcm_light_path(Sampler &sampler, std::vector<VCMVertex> &vertices, std::vector<Color> &splats) const
+{
+    VCMState state;
+    Color emitted;
+    double direct_pdf, emission_pdf, cos_light;
+    if (!sample_emission(sampler, state.ray, emitted, direct_pdf, emission_pdf, cos_light))
+    {
+        return;
+    }
+
+    state.throughput = emitted * (cos_light / emission_pdf);
+    state.specular_path = false;
+    state.dVCM = vcm_mis(direct_pdf / emission_pdf);
+    state.dVC = vcm_mis(cos_light / emission_pdf);
+    state.dVM = state.dVC * vcm_vc_weight;
+
+    for (;; ++state.length)
+    {
+        HitRecord rec;
+        if (!world->hit(state.ray, 0, rec))
+        {
+            break;
+        }
+
+        //和相机路径一样，击中光源时路径结束
+        Color emitted = rec.material->emitted();
+        if (emitted.r() > 0 || emitted.g() > 0 || emitted.b() > 0)
+        {
+            break;
+        }
+
+        //递推量中上一个顶点的pdf换算成这个顶点的面积测度
+        double cos_in = std::fabs(rec.normal.dot(state.ray.get_direction().unit()));
+        state.dVCM *= vcm_mis((rec.p - state.ray.get_origin()).length_squared());
+        state.dVCM /= vcm_mis(cos_in);
+        state.dVC /= vcm_mis(cos_in);
+        state.dVM /= vcm_mis(cos_in);
+
+        ScatterRecord srec;
+        rec.material->scatter(state.ray, rec, srec, sampler);
+
+        if (!rec.material->is_specular())
+        {
+            vertices.push_back(VCMVertex{rec, state.ray, state.throughput, state.length, state.dVCM, state.dVC, state.dVM});
+            vcm_connect_camera(vertices.back(), splats);
+        }
+
+        //再散射一次之后连接相机的路径会超过最大长度
+        if (state.length + 1 > max_depth || !vcm_scatter(rec, srec, state, sampler))
+        {
+            break;
+        }
+    }
 }
 
-void Camera::render()
+//第一段从相机出发，相机的pdf按视口上以像素为单位的面积计算，像素的面积是1
+Color Camera::vcm_camera_path(int i, int j, size_t index, Sampler &sampler, long long &bounces) const
 {
-    for (int j = 0; j < image_height; ++j)
+    Ray ray = get_ray(i, j, sampler);
+    Direction axis = pixel_delta_u.cross(pixel_delta_v).unit();
+    double cos_at_camera = axis.dot(ray.get_direction());
+    double image_distance = (pixel00_center - center).dot(axis) / pixel_delta_u.length() / cos_at_camera;
+    double camera_pdf = image_distance * image_distance / cos_at_camera;
+
+    VCMState state;
+    state.ray = ray;
+    state.throughput = Color(1, 1, 1);
+    state.dVCM = vcm_mis(static_cast<double>(vcm_path_ends.size()) / camera_pdf);
+
+    size_t begin = index > 0 ? vcm_path_ends[index - 1] : 0;
+    size_t end = vcm_path_ends[index];
+
+    Color color(0, 0, 0);
+    for (;; ++state.length)
     {
-        for (int i = 0; i < image_width; ++i)
+        HitRecord rec;
+        if (!world->hit(state.ray, 0, rec))
         {
-            //该像素的中心点坐标
-            auto p = pixel00_center + pixel_delta_u * i + pixel_delta_v * j;
+            color = color + state.throughput * background_color;
+            break;
+        }
 
-            //该像素的颜色，初始化为黑色
-            Color pixel_color(0, 0, 0);
+        double cos_in = std::fabs(rec.normal.dot(state.ray.get_direction().unit()));
+        state.dVCM *= vcm_mis((rec.p - state.ray.get_origin()).length_squared());
+        state.dVCM /= vcm_mis(cos_in);
+        state.dVC /= vcm_mis(cos_in);
+        state.dVM /= vcm_mis(cos_in);
 
-            for (int s = 0; s < samples_per_pixel; ++s)
-            {
-                //在像素内随机采样一个点
-                auto random_point = random_generator.sample_point_square(p, pixel_lenght, viewport_u, viewport_v);
+        Color emitted = rec.material->emitted();
+        if (emitted.r() > 0 || emitted.g() > 0 || emitted.b() > 0)
+        {
+            color = color + state.throughput * emitted * vcm_emission_weight(rec, state);
+            break;
+        }
 
-                //光线的方向就是从相机中心指向采样点的方向
-                Direction direction = Direction(random_point - center).unit();
+        if (state.length > max_depth)
+        {
+            break;
+        }
 
-                //生成光线
-                Ray ray(center, direction);
+        //镜面上不连接光源，也跳过这些维度
+        if (rec.material->is_specular())
+        {
+            sampler.skip_dimensions(light_sample_dimensions);
+        }
+        else
+        {
+            color = color + state.throughput * vcm_direct_light(rec, state, sampler);
 
-                //像素的颜色就是所有采样点的颜色的平均值
-                switch (algorithm)
+            //光子路径的顶点按长度递增排列，超过最大长度之后的都不用再看
+            for (size_t k = begin; k < end; ++k)
+            {
+                const VCMVertex &vertex = vcm_light_vertices[k];
+                if (vertex.length + state.length > max_depth)
                 {
-                    case Algorithm::PathTracing:
-                        pixel_color = pixel_color + ray_color(ray, max_depth, *world);
-                        break;
-                    case Algorithm::PathTracingPDF:
-                        pixel_color = pixel_color + ray_color_pdf(ray, max_depth, *world);
-                        break;
-                    case Algorithm::PhotonMapping:
-                        //TODO
-                        break;
-                    default:
-                        break;
+                    break;
                 }
+                color = color + state.throughput * vertex.throughput * vcm_connect(rec, state, vertex);
             }
-            //计算平均值
-            pixel_color = pixel_color / samples_per_pixel;
 
-            //将颜色写入图像
-            image.set_pixel(i, j, pixel_color);
+            //光子到达的方向就是光子路径上一段光线的反方向，合并不需要阴影光线
+            Color merged(0, 0, 0);
+            vcm_grid.query(rec.p, [&](uint32_t k)
+            {
+                const VCMVertex &vertex = vcm_light_vertices[k];
+                if (vertex.length + state.length > max_depth + 1)
+                {
+                    return;
+                }
+
+                double cos_theta, pdf, reverse_pdf;
+                Color f = vcm_evaluate(rec, state.ray, -vertex.ray.get_direction().unit(), cos_theta, pdf, reverse_pdf);
+                if (f.r() <= 0 && f.g() <= 0 && f.b() <= 0)
+                {
+                    return;
+                }
+
+                double light_weight = vertex.dVCM * vcm_vc_weight + vertex.dVM * vcm_mis(pdf);
+                double camera_weight = state.dVCM * vcm_vc_weight + state.dVM * vcm_mis(reverse_pdf);
+                merged = merged + f * vertex.throughput / (light_weight + 1 + camera_weight);
+            });
+            color = color + state.throughput * merged * vcm_vm_normalization;
+        }
+
+        ScatterRecord srec;
+        rec.material->scatter(state.ray, rec, srec, sampler);
+
+        if (!vcm_scatter(rec, srec, state, sampler))
+        {
+            break;
         }
-        std::clog << "Scanlines remaining: " << image_height - j << '\n';
     }
+
+    bounces += state.length;
+    return color;
 }
 
-//并行渲染，和上面的区别是使用了OpenMP
-//基本上一模一样，只是加了#pragma omp parallel for schedule(guided)
-void Camera::render_parallel()
+//scatter已经按材质的分布采样了方向，f * cos / pdf就是颜色衰减，throughput只需要再除以继续的概率
+//镜面反射的pdf是delta函数，正反两个方向相同，在递推量里约掉，只剩下余弦
+bool Camera::vcm_scatter(const HitRecord &rec, const ScatterRecord &srec, VCMState &state, Sampler &sampler) const
 {
-    int num_threads = omp_get_max_threads();
-    omp_set_num_threads(num_threads);
+    double continuation = vcm_continuation(*rec.material);
+    if (sampler.get_1d() >= continuation)
+    {
+        return false;
+    }
 
-    for (int j = 0; j < image_height; ++j)
+    Direction direction = srec.scattered_ray.get_direction().unit();
+    double cos_out = std::fabs(rec.normal.dot(direction));
+    if (rec.material->is_specular())
     {
-        #pragma omp parallel for schedule(guided)
-        for (int i = 0; i < image_width; ++i)
+        state.dVCM = 0;
+        state.dVC *= vcm_mis(cos_out);
+        state.dVM *= vcm_mis(cos_out);
+    }
+    else
+    {
+        double cos_theta, pdf, reverse_pdf;
+        vcm_evaluate(rec, state.ray, direction, cos_theta, pdf, reverse_pdf);
+        if (!(pdf > 0))
         {
-            auto p = pixel00_center + pixel_delta_u * i + pixel_delta_v * j;
-            Color pixel_color(0, 0, 0);
+            return false;
+        }
+
+        state.dVC = vcm_mis(cos_out / pdf) * (state.dVC * vcm_mis(reverse_pdf) + state.dVCM + vcm_vm_weight);
+        state.dVM = vcm_mis(cos_out / pdf) * (state.dVM * vcm_mis(reverse_pdf) + state.dVCM * vcm_vc_weight + 1);
+        state.dVCM = vcm_mis(1 / pdf);
+        state.specular_path = false;
+    }
+
+    state.throughput = state.throughput * srec.attenuation / 255.0 / continuation;
+    state.ray = srec.scattered_ray;
+    return true;
+}
+
+//返回不带余弦的f，材质的evaluate是f * cos
+Color Camera::vcm_evaluate(const HitRecord &rec, const Ray &ray_in, const Direction &direction,
+                           double &cos_theta, double &pdf, double &reverse_pdf) const
+{
+    double continuation = vcm_continuation(*rec.material);
+    Ray scattered = rec.spawn_ray(direction, ray_in.get_time());
+    Ray reversed = rec.spawn_ray(-direction, ray_in.get_time());
+    double scattering_pdf = rec.material->scattering_pdf(ray_in, rec, scattered);
+    cos_theta = std::fabs(rec.normal.dot(direction));
+    pdf = scattering_pdf * continuation;
+    reverse_pdf = rec.material->scattering_pdf(reversed, rec, rec.spawn_ray(-ray_in.get_direction().unit(), ray_in.get_time())) * continuation;
+    if (!(scattering_pdf > 0) || !(cos_theta > 0))
+    {
+        return Color(0, 0, 0);
+    }
+    return rec.material->evaluate(ray_in, rec, scattered) / cos_theta;
+}
+
+//不在lights中的发光物体只能被相机路径击中，权重是1
+double Camera::vcm_emission_weight(const HitRecord &rec, const VCMState &state) const
+{
+    auto it = light_indices.find(rec.object);
+    if (state.length == 1 || it == light_indices.end())
+    {
+        return 1;
+    }
+
+    double direct_pdf = light_table.get_pmf(it->second) / lights[it->second]->area();
+    double cos_light = std::fabs(rec.normal.dot(state.ray.get_direction().unit()));
+    double emission_pdf = direct_pdf * 0.5 * cosine_hemisphere_pdf(cos_light);
+    double camera_weight = vcm_mis(direct_pdf) * state.dVCM + vcm_mis(emission_pdf) * state.dVC;
+    return 1 / (1 + camera_weight);
+}
+
+//光源上的点和vcm_light_path的起点用同样的方式采样，这样相机路径连接光源和光子路径从光源出发是同一个顶点的两种采样
+//两个pdf都在光源上，之比里的距离和光源上的余弦约掉，可以直接用着色点的立体角测度
+Color Camera::vcm_direct_light(const HitRecord &rec, const VCMState &state, Sampler &sampler) const
+{
+    if (light_table.empty())
+    {
+        sampler.skip_dimensions(light_sample_dimensions);
+        return Color(0, 0, 0);
+    }
+
+    int light = light_table.sample(sampler.get_1d());
+    double light_pmf = light_table.get_pmf(light);
+    double area = lights[light]->area();
+    Direction light_normal;
+    Point point = lights[light]->sample_area(sampler, light_normal);
+
+    Direction to_light = point - rec.p;
+    double distance_squared = to_light.length_squared();
+    double distance = std::sqrt(distance_squared);
+    if (!(light_pmf > 0) || !(area > 0) || !(distance > 0))
+    {
+        return Color(0, 0, 0);
+    }
+    Direction direction = to_light / distance;
+    double cos_light = std::fabs(light_normal.dot(direction));
+    if (!(cos_light > 0))
+    {
+        return Color(0, 0, 0);
+    }
+
+    double cos_theta, pdf, reverse_pdf;
+    Color f = vcm_evaluate(rec, state.ray, direction, cos_theta, pdf, reverse_pdf);
+    if (f.r() <= 0 && f.g() <= 0 && f.b() <= 0)
+    {
+        return Color(0, 0, 0);
+    }
+
+    double direct_pdf = light_pmf / area * distance_squared / cos_light;
+    double emission_pdf = light_pmf / area * 0.5 * cosine_hemisphere_pdf(cos_light);
+    double light_weight = vcm_mis(pdf / direct_pdf);
+    double camera_weight = vcm_mis(emission_pdf * cos_theta / (direct_pdf * cos_light)) * (vcm_vm_weight + state.dVCM + state.dVC * vcm_mis(reverse_pdf));
+
+    //阴影光线先击中的必须是这个光源上的这个点，球形光源背面的点会被正面挡住
+    HitRecord light_rec;
+    if (!world->hit(rec.spawn_ray(direction, state.ray.get_time()), 0, light_rec) || light_rec.object != lights[light].get()
+        || std::fabs(light_rec.t - distance) > 1e-3 * distance)
+    {
+        return Color(0, 0, 0);
+    }
+    return f * lights[light]->get_material()->emitted() * (cos_theta / direct_pdf / (light_weight + 1 + camera_weight));
+}
+
+//两端都按对方的采样方式算出面积测度的pdf，分别代入两条子路径的递推量
+Color Camera::vcm_connect(const HitRecord &rec, const VCMState &state, const VCMVertex &vertex) const
+{
+    Direction offset = vertex.rec.p - rec.p;
+    double distance_squared = offset.length_squared();
+    double distance = std::sqrt(distance_squared);
+    if (!(distance > 0))
+    {
+        return Color(0, 0, 0);
+    }
+    Direction direction = offset / distance;
+
+    double camera_cos, camera_pdf, camera_reverse_pdf;
+    Color camera_f = vcm_evaluate(rec, state.ray, direction, camera_cos, camera_pdf, camera_reverse_pdf);
+    if (camera_f.r() <= 0 && camera_f.g() <= 0 && camera_f.b() <= 0)
+    {
+        return Color(0, 0, 0);
+    }
+    double light_cos, light_pdf, light_reverse_pdf;
+    Color light_f = vcm_evaluate(vertex.rec, vertex.ray, -direction, light_cos, light_pdf, light_reverse_pdf);
+    if (light_f.r() <= 0 && light_f.g() <= 0 && light_f.b() <= 0)
+    {
+        return Color(0, 0, 0);
+    }
+
+    double geometry = camera_cos * light_cos / distance_squared;
+    double camera_pdf_area = camera_pdf * light_cos / distance_squared;
+    double light_pdf_area = light_pdf * camera_cos / distance_squared;
+    double light_weight = vcm_mis(camera_pdf_area) * (vcm_vm_weight + vertex.dVCM + vertex.dVC * vcm_mis(light_reverse_pdf));
+    double camera_weight = vcm_mis(light_pdf_area) * (vcm_vm_weight + state.dVCM + state.dVC * vcm_mis(camera_reverse_pdf));
+
+    HitRecord blocker;
+    if (world->hit(rec.spawn_ray(direction, state.ray.get_time(), distance * (1 - 1e-3)), 0, blocker))
+    {
+        return Color(0, 0, 0);
+    }
+    return camera_f * light_f * (geometry / (light_weight + 1 + camera_weight));
+}
+
+//从相机中心沿vertex的方向与视口平面求交得到像素，和get_ray在像素内均匀取点的pdf对应
+void Camera::vcm_connect_camera(const VCMVertex &vertex, std::vector<Color> &splats) const
+{
+    Direction to_camera = center - vertex.rec.p;
+    double distance_squared = to_camera.length_squared();
+    double distance = std::sqrt(distance_squared);
+    Direction axis = pixel_delta_u.cross(pixel_delta_v).unit();
+    if (!(distance > 0))
+    {
+        return;
+    }
+    Direction direction = to_camera / distance;
+    double cos_at_camera = -axis.dot(direction);
+    if (!(cos_at_camera > 0))
+    {
+        return;
+    }
+
+    double plane = (pixel00_center - center).dot(axis);
+    Direction offset = (center - direction * (plane / cos_at_camera)) - pixel00_center;
+    int i = static_cast<int>(std::floor(offset.dot(pixel_delta_u) / pixel_delta_u.length_squared() + 0.5));
+    int j = static_cast<int>(std::floor(offset.dot(pixel_delta_v) / pixel_delta_v.length_squared() + 0.5));
+    if (i < 0 || i >= image_width || j < 0 || j >= image_height)
+    {
+        return;
+    }
+
+    double cos_theta, pdf, reverse_pdf;
+    Color f = vcm_evaluate(vertex.rec, vertex.ray, direction, cos_theta, pdf, reverse_pdf);
+    if (f.r() <= 0 && f.g() <= 0 && f.b() <= 0)
+    {
+        return;
+    }
+
+    //相机在视口上(以像素为单位)均匀采样，换算成这个顶点处的面积测度
+    double image_distance = plane / pixel_delta_u.length() / cos_at_camera;
+    double camera_pdf = image_distance * image_distance / cos_at_camera * cos_theta / distance_squared;
+    double light_paths = static_cast<double>(vcm_path_ends.size());
+    double light_weight = vcm_mis(camera_pdf / light_paths) * (vcm_vm_weight + vertex.dVCM + vertex.dVC * vcm_mis(reverse_pdf));
+
+    HitRecord blocker;
+    if (world->hit(vertex.rec.spawn_ray(direction, vertex.ray.get_time(), distance), 0, blocker))
+    {
+        return;
+    }
+    Color &splat = splats[static_cast<size_t>(j) * image_width + i];
+    splat = splat + vertex.throughput * f * (camera_pdf / light_paths / (light_weight + 1));
+}
+
+//自举路径k的长度是k % (max_depth + 1) + 1，种子由帧号和k决定，链从自举路径出发时用同样的种子重建它
+static uint64_t mlt_seed(uint32_t frame, size_t k)
+{
+    return (static_cast<uint64_t>(frame) << 40) ^ static_cast<uint64_t>(k);
+}
+
+//像素的值是 像素数 * b / 变异次数 * sum(L / luminance(L))，b是自举估计的每条路径的平均亮度(各种长度之和)
+//每次变异按期望值的方式累加：提议的状态乘接受概率，当前状态乘拒绝概率，被拒绝的提议也能贡献到图像上
+void Camera::render_mlt(bool parallel)
+{
+    auto start_time = std::chrono::steady_clock::now();
+    long long total_bounces = 0;
+
+    size_t pixel_count = static_cast<size_t>(image_width) * image_height;
+    begin_passes();
+
+    uint32_t frame = frame_index++;
+    int lengths = max_depth + 1;
+    size_t bootstrap_count = static_cast<size_t>(mlt_bootstrap) * lengths;
+
+    std::vector<double> bootstrap_weights(bootstrap_count, 0);
+    #pragma omp parallel for schedule(dynamic, 256) reduction(+:total_bounces) if(parallel)
+    for (long long k = 0; k < static_cast<long long>(bootstrap_count); ++k)
+    {
+        MLTSampler sampler(mlt_seed(frame, k), mlt_sigma, mlt_large_step_probability);
+        int i, j;
+        Color color = mlt_path(sampler, static_cast<int>(k % lengths) + 1, i, j, total_bounces);
+        bootstrap_weights[k] = 0.2126 * color.r() + 0.7152 * color.g() + 0.0722 * color.b();
+    }
+
+    double weight_sum = 0;
+    for (double weight : bootstrap_weights)
+    {
+        weight_sum += weight;
+    }
+    double normalization = weight_sum / mlt_bootstrap;
+
+    long long mutations = static_cast<long long>(samples_per_pixel) * static_cast<long long>(pixel_count);
+    int chains = static_cast<int>(std::min<long long>(mlt_chains, mutations));
+    std::vector<std::vector<Color>> splats(omp_get_max_threads(), std::vector<Color>(pixel_count, Color(0, 0, 0)));
+
+    if (normalization > 0)
+    {
+        AliasTable bootstrap_table(bootstrap_weights);
 
-            for (int s = 0; s < samples_per_pixel; ++s)
+        #pragma omp parallel for schedule(dynamic) reduction(+:total_bounces) if(parallel)
+        for (int c = 0; c < chains; ++c)
+        {
+            std::vector<Color> &thread_splats = splats[omp_get_thread_num()];
+
+            //链的起点按亮度分层地从自举路径中选出，层内要抖动：取层的中点时u * 表的大小可能总是整数，别名表就永远不会选到别名
+            IndependentSampler jitter(1, frame);
+            jitter.start_pixel_sample(c, 0, 0);
+            size_t k = static_cast<size_t>(bootstrap_table.sample((c + jitter.get_1d()) / chains));
+            int length = static_cast<int>(k % lengths) + 1;
+            MLTSampler sampler(mlt_seed(frame, k), mlt_sigma, mlt_large_step_probability);
+            int current_i, current_j;
+            Color current = mlt_path(sampler, length, current_i, current_j, total_bounces);
+            double current_weight = 0.2126 * current.r() + 0.7152 * current.g() + 0.0722 * current.b();
+
+            long long begin = mutations * c / chains;
+            long long end = mutations * (c + 1) / chains;
+            for (long long m = begin; m < end; ++m)
             {
-                auto random_point = random_generator.sample_point_square(p, pixel_lenght, viewport_u, viewport_v);
-                Direction direction = Direction(random_point - center).unit();
-                Ray ray(center, direction);
-                switch (algorithm)
+                sampler.start_iteration();
+                int proposed_i, proposed_j;
+                Color proposed = mlt_path(sampler, length, proposed_i, proposed_j, total_bounces);
+                double proposed_weight = 0.2126 * proposed.r() + 0.7152 * proposed.g() + 0.0722 * proposed.b();
+
+                double acceptance = current_weight > 0 ? std::min(1.0, proposed_weight / current_weight) : 1;
+                if (proposed_weight > 0)
+                {
+                    Color &splat = thread_splats[static_cast<size_t>(proposed_j) * image_width + proposed_i];
+                    splat = splat + proposed * (acceptance / proposed_weight);
+                }
+                if (current_weight > 0)
+                {
+                    Color &splat = thread_splats[static_cast<size_t>(current_j) * image_width + current_i];
+                    splat = splat + current * ((1 - acceptance) / current_weight);
+                }
+
+                if (sampler.uniform() < acceptance)
+                {
+                    sampler.accept();
+                    current = proposed;
+                    current_weight = proposed_weight;
+                    current_i = proposed_i;
+                    current_j = proposed_j;
+                }
+                else
                 {
-                    case Algorithm::PathTracing:
-                        pixel_color = pixel_color + ray_color(ray, max_depth, *world);
-                        break;
-                    case Algorithm::PathTracingPDF:
-                        pixel_color = pixel_color + ray_color_pdf(ray, max_depth, *world);
-                        break;
-                    case Algorithm::PhotonMapping:
-                        //TODO
-                        break;
-                    default:
-                        break;
+                    sampler.reject();
                 }
             }
-            pixel_color = pixel_color / samples_per_pixel;
-            image.set_pixel(i, j, pixel_color);
         }
-        std::clog << "Scanlines remaining: " << image_height - j << '\n';
     }
-}
 
-//通过路径追踪来计算像素的颜色
-//每次碰撞后，根据材质的散射函数随即获取一个散射光线
-Color Camera::ray_color(const Ray &ray, int depth, const Hittable &world)
-{
-    if (depth <= 0)
+    //变异次数是samples_per_pixel * 像素数，所以sum / samples_per_pixel就是上面的像素值
+    for (size_t index = 0; index < pixel_count; ++index)
     {
-        //如果递归深度为0，返回黑色
-        return overflows_color;
+        PixelStatistics &pixel = pixel_statistics[index];
+        for (const std::vector<Color> &thread_splats : splats)
+        {
+            pixel.sum = pixel.sum + thread_splats[index] * normalization;
+        }
+        pixel.samples = samples_per_pixel;
     }
 
-    HitRecord rec;
+    resolve_image();
+    report_render_stats(start_time, mutations + static_cast<long long>(bootstrap_count), total_bounces);
+}
 
-    if (world.hit(ray, 0.001, 1000, rec))
+//和ray_color_nee相同的估计，只是把贡献按路径长度拆开：倒数第二个顶点上的光源采样，和最后一段按材质采样击中光源，用power heuristic分配权重
+//所有长度的贡献之和就是ray_color_nee(没有俄罗斯轮盘赌时)的结果。MLT不需要轮盘赌，路径的长度已经固定
+Color Camera::mlt_path(Sampler &sampler, int length, int &i, int &j, long long &bounces) const
+{
+    double u1, u2;
+    sampler.get_2d(u1, u2);
+    i = std::min(static_cast<int>(u1 * image_width), image_width - 1);
+    j = std::min(static_cast<int>(u2 * image_height), image_height - 1);
+    Ray ray = get_ray(i, j, sampler);
+
+    Color radiance(0, 0, 0);
+    Color throughput(1, 1, 1);
+    Point previous_point;
+    Direction previous_normal;
+    double previous_bsdf_pdf = 0;
+    bool previous_specular = true;
+
+    for (int segment = 1; ; ++segment)
     {
-        //如果碰撞，计算碰撞点是如何散射的光线
+        ++bounces;
+        HitRecord rec;
+        if (!world->hit(ray, 0, rec))
+        {
+            return segment == length ? radiance + throughput * background_color : radiance;
+        }
+
+        Color emitted = rec.material->emitted();
+        bool emitter = emitted.r() > 0 || emitted.g() > 0 || emitted.b() > 0;
+        if (segment == length)
+        {
+            double weight = 1;
+            if (emitter && !previous_specular)
+            {
+                weight = power_heuristic(previous_bsdf_pdf, light_pdf(rec.object, previous_point, previous_normal, ray.get_direction()));
+            }
+            return emitter ? radiance + throughput * emitted * weight : radiance;
+        }
+
+        //和ray_color_nee一样，光源不再继续散射
+        if (emitter)
+        {
+            return radiance;
+        }
+
         ScatterRecord srec;
-        rec.material->scatter(ray, rec, srec);
+        rec.material->scatter(ray, rec, srec, sampler);
+        bool specular = rec.material->is_specular();
+        if (segment + 1 == length && !specular)
+        {
+            radiance = radiance + throughput * estimate_direct_light(ray, rec, *world, sampler, true);
+        }
 
-        //像素的颜色 = 碰撞点发出的光线的颜色 + 碰撞点反射的光线的颜色 * 碰撞点的颜色衰减
-        return srec.attenuation * ray_color(srec.scattered_ray, depth - 1, world) / Color(255,255,255) + srec.emitted;
-    } else {
+        previous_point = rec.p;
+        previous_normal = rec.normal;
+        previous_bsdf_pdf = specular ? 0 : rec.material->scattering_pdf(ray, rec, srec.scattered_ray);
+        previous_specular = specular;
 
-        //如果没有碰撞，返回背景色
-        Color background = Color(100, 100, 100);
-        return background;
+        throughput = throughput * srec.attenuation / 255.0;
+        ray = srec.scattered_ray;
     }
 }
 
-//通过pdf来计算像素的颜色
-//与ray_color的区别是，我们只根据材料的特性来随即生成散射光线
-//而是根据pdf来生成散射光线，也就是重要性采样
-Color Camera::ray_color_pdf(const Ray &ray, int depth, const Hittable &world)
+//光子路径的条数固定而且很少，所以不做俄罗斯轮盘赌，每条最多反弹max_depth - 1次，连接到相机路径的第一个顶点之后总长度不超过max_depth + 1
+//光子路径都从像素(0, 0)的采样器取随机数，第k条用第k个样本，虚拟点光源在光源上分层，而且每次生成的都一样
+void Camera::trace_vpls()
 {
-    if (depth <= 0)
+    if (vpls_valid)
     {
-        return overflows_color;
+        return;
     }
 
-    HitRecord rec;
+    vpls.clear();
+    auto sampler = Sampler::create(sampler_type, vpl_paths);
+    for (int k = 0; k < vpl_paths; ++k)
+    {
+        sampler->start_pixel_sample(0, 0, k);
+        Ray ray;
+        Color emitted;
+        double direct_pdf, emission_pdf, cos_light;
+        if (!sample_emission(*sampler, ray, emitted, direct_pdf, emission_pdf, cos_light))
+        {
+            continue;
+        }
+
+        Color power = emitted * (cos_light / emission_pdf / vpl_paths);
+        for (int bounce = 1; bounce < max_depth; ++bounce)
+        {
+            HitRecord rec;
+            if (!world->hit(ray, 0, rec))
+            {
+                break;
+            }
+
+            //光源上的顶点由光源采样负责
+            Color hit_emitted = rec.material->emitted();
+            if (hit_emitted.r() > 0 || hit_emitted.g() > 0 || hit_emitted.b() > 0)
+            {
+                break;
+            }
+
+            ScatterRecord srec;
+            rec.material->scatter(ray, rec, srec, *sampler);
+            if (!rec.material->is_specular())
+            {
+                vpls.push_back(VirtualPointLight{rec, ray, power});
+            }
+
+            power = power * srec.attenuation / 255.0;
+            ray = srec.scattered_ray;
+        }
+    }
 
-    if (world.hit(ray, 0.001, 1000, rec))
+    std::vector<double> powers;
+    for (const VirtualPointLight &vpl : vpls)
     {
-        auto srec = ScatterRecord();
-        rec.material->scatter(ray, rec, srec);   
+        powers.push_back(0.2126 * vpl.power.r() + 0.7152 * vpl.power.g() + 0.0722 * vpl.power.b());
+    }
+    vpl_table = AliasTable(powers);
+    vpls_valid = true;
+    std::clog << "Virtual point lights: " << vpls.size() << '\n';
+}
 
-        //在pdf采样中，我们放弃了记录光源之间的光照。
-        //因为光源可能会对自己采样，会导致光线与自己相交。
-        if (srec.emitted.r() > 0 || srec.emitted.g() > 0 || srec.emitted.b() > 0) {
-            return srec.emitted;
+//两端材质的evaluate都带着余弦，除掉之后再和夹紧的几何项相乘
+Color Camera::estimate_vpl_light(const Ray &ray_in, const HitRecord &rec, Sampler &sampler) const
+{
+    Color radiance(0, 0, 0);
+    if (vpl_table.empty() || vpl_samples <= 0)
+    {
+        return radiance;
+    }
+
+    for (int s = 0; s < vpl_samples; ++s)
+    {
+        int index = vpl_table.sample(sampler.get_1d());
+        double pmf = vpl_table.get_pmf(index);
+        const VirtualPointLight &vpl = vpls[index];
+
+        Direction offset = vpl.rec.p - rec.p;
+        double distance_squared = offset.length_squared();
+        double distance = std::sqrt(distance_squared);
+        if (!(pmf > 0) || !(distance > 0))
+        {
+            continue;
         }
+        Direction direction = offset / distance;
 
-        //计算所有光源的pdf
-        std::vector<PDF*> light_pdfs;
-        std::vector<double> light_weights;
+        double cos_x = std::fabs(rec.normal.dot(direction));
+        double cos_y = std::fabs(vpl.rec.normal.dot(direction));
+        Color f_x = rec.material->evaluate(ray_in, rec, rec.spawn_ray(direction, ray_in.get_time()));
+        Color f_y = vpl.rec.material->evaluate(vpl.ray, vpl.rec, vpl.rec.spawn_ray(-direction, vpl.ray.get_time()));
+        if (!(cos_x > 0) || !(cos_y > 0) || !(f_x.r() + f_x.g() + f_x.b() > 0) || !(f_y.r() + f_y.g() + f_y.b() > 0))
+        {
+            continue;
+        }
 
-        for (const auto& light : lights) {
-            double weights = 1.0 / lights.size();
-            light_pdfs.push_back(new HittablePDF(rec.p, light));
-            light_weights.push_back(weights);
+        HitRecord blocker;
+        if (world->hit(rec.spawn_ray(direction, ray_in.get_time(), distance * (1 - 1e-3)), 0, blocker))
+        {
+            continue;
         }
 
-        MixturePDF light_pdf(light_pdfs, light_weights);
+        double geometry = std::min(cos_x * cos_y / distance_squared, vpl_geometry_clamp);
+        Color f = f_x * f_y / (cos_x * cos_y);
+        radiance = radiance + f * vpl.power * (geometry / pmf);
+    }
+    return radiance / vpl_samples;
+}
+
+//Keller的instant radiosity：镜面反射之后的第一个漫反射表面上，直接光照用光源采样，间接光照由trace_vpls生成的虚拟点光源照亮
+//虚拟点光源在帧之间不变，所以误差是固定的低频偏差而不是随机的噪点，适合移动相机时的预览
+Color Camera::ray_color_vpl(const Ray &ray, int depth, const Hittable &world, Sampler &sampler, int &bounces)
+{
+    Color radiance(0, 0, 0);
+    Color throughput(1, 1, 1);
+    Ray current_ray = ray;
 
-        //计算最终的pdf
-        std::vector<PDF*> pdfs;
-        std::vector<double> weights;
-        pdfs.push_back(new SpherePDF());
-        pdfs.push_back(&light_pdf);
-        weights.push_back(0.5);
-        weights.push_back(0.5);
+    for (bounces = 0; ; ++bounces)
+    {
+        if (bounces >= depth)
+        {
+            return radiance + throughput * overflows_color;
+        }
 
-        MixturePDF mixture_pdf(pdfs, weights);
+        HitRecord rec;
 
-        auto scattered_direction = mixture_pdf.generate(random_generator);
+        if (!world.hit(current_ray, 0, rec))
+        {
+            return radiance + throughput * background_color;
+        }
 
-        Ray scattered_ray(rec.p, scattered_direction);
+        Color emitted = rec.material->emitted();
+        if (emitted.r() > 0 || emitted.g() > 0 || emitted.b() > 0)
+        {
+            ++bounces;
+            return radiance + throughput * emitted;
+        }
 
-        double pdf_value = mixture_pdf.value(scattered_direction);
+        ScatterRecord srec;
+        rec.material->scatter(current_ray, rec, srec, sampler);
 
-        //这里存在神秘的浮点误差
-        //比方说我们生成了光源边缘的点，再计算pdf时，虽然这点在光源上，但是pdf值可能为0
-        //发生概率大概在千分之二左右
-        //但是在1080p * 1920 * 100次采样中，这种情况就是大概率发生的
-        //求交时的误差可能导致这种情况
-        while (pdf_value == 0) {
-            //直到生成的光线的pdf不为0
-            scattered_direction = mixture_pdf.generate(random_generator);
-            scattered_ray = Ray(rec.p, scattered_direction);
-            pdf_value = mixture_pdf.value(scattered_direction);
+        if (rec.material->is_specular())
+        {
+            throughput = throughput * srec.attenuation / 255.0;
+            current_ray = srec.scattered_ray;
+            continue;
         }
 
-        double scattering_pdf = rec.material->scattering_pdf(ray, rec, scattered_ray);
+        radiance = radiance + throughput * estimate_direct_light(current_ray, rec, world, sampler, false);
+        radiance = radiance + throughput * estimate_vpl_light(current_ray, rec, sampler);
 
-        Color sample_color = ray_color_pdf(scattered_ray, depth - 1, world);
+        ++bounces;
+        return radiance;
+    }
+}
 
-        //重要性采样
-        Color result = srec.attenuation * sample_color / Color(255, 255, 255) * scattering_pdf / pdf_value + srec.emitted;
+//预览只追踪主光线、镜面反射和少量的阴影光线，每个样本的开销和路径追踪的一次反弹差不多
+//法线和环境光遮蔽只看几何，在第一个交点上就结束；颜色和直接光照穿过镜面，和ray_color_irradiance_cache一样
+Color Camera::ray_color_preview(const Ray &ray, int depth, const Hittable &world, Sampler &sampler, int &bounces)
+{
+    Color throughput(1, 1, 1);
+    Ray current_ray = ray;
 
-        return result;
-    } else {
+    for (bounces = 0; ; )
+    {
+        if (bounces >= depth)
+        {
+            return throughput * overflows_color;
+        }
 
-        //如果没有碰撞，返回背景色
-        return background_color;
+        HitRecord rec;
+
+        if (!world.hit(current_ray, 0, rec))
+        {
+            return throughput * background_color;
+        }
+
+        ++bounces;
+        if (algorithm == Algorithm::Normals)
+        {
+            //法线的每个分量从[-1, 1]映射到[0, 255]
+            return (Color(rec.normal.x(), rec.normal.y(), rec.normal.z()) + Color(1, 1, 1)) * 127.5;
+        }
+
+        Color emitted = rec.material->emitted();
+        if (emitted.r() > 0 || emitted.g() > 0 || emitted.b() > 0)
+        {
+            return throughput * emitted;
+        }
+
+        if (algorithm == Algorithm::AmbientOcclusion)
+        {
+            //法线朝向光线的来向，从球的内部看时也在可见的一侧发出光线
+            Direction normal = rec.normal.dot(current_ray.get_direction()) > 0 ? -rec.normal : rec.normal;
+            OrthonormalBasis basis(normal);
+            int unoccluded = 0;
+            for (int k = 0; k < ao_samples; ++k)
+            {
+                double u1, u2;
+                sampler.get_2d(u1, u2);
+                HitRecord blocker;
+                if (!world.hit(rec.spawn_ray(basis.to_world(sample_cosine_hemisphere(u1, u2)), current_ray.get_time(), ao_radius), 0, blocker))
+                {
+                    ++unoccluded;
+                }
+            }
+            return Color(255, 255, 255) * (ao_samples > 0 ? static_cast<double>(unoccluded) / ao_samples : 1);
+        }
+
+        ScatterRecord srec;
+        rec.material->scatter(current_ray, rec, srec, sampler);
 
+        if (rec.material->is_specular())
+        {
+            throughput = throughput * srec.attenuation / 255.0;
+            current_ray = srec.scattered_ray;
+            continue;
+        }
+
+        if (algorithm == Algorithm::Albedo)
+        {
+            return throughput * srec.attenuation;
+        }
+        return throughput * estimate_direct_light(current_ray, rec, world, sampler, false);
     }
 }
 
 //通过光子映射来计算像素的颜色
-Color Camera::ray_color_photons(const Ray &ray, int depth, const Hittable &world, Photomap &photomap) {
+Color Camera::ray_color_photons(const Ray &ray, int depth, const Hittable &world, Sampler &sampler, Photomap &photomap) {
 
     if (depth <= 0) {
         return overflows_color;
@@ -315,11 +2625,11 @@ Color Camera::ray_color_photons(const Ray &ray, int depth, const Hittable &world
 
     HitRecord rec;
 
-    if (world.hit(ray, 0.001, 1000, rec)) {
+    if (world.hit(ray, 0, rec)) {
 
         ScatterRecord srec;
 
-        rec.material->scatter(ray, rec, srec);
+        rec.material->scatter(ray, rec, srec, sampler);
 
         int num_photons = 100;
 
@@ -361,4 +2671,9 @@ Color Camera::ray_color_photons(const Ray &ray, int depth, const Hittable &world
 void Camera::write_image(std::ostream &out) const
 {
     image.write_as_ppm(out);
+}
+
+void Camera::write_sample_heatmap(std::ostream &out) const
+{
+    sample_heatmap.write_as_ppm(out);
 }
\ No newline at end of file
@@ -0,0 +1,58 @@
+#include "hash_grid.hpp"
+
+#include <algorithm>
+#include <limits>
+
+//Teschner等人的空间哈希
+uint32_t HashGrid::cell_index(int64_t x, int64_t y, int64_t z) const
+{
+    uint32_t hash = (static_cast<uint32_t>(x) * 73856093u) ^ (static_cast<uint32_t>(y) * 19349663u) ^ (static_cast<uint32_t>(z) * 83492791u);
+    return hash % static_cast<uint32_t>(cell_ends.size());
+}
+
+void HashGrid::build(const std::vector<Point> &points, double radius)
+{
+    this->points = points;
+    this->radius = radius;
+    radius_squared = radius * radius;
+    inverse_cell_size = 1 / (2 * radius);
+
+    indices.clear();
+    cell_ends.clear();
+    if (points.empty())
+    {
+        return;
+    }
+
+    double lower[3] = {std::numeric_limits<double>::infinity(), std::numeric_limits<double>::infinity(), std::numeric_limits<double>::infinity()};
+    for (const Point &p : points)
+    {
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            lower[axis] = std::min(lower[axis], p[axis]);
+        }
+    }
+    minimum = Point(lower[0], lower[1], lower[2]);
+
+    //先数出每个桶的点数，前缀和之后就是每个桶的结束位置，再倒着把下标填进去
+    cell_ends.assign(points.size(), 0);
+    std::vector<uint32_t> cells(points.size());
+    for (size_t i = 0; i < points.size(); ++i)
+    {
+        Direction offset = (points[i] - minimum) * inverse_cell_size;
+        cells[i] = cell_index(static_cast<int64_t>(std::floor(offset.x())), static_cast<int64_t>(std::floor(offset.y())),
+                              static_cast<int64_t>(std::floor(offset.z())));
+        ++cell_ends[cells[i]];
+    }
+    for (size_t c = 1; c < cell_ends.size(); ++c)
+    {
+        cell_ends[c] += cell_ends[c - 1];
+    }
+
+    indices.resize(points.size());
+    std::vector<uint32_t> fill(cell_ends);
+    for (size_t i = points.size(); i-- > 0;)
+    {
+        indices[--fill[cells[i]]] = static_cast<uint32_t>(i);
+    }
+}
@@ -5,18 +5,17 @@ void HittableList::add(std::shared_ptr<Hittable> object)
     objects.push_back(object);
 }
 
-bool HittableList::hit(const Ray &ray, double t_min, double t_max, HitRecord &rec) const
+//击中的物体会收缩光线的t_max，所以最后一个击中的就是最近的
+bool HittableList::hit(const Ray &ray, double t_min, HitRecord &rec) const
 {
     HitRecord temp_rec;
     bool hit_anything = false;
-    double closest_so_far = t_max;
 
     for (const auto &object : objects)
     {
-        if (object->hit(ray, t_min, closest_so_far, temp_rec))
+        if (object->hit(ray, t_min, temp_rec))
         {
             hit_anything = true;
-            closest_so_far = temp_rec.t;
             rec = temp_rec;
         }
     }
@@ -48,5 +47,22 @@ AABB HittableList::bounding_box() const
         first_box = false;
     }
 
+    return box;
+}
+
+AABB HittableList::bounding_box_at(double time) const
+{
+    if (objects.empty())
+    {
+        return AABB(Point(0, 0, 0), Point(0, 0, 0));
+    }
+
+    AABB box = objects[0]->bounding_box_at(time);
+
+    for (size_t i = 1; i < objects.size(); ++i)
+    {
+        box = AABB::surrounding_box(box, objects[i]->bounding_box_at(time));
+    }
+
     return box;
 }
\ No newline at end of file
@@ -0,0 +1,149 @@
+#include "irradiance_cache.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+
+Color IrradianceRecord::extrapolate(const Point &p, const Direction &n) const
+{
+    Direction rotation = normal.cross(n);
+    Direction translation = p - position;
+    double channels[3] = {irradiance.r(), irradiance.g(), irradiance.b()};
+    for (int c = 0; c < 3; ++c)
+    {
+        channels[c] = std::max(0.0, channels[c] + rotation.dot(rotation_gradient[c]) + translation.dot(translation_gradient[c]));
+    }
+    return Color(channels[0], channels[1], channels[2]);
+}
+
+IrradianceCache::IrradianceCache(double accuracy, double min_radius, double max_radius)
+    : accuracy(accuracy), min_radius(min_radius), max_radius(max_radius)
+{
+}
+
+void IrradianceCache::reset(const AABB &bounds)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    Direction extent = bounds.maximum - bounds.minimum;
+    double half_size = std::max(extent.x(), std::max(extent.y(), extent.z())) * 0.5 + 1e-3;
+    root = std::make_unique<Node>(bounds.minimum + extent * 0.5, half_size);
+    record_count = 0;
+}
+
+//权重用1 - e / a，在有效区域的边界上平滑地降到0，插值结果没有Ward权重在记录处的奇点
+//记录在p前方(p在记录的切平面后面)时，它看到的遮挡和p不同，不使用
+bool IrradianceCache::lookup(const Point &p, const Direction &n, Color &irradiance) const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    if (!root)
+    {
+        return false;
+    }
+
+    Color sum(0, 0, 0);
+    double weight_sum = 0;
+
+    const Node *stack[256];
+    int stack_size = 0;
+    stack[stack_size++] = root.get();
+    while (stack_size > 0)
+    {
+        const Node *node = stack[--stack_size];
+
+        for (const IrradianceRecord &record : node->records)
+        {
+            Direction offset = p - record.position;
+            double distance = offset.length();
+            double error = distance / record.radius + std::sqrt(std::max(0.0, 1 - n.dot(record.normal)));
+            if (error >= accuracy)
+            {
+                continue;
+            }
+            if (offset.dot(n + record.normal) * 0.5 < -0.05 * record.radius)
+            {
+                continue;
+            }
+
+            double weight = 1 - error / accuracy;
+            sum = sum + record.extrapolate(p, n) * weight;
+            weight_sum += weight;
+        }
+
+        //子节点里记录的有效半径不超过子节点的半边长
+        for (const auto &child : node->children)
+        {
+            if (!child || stack_size == 256)
+            {
+                continue;
+            }
+            double reach = child->half_size * 2;
+            if (std::fabs(p.x() - child->center.x()) <= reach && std::fabs(p.y() - child->center.y()) <= reach
+                && std::fabs(p.z() - child->center.z()) <= reach)
+            {
+                stack[stack_size++] = child.get();
+            }
+        }
+    }
+
+    if (weight_sum <= 0)
+    {
+        return false;
+    }
+    irradiance = sum / weight_sum;
+    return true;
+}
+
+//半径不超过辐照度除以平移梯度的长度(Tabellion和Lamorlette)，梯度大的地方记录更密
+void IrradianceCache::insert(IrradianceRecord record)
+{
+    double channels[3] = {record.irradiance.r(), record.irradiance.g(), record.irradiance.b()};
+    for (int c = 0; c < 3; ++c)
+    {
+        double gradient = record.translation_gradient[c].length();
+        if (channels[c] > 0 && gradient > 0)
+        {
+            record.radius = std::min(record.radius, channels[c] / gradient);
+        }
+    }
+    record.radius = std::clamp(record.radius, min_radius, max_radius);
+    double valid_radius = record.radius * accuracy;
+
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    if (!root)
+    {
+        return;
+    }
+
+    Node *node = root.get();
+    while (node->half_size * 0.5 >= valid_radius)
+    {
+        const Point &c = node->center;
+        const Point &q = record.position;
+
+        //超出根节点范围的记录(比如运动的物体)留在当前节点
+        if (std::fabs(q.x() - c.x()) > node->half_size || std::fabs(q.y() - c.y()) > node->half_size
+            || std::fabs(q.z() - c.z()) > node->half_size)
+        {
+            break;
+        }
+
+        int index = (q.x() >= c.x()) | ((q.y() >= c.y()) << 1) | ((q.z() >= c.z()) << 2);
+        if (!node->children[index])
+        {
+            double quarter = node->half_size * 0.5;
+            Point child_center(c.x() + ((index & 1) ? quarter : -quarter), c.y() + ((index & 2) ? quarter : -quarter),
+                               c.z() + ((index & 4) ? quarter : -quarter));
+            node->children[index] = std::make_unique<Node>(child_center, quarter);
+        }
+        node = node->children[index].get();
+    }
+
+    node->records.push_back(record);
+    ++record_count;
+}
+
+size_t IrradianceCache::size() const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return record_count;
+}
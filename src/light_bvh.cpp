@@ -0,0 +1,354 @@
+#include "light_bvh.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+static double safe_sqrt(double x)
+{
+    return std::sqrt(std::max(0.0, x));
+}
+
+static double safe_acos(double x)
+{
+    return std::acos(std::clamp(x, -1.0, 1.0));
+}
+
+//cos(a - b)，a < b时夹角取0
+static double cos_sub_clamped(double sin_a, double cos_a, double sin_b, double cos_b)
+{
+    if (cos_a > cos_b)
+    {
+        return 1;
+    }
+    return cos_a * cos_b + sin_a * sin_b;
+}
+
+//sin(a - b)，a < b时夹角取0
+static double sin_sub_clamped(double sin_a, double cos_a, double sin_b, double cos_b)
+{
+    if (cos_a > cos_b)
+    {
+        return 0;
+    }
+    return sin_a * cos_b - cos_a * sin_b;
+}
+
+double LightBounds::importance(const Point &p, const Direction &n) const
+{
+    //用包围盒的中心近似光源的位置，距离不小于包围盒对角线的一半，避免在包围盒内部时趋于无穷
+    Point center = bounds.minimum + (bounds.maximum - bounds.minimum) / 2;
+    double radius = (bounds.maximum - bounds.minimum).length() / 2;
+    double d2 = std::max((p - center).length_squared(), radius);
+
+    //从着色点看包围盒的包围球所张的圆锥
+    double cos_theta_b = -1;
+    double distance_squared = (p - center).length_squared();
+    if (distance_squared > radius * radius)
+    {
+        cos_theta_b = safe_sqrt(1 - radius * radius / distance_squared);
+    }
+    double sin_theta_b = safe_sqrt(1 - cos_theta_b * cos_theta_b);
+
+    //着色点方向和发光圆锥轴的夹角，减去圆锥的半角和包围盒的张角，就是可能的最小夹角
+    Direction wi = (distance_squared > 0) ? (p - center).unit() : Direction(0, 0, 1);
+    double cos_theta_w = std::fabs(axis.dot(wi));
+    double sin_theta_w = safe_sqrt(1 - cos_theta_w * cos_theta_w);
+    double sin_theta_o = safe_sqrt(1 - cos_theta_o * cos_theta_o);
+
+    double cos_theta_x = cos_sub_clamped(sin_theta_w, cos_theta_w, sin_theta_o, cos_theta_o);
+    double sin_theta_x = sin_sub_clamped(sin_theta_w, cos_theta_w, sin_theta_o, cos_theta_o);
+    double cos_theta_p = cos_sub_clamped(sin_theta_x, cos_theta_x, sin_theta_b, cos_theta_b);
+
+    if (cos_theta_p <= cos_theta_e)
+    {
+        return 0;
+    }
+
+    double result = phi * cos_theta_p / d2;
+
+    //着色点这一侧的余弦也取可能的最大值
+    if (n.length_squared() > 0)
+    {
+        double cos_theta_i = std::fabs(wi.dot(n));
+        double sin_theta_i = safe_sqrt(1 - cos_theta_i * cos_theta_i);
+        result *= cos_sub_clamped(sin_theta_i, cos_theta_i, sin_theta_b, cos_theta_b);
+    }
+
+    return std::max(result, 0.0);
+}
+
+LightBounds LightBounds::merge(const LightBounds &a, const LightBounds &b)
+{
+    if (a.phi == 0)
+    {
+        return b;
+    }
+    if (b.phi == 0)
+    {
+        return a;
+    }
+
+    //两个方向圆锥的并集
+    Direction merged_axis = a.axis;
+    double merged_cos = -1;
+
+    double theta_a = safe_acos(a.cos_theta_o);
+    double theta_b = safe_acos(b.cos_theta_o);
+    double theta_d = safe_acos(a.axis.dot(b.axis));
+
+    if (std::min(theta_d + theta_b, M_PI) <= theta_a)
+    {
+        merged_axis = a.axis;
+        merged_cos = a.cos_theta_o;
+    }
+    else if (std::min(theta_d + theta_a, M_PI) <= theta_b)
+    {
+        merged_axis = b.axis;
+        merged_cos = b.cos_theta_o;
+    }
+    else
+    {
+        double theta_o = (theta_a + theta_d + theta_b) / 2;
+        Direction rotation_axis = a.axis.cross(b.axis);
+        if (theta_o < M_PI && rotation_axis.length_squared() > 0)
+        {
+            merged_axis = a.axis.rotate(rotation_axis, theta_o - theta_a);
+            merged_cos = std::cos(theta_o);
+        }
+    }
+
+    return LightBounds(AABB::surrounding_box(a.bounds, b.bounds), a.phi + b.phi, merged_axis, merged_cos,
+                       std::min(a.cos_theta_e, b.cos_theta_e));
+}
+
+LightBVH::LightBVH(const std::vector<std::shared_ptr<Hittable>> &lights, const std::vector<double> &powers)
+{
+    light_to_leaf.assign(lights.size(), -1);
+
+    std::vector<BuildLight> build_lights;
+    for (size_t i = 0; i < lights.size(); ++i)
+    {
+        if (!(powers[i] > 0))
+        {
+            continue;
+        }
+
+        Direction axis;
+        double cos_theta_o;
+        lights[i]->emission_cone(axis, cos_theta_o);
+
+        AABB box = lights[i]->bounding_box();
+        Point centroid = box.minimum + (box.maximum - box.minimum) / 2;
+
+        //面光源在法线附近的半球内发光，所以cos_theta_e是cos(90°)
+        build_lights.push_back({static_cast<int>(i), LightBounds(box, powers[i], axis, cos_theta_o, 0), centroid});
+    }
+
+    if (!build_lights.empty())
+    {
+        nodes.reserve(2 * build_lights.size());
+        build(build_lights, 0, static_cast<int>(build_lights.size()), -1);
+    }
+}
+
+double LightBVH::evaluate_cost(const LightBounds &b, const AABB &bounds, int axis)
+{
+    //方向圆锥在球面上覆盖的"面积"
+    double theta_o = safe_acos(b.cos_theta_o);
+    double theta_e = safe_acos(b.cos_theta_e);
+    double theta_w = std::min(theta_o + theta_e, M_PI);
+    double sin_theta_o = safe_sqrt(1 - b.cos_theta_o * b.cos_theta_o);
+    double m_omega = 2 * M_PI * (1 - b.cos_theta_o)
+                   + M_PI / 2 * (2 * theta_w * sin_theta_o - std::cos(theta_o - 2 * theta_w) - 2 * theta_o * sin_theta_o + b.cos_theta_o);
+
+    //细长的节点沿短轴分割时加大代价
+    Direction diagonal = bounds.maximum - bounds.minimum;
+    double max_extent = std::max(diagonal.x(), std::max(diagonal.y(), diagonal.z()));
+    double kr = diagonal[axis] > 0 ? max_extent / diagonal[axis] : 0;
+
+    Direction d = b.bounds.maximum - b.bounds.minimum;
+    double surface_area = 2 * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+
+    return b.phi * m_omega * kr * surface_area;
+}
+
+int LightBVH::build(std::vector<BuildLight> &build_lights, int begin, int end, int parent)
+{
+    int node_index = static_cast<int>(nodes.size());
+    nodes.push_back(Node());
+
+    if (end - begin == 1)
+    {
+        const BuildLight &light = build_lights[begin];
+        nodes[node_index] = {light.light_bounds, static_cast<uint32_t>(light.index), true, parent};
+        light_to_leaf[light.index] = node_index;
+        return node_index;
+    }
+
+    AABB bounds = build_lights[begin].light_bounds.bounds;
+    AABB centroid_bounds(build_lights[begin].centroid, build_lights[begin].centroid);
+    for (int i = begin + 1; i < end; ++i)
+    {
+        bounds = AABB::surrounding_box(bounds, build_lights[i].light_bounds.bounds);
+        centroid_bounds = AABB::surrounding_box(centroid_bounds, AABB(build_lights[i].centroid, build_lights[i].centroid));
+    }
+
+    //每个轴分成若干个桶，选代价最小的分割
+    constexpr int bucket_count = 12;
+    double min_cost = std::numeric_limits<double>::infinity();
+    int min_axis = -1;
+    int min_bucket = -1;
+
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        double low = centroid_bounds.minimum[axis];
+        double high = centroid_bounds.maximum[axis];
+        if (high == low)
+        {
+            continue;
+        }
+
+        LightBounds buckets[bucket_count];
+        for (int i = begin; i < end; ++i)
+        {
+            int b = std::min(static_cast<int>(bucket_count * (build_lights[i].centroid[axis] - low) / (high - low)), bucket_count - 1);
+            buckets[b] = LightBounds::merge(buckets[b], build_lights[i].light_bounds);
+        }
+
+        for (int split = 0; split < bucket_count - 1; ++split)
+        {
+            LightBounds below;
+            LightBounds above;
+            for (int b = 0; b <= split; ++b)
+            {
+                below = LightBounds::merge(below, buckets[b]);
+            }
+            for (int b = split + 1; b < bucket_count; ++b)
+            {
+                above = LightBounds::merge(above, buckets[b]);
+            }
+
+            if (below.phi == 0 || above.phi == 0)
+            {
+                continue;
+            }
+
+            double cost = evaluate_cost(below, bounds, axis) + evaluate_cost(above, bounds, axis);
+            if (cost < min_cost)
+            {
+                min_cost = cost;
+                min_axis = axis;
+                min_bucket = split;
+            }
+        }
+    }
+
+    int mid;
+    if (min_axis == -1)
+    {
+        //所有光源的中心重合，只能从中间分开
+        mid = (begin + end) / 2;
+    }
+    else
+    {
+        double low = centroid_bounds.minimum[min_axis];
+        double high = centroid_bounds.maximum[min_axis];
+        auto middle = std::partition(build_lights.begin() + begin, build_lights.begin() + end, [&](const BuildLight &light) {
+            int b = std::min(static_cast<int>(bucket_count * (light.centroid[min_axis] - low) / (high - low)), bucket_count - 1);
+            return b <= min_bucket;
+        });
+        mid = static_cast<int>(middle - build_lights.begin());
+        if (mid == begin || mid == end)
+        {
+            mid = (begin + end) / 2;
+        }
+    }
+
+    int left = build(build_lights, begin, mid, node_index);
+    int right = build(build_lights, mid, end, node_index);
+
+    nodes[node_index] = {LightBounds::merge(nodes[left].light_bounds, nodes[right].light_bounds), static_cast<uint32_t>(right), false, parent};
+    return node_index;
+}
+
+int LightBVH::sample(const Point &p, const Direction &n, double u, double &pmf) const
+{
+    pmf = 0;
+    if (nodes.empty())
+    {
+        return -1;
+    }
+
+    int node_index = 0;
+    double probability = 1;
+
+    while (true)
+    {
+        const Node &node = nodes[node_index];
+
+        if (node.is_leaf)
+        {
+            //只有一个光源时也要检查它是否有贡献
+            if (node_index > 0 || node.light_bounds.importance(p, n) > 0)
+            {
+                pmf = probability;
+                return static_cast<int>(node.child_or_light);
+            }
+            return -1;
+        }
+
+        double left = nodes[node_index + 1].light_bounds.importance(p, n);
+        double right = nodes[node.child_or_light].light_bounds.importance(p, n);
+        if (left == 0 && right == 0)
+        {
+            return -1;
+        }
+
+        //选中一个孩子后，把u重新映射回[0, 1)，继续在下一层使用
+        double left_probability = left / (left + right);
+        if (u < left_probability)
+        {
+            u = std::min(u / left_probability, 1 - std::numeric_limits<double>::epsilon());
+            probability *= left_probability;
+            node_index = node_index + 1;
+        }
+        else
+        {
+            u = std::min((u - left_probability) / (1 - left_probability), 1 - std::numeric_limits<double>::epsilon());
+            probability *= 1 - left_probability;
+            node_index = static_cast<int>(node.child_or_light);
+        }
+    }
+}
+
+double LightBVH::pmf(const Point &p, const Direction &n, int light) const
+{
+    if (light < 0 || light >= static_cast<int>(light_to_leaf.size()) || light_to_leaf[light] < 0)
+    {
+        return 0;
+    }
+
+    int node_index = light_to_leaf[light];
+    if (nodes[node_index].parent < 0)
+    {
+        return nodes[node_index].light_bounds.importance(p, n) > 0 ? 1 : 0;
+    }
+
+    //和sample()走的是同一条路径，只是方向反过来
+    double probability = 1;
+    while (nodes[node_index].parent >= 0)
+    {
+        int parent = nodes[node_index].parent;
+        double left = nodes[parent + 1].light_bounds.importance(p, n);
+        double right = nodes[nodes[parent].child_or_light].light_bounds.importance(p, n);
+        if (left == 0 && right == 0)
+        {
+            return 0;
+        }
+
+        probability *= (node_index == parent + 1 ? left : right) / (left + right);
+        node_index = parent;
+    }
+
+    return probability;
+}
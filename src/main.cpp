@@ -1,5 +1,6 @@
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_keycode.h>
+#include <algorithm>
 #include <memory>
 #include <tuple>
 #include <vector>
@@ -19,7 +20,7 @@
 #include "random_generator.hpp"
 #include "sphere.hpp"
 #include "triangle.hpp"
-#include "obj_loader.hpp"
+#include "mesh.hpp"
 #include "basic_types.hpp"
 #include "photo_map.hpp"
 
@@ -36,25 +37,80 @@ bool spheres_overlap(const std::shared_ptr<Sphere>& sphere1, const std::shared_p
 
 std::vector<std::shared_ptr<Hittable>> generate_random_scene();
 
-std::tuple<std::vector<std::shared_ptr<Hittable>>, std::vector<std::shared_ptr<Hittable>>> generate_test_scene();
+std::tuple<std::vector<std::shared_ptr<Hittable>>, std::vector<std::shared_ptr<Hittable>>> generate_test_scene(bool glossy);
 
 int main(int argc, char* argv[]) {
 
     //handle command line arguments
+    //--bunny: 在场景中加入斯坦福兔子
+    //--quantize: 兔子使用量化的顶点格式
+    //--guiding: 完整渲染时使用路径引导
+    //--irradiance-cache: 使用辐照度缓存，缓存在相机移动时保留，之后的帧只需要补充新看到的区域
+    //--radiance-cache: 路径在哈希辐亮度缓存中有足够样本的位置提前结束
+    //--restir: 主交点的直接光照用ReSTIR的蓄水池重采样，移动时1spp的预览复用上一帧的样本
+    //--restir-gi: 在--restir的基础上，主交点的间接光照也在像素之间和帧之间复用次级路径
+    //--vcm: 用顶点连接与合并(VCM)把双向路径追踪和光子映射结合起来，适合焦散和难以直接连接光源的场景
+    //--mlt: 用主样本空间的Metropolis光传输，样本集中在对图像贡献大的路径上，适合光只能穿过玻璃或窄缝到达的场景
+    //--vpl: 间接光照由从光源发出的虚拟点光源照亮，比路径追踪快，相机移动时虚拟点光源不需要重新生成
+    //--glossy: 测试场景的两个球换成GGX微表面材质，一个粗糙的金属球和一个磨砂玻璃球
+    //--preview-normals, --preview-albedo, --preview-ao, --preview-direct: 移动相机时换成对应的快速预览(法线、颜色、环境光遮蔽、只有直接光照)，停下来之后换回完整的算法
     std::vector<std::string> args(argv, argv + argc);
+    bool add_bunny = std::find(args.begin(), args.end(), "--bunny") != args.end();
+    bool quantize = std::find(args.begin(), args.end(), "--quantize") != args.end();
+    bool guiding = std::find(args.begin(), args.end(), "--guiding") != args.end();
+    bool irradiance_cache = std::find(args.begin(), args.end(), "--irradiance-cache") != args.end();
+    bool radiance_cache = std::find(args.begin(), args.end(), "--radiance-cache") != args.end();
+    bool restir_gi = std::find(args.begin(), args.end(), "--restir-gi") != args.end();
+    bool vcm = std::find(args.begin(), args.end(), "--vcm") != args.end();
+    bool mlt = std::find(args.begin(), args.end(), "--mlt") != args.end();
+    bool vpl = std::find(args.begin(), args.end(), "--vpl") != args.end();
+    bool glossy = std::find(args.begin(), args.end(), "--glossy") != args.end();
+    bool restir = restir_gi || std::find(args.begin(), args.end(), "--restir") != args.end();
+    int preview_algorithm = -1;
+    if (std::find(args.begin(), args.end(), "--preview-normals") != args.end()) {
+        preview_algorithm = Algorithm::Normals;
+    }
+    else if (std::find(args.begin(), args.end(), "--preview-albedo") != args.end()) {
+        preview_algorithm = Algorithm::Albedo;
+    }
+    else if (std::find(args.begin(), args.end(), "--preview-ao") != args.end()) {
+        preview_algorithm = Algorithm::AmbientOcclusion;
+    }
+    else if (std::find(args.begin(), args.end(), "--preview-direct") != args.end()) {
+        preview_algorithm = Algorithm::DirectLighting;
+    }
 
     //initialize SDL
     SDL_Init(SDL_INIT_VIDEO);
     atexit(SDL_Quit);
 
     //generate test scene
-    auto [objects, lights] = generate_test_scene();
+    auto [objects, lights] = generate_test_scene(glossy);
+
+    if (add_bunny) {
+        auto bunny = Mesh::load_obj("models/bunny/bunny.obj", std::make_shared<Lambertian>(Color(200, 200, 200)),
+                                    5.0, Direction(0, -0.165, -1.2), quantize ? VertexFormat::Quantized16 : VertexFormat::FullPrecision);
+        if (bunny) {
+            objects.push_back(bunny);
+        }
+    }
     auto world = std::make_shared<HittableList>(objects);
 
     //set up camera
-    Camera camera(16.0 / 9.0, 800, 30, 5);
+    //移动相机时用蓝噪声采样器以preview_samples的样本数快速预览，指定了预览算法时换成它，
+    //停止移动refine_delay毫秒后再用Sobol采样器以full_samples的样本数渲染一次完整的图像
+    const int full_samples = 30;
+    const int preview_samples = 1;
+    const Uint32 refine_delay = 300;
+    Camera camera(16.0 / 9.0, 800, full_samples, 32);
     camera.set_world(world, lights);
-    camera.set_algorithm(Algorithm::PathTracingPDF);
+    int full_algorithm = vpl ? Algorithm::VPL : mlt ? Algorithm::MLT : vcm ? Algorithm::VCM : restir ? Algorithm::ReSTIR : irradiance_cache ? Algorithm::IrradianceCaching : Algorithm::PathTracingPDF;
+    camera.set_algorithm(full_algorithm);
+    camera.set_path_guiding(guiding);
+    camera.set_radiance_cache(radiance_cache);
+    camera.set_restir_gi(restir_gi);
+    bool needs_refine = false;
+    Uint32 last_move_time = 0;
 
     //generate the first image
     camera.render();
@@ -126,13 +182,30 @@ int main(int argc, char* argv[]) {
         }
 
         if (camera_moved) {
-            camera.render_parallel();
-            ss.str("");
-            ss.clear();
-            camera.write_image(ss);
-            window.display_image(ss.str());
+            if (preview_algorithm >= 0) {
+                camera.set_algorithm(preview_algorithm);
+            }
+            camera.set_sampler(SamplerType::BlueNoise);
+            camera.set_samples_per_pixel(preview_samples);
+            needs_refine = true;
+            last_move_time = SDL_GetTicks();
         }
-        SDL_Delay(10);
+        else if (needs_refine && SDL_GetTicks() - last_move_time >= refine_delay) {
+            camera.set_algorithm(full_algorithm);
+            camera.set_sampler(SamplerType::Sobol);
+            camera.set_samples_per_pixel(full_samples);
+            needs_refine = false;
+        }
+        else {
+            SDL_Delay(10);
+            continue;
+        }
+
+        camera.render_parallel();
+        ss.str("");
+        ss.clear();
+        camera.write_image(ss);
+        window.display_image(ss.str());
     }
     return 0;
 }
@@ -222,6 +295,9 @@ std::vector<std::shared_ptr<Hittable>> generate_random_scene() {
     const int desired_sphere_count = 1000;
     int sphere_count = 0;
 
+    // 已经放下的球(按快门打开时的位置)，用于检测重叠
+    std::vector<std::shared_ptr<Sphere>> placed_spheres;
+
     while (sphere_count < desired_sphere_count) {
         bool overlap = false;
         int attempts = 0;
@@ -264,13 +340,10 @@ std::vector<std::shared_ptr<Hittable>> generate_random_scene() {
             random_sphere = std::make_shared<Sphere>(Point(random_x, y, random_z), random_radius, random_material);
 
             overlap = false;
-            for (const auto& obj : objects) {
-                auto existing_sphere = std::dynamic_pointer_cast<Sphere>(obj);
-                if (existing_sphere) {
-                    if (spheres_overlap(random_sphere, existing_sphere)) {
-                        overlap = true;
-                        break;
-                    }
+            for (const auto& existing_sphere : placed_spheres) {
+                if (spheres_overlap(random_sphere, existing_sphere)) {
+                    overlap = true;
+                    break;
                 }
             }
 
@@ -278,7 +351,15 @@ std::vector<std::shared_ptr<Hittable>> generate_random_scene() {
         } while (overlap);
 
         if (!overlap) {
-            objects.push_back(random_sphere);
+            placed_spheres.push_back(random_sphere);
+
+            // 漫反射的球在快门时间内向上弹起，用来展示动态模糊
+            if (std::dynamic_pointer_cast<Lambertian>(random_material)) {
+                auto center1 = random_sphere->get_center() + Direction(0, random_generator.get_random_double(0, 0.5), 0);
+                objects.push_back(std::make_shared<MovingSphere>(random_sphere->get_center(), center1, random_sphere->get_radius(), random_material));
+            } else {
+                objects.push_back(random_sphere);
+            }
             sphere_count++;
         }
     }
@@ -290,14 +371,20 @@ std::vector<std::shared_ptr<Hittable>> generate_random_scene() {
     return objects;
 }
 
-std::tuple<std::vector<std::shared_ptr<Hittable>>, std::vector<std::shared_ptr<Hittable>>> generate_test_scene() {
+std::tuple<std::vector<std::shared_ptr<Hittable>>, std::vector<std::shared_ptr<Hittable>>> generate_test_scene(bool glossy) {
     auto floor_material = std::make_shared<Lambertian>(Color(125, 125, 125));
     auto light_material = std::make_shared<Lambertian>(Color(255, 255, 255));
     light_material->set_light_color(Color(10000, 10000, 10000));
 
     auto floor = std::make_shared<Sphere>(Point(0, -1000, 0), 1000, floor_material);
-    auto sphere1 = std::make_shared<Sphere>(Point(1, 1, -2), 1, std::make_shared<Lambertian>(Color(200, 0, 0)));
-    auto sphere2 = std::make_shared<Sphere>(Point(-1, 1, -2), 1, std::make_shared<Lambertian>(Color(0, 200, 0)));
+    std::shared_ptr<Material> material1 = std::make_shared<Lambertian>(Color(200, 0, 0));
+    std::shared_ptr<Material> material2 = std::make_shared<Lambertian>(Color(0, 200, 0));
+    if (glossy) {
+        material1 = std::make_shared<GGXMetal>(Color(240, 170, 80), 0.3);
+        material2 = std::make_shared<GGXDielectric>(1.5, 0.2);
+    }
+    auto sphere1 = std::make_shared<Sphere>(Point(1, 1, -2), 1, material1);
+    auto sphere2 = std::make_shared<Sphere>(Point(-1, 1, -2), 1, material2);
     auto sphere3 = std::make_shared<Sphere>(Point(0, 3, -2), 0.1, light_material);
     auto point1 = Point(1.75, 2.25, -3);
     auto point2 = Point(1.75, 2, -3);
@@ -1,19 +1,23 @@
 #include "material.hpp"
 #include "basic_types.hpp"
 #include "ray.hpp"
+#include "sampling.hpp"
 
-RandomGenerator Material::random_generator;
+#include <algorithm>
+#include <cmath>
 
 void Material::set_light_color(const Color &light_color)
 {
     this->light_color = light_color;
 }
 
-void Lambertian::scatter(const Ray &ray_in, const HitRecord &rec, ScatterRecord &srec) const
+void Lambertian::scatter(const Ray &ray_in, const HitRecord &rec, ScatterRecord &srec, Sampler &sampler) const
 {
-    auto random_point = random_generator.sample_point_sphere(rec.p, 1) + rec.normal;
-    auto ray_direction = Direction(random_point - rec.p).unit();
-    srec.scattered_ray = Ray(rec.p, ray_direction);
+    double u1, u2;
+    sampler.get_2d(u1, u2);
+    sampler.skip_dimensions(1);
+    auto ray_direction = OrthonormalBasis(rec.normal).to_world(sample_cosine_hemisphere(u1, u2));
+    srec.scattered_ray = rec.spawn_ray(ray_direction, ray_in.get_time());
     srec.attenuation = albedo;
     srec.emitted = light_color;
 }
@@ -30,16 +34,23 @@ double Lambertian::scattering_pdf(const Ray &ray_in, const HitRecord &rec, const
     return cosine / M_PI;
 }
 
+Color Lambertian::evaluate(const Ray &ray_in, const HitRecord &rec, const Ray &scattered) const
+{
+    return albedo / 255.0 * scattering_pdf(ray_in, rec, scattered);
+}
+
 Direction Metal::reflect(const Direction &v, const Direction &n)
 {
     return v - n * v.dot(n) * 2;
 }
 
-void Metal::scatter(const Ray &ray_in, const HitRecord &rec, ScatterRecord &srec) const
+void Metal::scatter(const Ray &ray_in, const HitRecord &rec, ScatterRecord &srec, Sampler &sampler) const
 {
-    auto random_point = random_generator.sample_point_sphere(rec.p, fuzz) + rec.normal;
-    auto ray_direction = Direction(random_point - rec.p).unit();
-    srec.scattered_ray = Ray(rec.p, ray_direction);
+    double u1, u2;
+    sampler.get_2d(u1, u2);
+    sampler.skip_dimensions(1);
+    auto ray_direction = (rec.normal + sample_uniform_sphere(u1, u2) * fuzz).unit();
+    srec.scattered_ray = rec.spawn_ray(ray_direction, ray_in.get_time());
     srec.attenuation = albedo;
     srec.emitted = light_color;
 }
@@ -73,7 +84,7 @@ double Dielectric::schlick(double cosine, double ref_idx)
 }
 
 
-void Dielectric::scatter(const Ray &ray_in, const HitRecord &rec, ScatterRecord &srec) const
+void Dielectric::scatter(const Ray &ray_in, const HitRecord &rec, ScatterRecord &srec, Sampler &sampler) const
 {
     srec.attenuation = Color(255, 255, 255);
     srec.emitted = light_color;
@@ -107,12 +118,273 @@ void Dielectric::scatter(const Ray &ray_in, const HitRecord &rec, ScatterRecord
         reflect_prob = 1.0;
     }
 
-    if (random_generator.get_random_double(0, 1) < reflect_prob)
+    //方向是确定的，只用最后1D选择反射或折射
+    sampler.skip_dimensions(2);
+    if (sampler.get_1d() < reflect_prob)
     {
-        srec.scattered_ray = Ray(rec.p, reflected);
+        srec.scattered_ray = rec.spawn_ray(reflected, ray_in.get_time());
     }
     else
     {
-        srec.scattered_ray = Ray(rec.p, refracted);
+        srec.scattered_ray = rec.spawn_ray(refracted, ray_in.get_time());
+    }
+}
+
+//alpha太小时D在半程向量附近的值会溢出
+static constexpr double min_ggx_alpha = 1e-3;
+
+//下面的方向都在局部坐标系中，z轴是(朝向入射一侧的)法线
+//各向同性的GGX法线分布D(m)
+static double ggx_distribution(const Direction &m, double alpha)
+{
+    double a2 = alpha * alpha;
+    double t = m.z() * m.z() * (a2 - 1) + 1;
+    return m.z() > 0 ? a2 / (M_PI * t * t) : 0;
+}
+
+//Smith遮蔽函数的Lambda，G1 = 1 / (1 + Lambda)，G2 = 1 / (1 + Lambda(wo) + Lambda(wi))
+static double ggx_lambda(const Direction &w, double alpha)
+{
+    double cos2 = w.z() * w.z();
+    if (!(cos2 > 0))
+    {
+        return 0;
+    }
+    double tan2 = std::max(0.0, 1 - cos2) / cos2;
+    return (std::sqrt(1 + alpha * alpha * tan2) - 1) / 2;
+}
+
+//可见法线的分布D_wo(m) = G1(wo) * max(0, wo . m) * D(m) / wo.z
+static double ggx_visible_normal_pdf(const Direction &wo, const Direction &m, double alpha)
+{
+    double cos_o = wo.dot(m);
+    if (!(cos_o > 0) || !(wo.z() > 0))
+    {
+        return 0;
+    }
+    return cos_o * ggx_distribution(m, alpha) / ((1 + ggx_lambda(wo, alpha)) * wo.z());
+}
+
+//把椭球拉伸成半球，在wo方向看到的投影圆盘上均匀采样，再投影回半球并压缩回去(Heitz 2018)
+static Direction ggx_sample_visible_normal(const Direction &wo, double alpha, double u1, double u2)
+{
+    Direction vh = Direction(alpha * wo.x(), alpha * wo.y(), wo.z()).unit();
+    double length_squared = vh.x() * vh.x() + vh.y() * vh.y();
+    Direction t1 = length_squared > 0 ? Direction(-vh.y(), vh.x(), 0) / std::sqrt(length_squared) : Direction(1, 0, 0);
+    Direction t2 = vh.cross(t1);
+
+    double r = std::sqrt(u1);
+    double phi = 2 * M_PI * u2;
+    double p1 = r * std::cos(phi);
+    double p2 = r * std::sin(phi);
+    double s = 0.5 * (1 + vh.z());
+    p2 = (1 - s) * std::sqrt(std::max(0.0, 1 - p1 * p1)) + s * p2;
+
+    Direction nh = t1 * p1 + t2 * p2 + vh * std::sqrt(std::max(0.0, 1 - p1 * p1 - p2 * p2));
+    return Direction(alpha * nh.x(), alpha * nh.y(), std::max(1e-6, nh.z())).unit();
+}
+
+//非偏振光在电介质界面上的精确Fresnel反射率，eta是透射一侧和入射一侧的折射率之比，发生全反射时为1
+static double fresnel_dielectric(double cos_i, double eta)
+{
+    double sin2_t = std::max(0.0, 1 - cos_i * cos_i) / (eta * eta);
+    if (sin2_t >= 1)
+    {
+        return 1;
+    }
+    double cos_t = std::sqrt(1 - sin2_t);
+    double parallel = (eta * cos_i - cos_t) / (eta * cos_i + cos_t);
+    double perpendicular = (cos_i - eta * cos_t) / (cos_i + eta * cos_t);
+    return (parallel * parallel + perpendicular * perpendicular) / 2;
+}
+
+static Color fresnel_schlick(const Color &f0, double cos_theta)
+{
+    double m = std::pow(std::max(0.0, 1 - cos_theta), 5);
+    return f0 + (Color(1, 1, 1) - f0) * m;
+}
+
+GGXMetal::GGXMetal(const Color &albedo, double roughness)
+    : albedo(albedo), alpha(std::max(roughness * roughness, min_ggx_alpha)) {}
+
+void GGXMetal::scatter(const Ray &ray_in, const HitRecord &rec, ScatterRecord &srec, Sampler &sampler) const
+{
+    double u1, u2;
+    sampler.get_2d(u1, u2);
+    sampler.skip_dimensions(1);
+    Direction wo_world = -ray_in.get_direction().unit();
+    OrthonormalBasis basis(rec.normal.dot(wo_world) < 0 ? -rec.normal : rec.normal);
+    Direction wo = basis.to_local(wo_world);
+    Direction m = ggx_sample_visible_normal(wo, alpha, u1, u2);
+    Direction wi = m * (2 * wo.dot(m)) - wo;
+
+    srec.scattered_ray = rec.spawn_ray(basis.to_world(wi), ray_in.get_time());
+    srec.emitted = light_color;
+
+    //反射到表面以下的方向被遮挡，能量损失由G2 / G1在其他方向上体现
+    if (!(wi.z() > 0) || !(wo.z() > 0))
+    {
+        srec.attenuation = Color(0, 0, 0);
+        return;
+    }
+    double g1 = 1 / (1 + ggx_lambda(wo, alpha));
+    double g2 = 1 / (1 + ggx_lambda(wo, alpha) + ggx_lambda(wi, alpha));
+    srec.attenuation = fresnel_schlick(albedo / 255.0, wo.dot(m)) * (255 * g2 / g1);
+}
+
+//反射的半程向量m = (wo + wi) / |wo + wi|，dm / dwi = 1 / (4 * (wo . m))
+double GGXMetal::scattering_pdf(const Ray &ray_in, const HitRecord &rec, const Ray &scattered) const
+{
+    Direction wo_world = -ray_in.get_direction().unit();
+    OrthonormalBasis basis(rec.normal.dot(wo_world) < 0 ? -rec.normal : rec.normal);
+    Direction wo = basis.to_local(wo_world);
+    Direction wi = basis.to_local(scattered.get_direction().unit());
+    if (!(wi.z() > 0) || !(wo.z() > 0))
+    {
+        return 0;
+    }
+    Direction m = (wo + wi).unit();
+    return ggx_visible_normal_pdf(wo, m, alpha) / (4 * wo.dot(m));
+}
+
+//f * cos_i = F * D * G2 / (4 * cos_o)
+Color GGXMetal::evaluate(const Ray &ray_in, const HitRecord &rec, const Ray &scattered) const
+{
+    Direction wo_world = -ray_in.get_direction().unit();
+    OrthonormalBasis basis(rec.normal.dot(wo_world) < 0 ? -rec.normal : rec.normal);
+    Direction wo = basis.to_local(wo_world);
+    Direction wi = basis.to_local(scattered.get_direction().unit());
+    if (!(wi.z() > 0) || !(wo.z() > 0))
+    {
+        return Color(0, 0, 0);
+    }
+    Direction m = (wo + wi).unit();
+    double g2 = 1 / (1 + ggx_lambda(wo, alpha) + ggx_lambda(wi, alpha));
+    return fresnel_schlick(albedo / 255.0, wo.dot(m)) * (ggx_distribution(m, alpha) * g2 / (4 * wo.z()));
+}
+
+GGXDielectric::GGXDielectric(double refraction_index, double roughness)
+    : refraction_index(refraction_index), alpha(std::max(roughness * roughness, min_ggx_alpha)) {}
+
+//法线翻到wo一侧作为局部坐标系的z轴，eta是wi一侧(透射时)和wo一侧的折射率之比
+//和Dielectric一样，光线和法线同向时认为从内部射出
+static OrthonormalBasis ggx_dielectric_frame(const Ray &ray_in, const HitRecord &rec, double refraction_index, double &eta)
+{
+    bool entering = ray_in.get_direction().dot(rec.normal) < 0;
+    eta = entering ? refraction_index : 1 / refraction_index;
+    return OrthonormalBasis(entering ? rec.normal : -rec.normal);
+}
+
+//折射的广义半程向量m ∝ wo + eta * wi，翻到wo一侧；wo和wi必须分别在m的两侧
+static bool ggx_refraction_half_vector(const Direction &wo, const Direction &wi, double eta, Direction &m)
+{
+    m = wo + wi * eta;
+    if (!(m.length_squared() > 0))
+    {
+        return false;
+    }
+    m = m.unit();
+    if (m.z() < 0)
+    {
+        m = -m;
+    }
+    return wo.dot(m) > 0 && wi.dot(m) < 0;
+}
+
+void GGXDielectric::scatter(const Ray &ray_in, const HitRecord &rec, ScatterRecord &srec, Sampler &sampler) const
+{
+    double eta;
+    OrthonormalBasis basis = ggx_dielectric_frame(ray_in, rec, refraction_index, eta);
+    Direction wo = basis.to_local(-ray_in.get_direction().unit());
+
+    double u1, u2;
+    sampler.get_2d(u1, u2);
+    Direction m = ggx_sample_visible_normal(wo, alpha, u1, u2);
+    double cos_o = wo.dot(m);
+    double fresnel = fresnel_dielectric(cos_o, eta);
+
+    //按Fresnel项选择反射或折射，选择的概率和BSDF中的F、1 - F抵消
+    Direction wi;
+    bool reflected = sampler.get_1d() < fresnel;
+    if (reflected)
+    {
+        wi = m * (2 * cos_o) - wo;
+    }
+    else
+    {
+        double sin2_t = std::max(0.0, 1 - cos_o * cos_o) / (eta * eta);
+        double cos_t = std::sqrt(std::max(0.0, 1 - sin2_t));
+        wi = -wo / eta + m * (cos_o / eta - cos_t);
+    }
+
+    srec.scattered_ray = rec.spawn_ray(basis.to_world(wi), ray_in.get_time());
+    srec.emitted = light_color;
+    if (!(wo.z() > 0) || (reflected ? !(wi.z() > 0) : !(wi.z() < 0)))
+    {
+        srec.attenuation = Color(0, 0, 0);
+        return;
+    }
+    double g1 = 1 / (1 + ggx_lambda(wo, alpha));
+    double g2 = 1 / (1 + ggx_lambda(wo, alpha) + ggx_lambda(wi, alpha));
+    srec.attenuation = Color(255, 255, 255) * (reflected ? g2 / g1 : g2 / g1 / eta);
+}
+
+//反射：F * D_wo(m) / (4 * (wo . m))
+//折射：(1 - F) * D_wo(m) * |wi . m| / (wi . m + (wo . m) / eta)^2
+double GGXDielectric::scattering_pdf(const Ray &ray_in, const HitRecord &rec, const Ray &scattered) const
+{
+    double eta;
+    OrthonormalBasis basis = ggx_dielectric_frame(ray_in, rec, refraction_index, eta);
+    Direction wo = basis.to_local(-ray_in.get_direction().unit());
+    Direction wi = basis.to_local(scattered.get_direction().unit());
+    if (!(wo.z() > 0) || wi.z() == 0)
+    {
+        return 0;
+    }
+
+    if (wi.z() > 0)
+    {
+        Direction m = (wo + wi).unit();
+        return fresnel_dielectric(wo.dot(m), eta) * ggx_visible_normal_pdf(wo, m, alpha) / (4 * wo.dot(m));
+    }
+
+    Direction m;
+    if (!ggx_refraction_half_vector(wo, wi, eta, m))
+    {
+        return 0;
+    }
+    double denominator = wi.dot(m) + wo.dot(m) / eta;
+    return (1 - fresnel_dielectric(wo.dot(m), eta)) * ggx_visible_normal_pdf(wo, m, alpha) * std::fabs(wi.dot(m)) / (denominator * denominator);
+}
+
+//反射：F * D * G2 / (4 * cos_o)
+//折射：(1 - F) * D * G2 * |wi . m| * |wo . m| / (eta * cos_o * (wi . m + (wo . m) / eta)^2)
+Color GGXDielectric::evaluate(const Ray &ray_in, const HitRecord &rec, const Ray &scattered) const
+{
+    double eta;
+    OrthonormalBasis basis = ggx_dielectric_frame(ray_in, rec, refraction_index, eta);
+    Direction wo = basis.to_local(-ray_in.get_direction().unit());
+    Direction wi = basis.to_local(scattered.get_direction().unit());
+    if (!(wo.z() > 0) || wi.z() == 0)
+    {
+        return Color(0, 0, 0);
+    }
+
+    double g2 = 1 / (1 + ggx_lambda(wo, alpha) + ggx_lambda(wi, alpha));
+    if (wi.z() > 0)
+    {
+        Direction m = (wo + wi).unit();
+        double value = fresnel_dielectric(wo.dot(m), eta) * ggx_distribution(m, alpha) * g2 / (4 * wo.z());
+        return Color(1, 1, 1) * value;
+    }
+
+    Direction m;
+    if (!ggx_refraction_half_vector(wo, wi, eta, m))
+    {
+        return Color(0, 0, 0);
     }
+    double denominator = wi.dot(m) + wo.dot(m) / eta;
+    double value = (1 - fresnel_dielectric(wo.dot(m), eta)) * ggx_distribution(m, alpha) * g2
+                 * std::fabs(wi.dot(m)) * wo.dot(m) / (eta * wo.z() * denominator * denominator);
+    return Color(1, 1, 1) * value;
 }
\ No newline at end of file
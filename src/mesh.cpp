@@ -0,0 +1,341 @@
+#include "mesh.hpp"
+#include "basic_types.hpp"
+#include "obj_loader.hpp"
+#include "triangle.hpp"
+
+#include <algorithm>
+#include <array>
+#include <iostream>
+#include <limits>
+#include <map>
+
+Mesh::Mesh(const std::vector<Point> &positions, const std::vector<Direction> &normals, const std::vector<uint32_t> &indices,
+           std::shared_ptr<Material> material, VertexFormat format)
+    : format(format), indices(indices), material(material)
+{
+    //没有给出法线时，用面积加权的面法线作为顶点法线
+    std::vector<Direction> vertex_normals = normals;
+    if (vertex_normals.size() != positions.size())
+    {
+        vertex_normals.assign(positions.size(), Direction(0, 0, 0));
+        for (size_t i = 0; i + 2 < indices.size(); i += 3)
+        {
+            auto face_normal = (positions[indices[i + 1]] - positions[indices[i]]).cross(positions[indices[i + 2]] - positions[indices[i]]);
+            for (int k = 0; k < 3; ++k)
+            {
+                vertex_normals[indices[i + k]] = vertex_normals[indices[i + k]] + face_normal;
+            }
+        }
+    }
+
+    Point small(std::numeric_limits<double>::infinity(), std::numeric_limits<double>::infinity(), std::numeric_limits<double>::infinity());
+    Point big(-std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity());
+    for (const auto &p : positions)
+    {
+        small = Point(std::min(small.x(), p.x()), std::min(small.y(), p.y()), std::min(small.z(), p.z()));
+        big = Point(std::max(big.x(), p.x()), std::max(big.y(), p.y()), std::max(big.z(), p.z()));
+    }
+    box = AABB(small, big);
+
+    if (format == VertexFormat::Quantized16)
+    {
+        //每个轴上把包围盒均匀分成65535份
+        auto extent = big - small;
+        quantize_scale = Direction(extent.x() / 65535, extent.y() / 65535, extent.z() / 65535);
+
+        quantized.resize(positions.size());
+        for (size_t i = 0; i < positions.size(); ++i)
+        {
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                double q = quantize_scale[axis] > 0 ? (positions[i][axis] - small[axis]) / quantize_scale[axis] : 0;
+                quantized[i].position[axis] = static_cast<uint16_t>(std::clamp(std::lround(q), 0L, 65535L));
+            }
+            encode_octahedral(vertex_normals[i], quantized[i].normal);
+        }
+    }
+    else
+    {
+        this->positions = positions;
+        this->normals.resize(vertex_normals.size());
+        for (size_t i = 0; i < vertex_normals.size(); ++i)
+        {
+            this->normals[i] = vertex_normals[i].length_squared() > 0 ? vertex_normals[i].unit() : Direction(0, 0, 1);
+        }
+    }
+
+    //BVH的包围盒用解码后的顶点计算，保证量化后的三角形一定在包围盒内
+    uint32_t triangle_count = static_cast<uint32_t>(indices.size() / 3);
+    std::vector<uint32_t> triangles(triangle_count);
+    std::vector<Point> centroids(triangle_count);
+    for (uint32_t i = 0; i < triangle_count; ++i)
+    {
+        triangles[i] = i;
+        auto a = vertex_position(indices[3 * i]);
+        auto b = vertex_position(indices[3 * i + 1]);
+        auto c = vertex_position(indices[3 * i + 2]);
+        centroids[i] = Point((a.get_vector() + b.get_vector() + c.get_vector()) / 3);
+    }
+
+    if (triangle_count > 0)
+    {
+        nodes.reserve(2 * triangle_count);
+        build(triangles, centroids, 0, triangle_count);
+    }
+
+    //按照BVH叶子的顺序重排索引，叶子里的三角形是连续存放的
+    std::vector<uint32_t> sorted_indices(indices.size());
+    for (uint32_t i = 0; i < triangle_count; ++i)
+    {
+        for (int k = 0; k < 3; ++k)
+        {
+            sorted_indices[3 * i + k] = indices[3 * triangles[i] + k];
+        }
+    }
+    this->indices = sorted_indices;
+}
+
+uint32_t Mesh::build(std::vector<uint32_t> &triangles, std::vector<Point> &centroids, uint32_t start, uint32_t end)
+{
+    uint32_t index = static_cast<uint32_t>(nodes.size());
+    nodes.push_back(Node());
+
+    AABB node_box;
+    AABB centroid_box(centroids[triangles[start]], centroids[triangles[start]]);
+    for (uint32_t i = start; i < end; ++i)
+    {
+        uint32_t tri = triangles[i];
+        auto a = vertex_position(indices[3 * tri]);
+        auto b = vertex_position(indices[3 * tri + 1]);
+        auto c = vertex_position(indices[3 * tri + 2]);
+        AABB tri_box(Point(std::min({a.x(), b.x(), c.x()}), std::min({a.y(), b.y(), c.y()}), std::min({a.z(), b.z(), c.z()})),
+                     Point(std::max({a.x(), b.x(), c.x()}), std::max({a.y(), b.y(), c.y()}), std::max({a.z(), b.z(), c.z()})));
+        node_box = (i == start) ? tri_box : AABB::surrounding_box(node_box, tri_box);
+        centroid_box = AABB::surrounding_box(centroid_box, AABB(centroids[tri], centroids[tri]));
+    }
+
+    const uint32_t max_leaf_size = 4;
+    if (end - start <= max_leaf_size)
+    {
+        nodes[index] = {node_box, start, end - start};
+        return index;
+    }
+
+    //沿质心包围盒最长的轴按中位数划分
+    auto extent = centroid_box.maximum - centroid_box.minimum;
+    int axis = 0;
+    if (extent.y() > extent.x()) axis = 1;
+    if (extent.z() > extent[axis]) axis = 2;
+
+    uint32_t mid = start + (end - start) / 2;
+    std::nth_element(triangles.begin() + start, triangles.begin() + mid, triangles.begin() + end,
+        [&centroids, axis](uint32_t a, uint32_t b) {
+            return centroids[a][axis] < centroids[b][axis];
+        });
+
+    build(triangles, centroids, start, mid);
+    uint32_t right = build(triangles, centroids, mid, end);
+
+    nodes[index] = {node_box, right, 0};
+    return index;
+}
+
+Point Mesh::vertex_position(uint32_t i) const
+{
+    if (format == VertexFormat::Quantized16)
+    {
+        const auto &q = quantized[i];
+        return box.minimum + Direction(q.position[0] * quantize_scale.x(), q.position[1] * quantize_scale.y(), q.position[2] * quantize_scale.z());
+    }
+    return positions[i];
+}
+
+Direction Mesh::vertex_normal(uint32_t i) const
+{
+    if (format == VertexFormat::Quantized16)
+    {
+        return decode_octahedral(quantized[i].normal);
+    }
+    return normals[i];
+}
+
+//把单位向量投影到八面体|x| + |y| + |z| = 1上，下半部分再折叠到上半部分的外侧
+void Mesh::encode_octahedral(const Direction &n, int16_t out[2])
+{
+    double l1 = std::fabs(n.x()) + std::fabs(n.y()) + std::fabs(n.z());
+    if (l1 == 0)
+    {
+        out[0] = out[1] = 0;
+        return;
+    }
+
+    double x = n.x() / l1;
+    double y = n.y() / l1;
+    if (n.z() < 0)
+    {
+        double folded_x = (1 - std::fabs(y)) * (x >= 0 ? 1 : -1);
+        double folded_y = (1 - std::fabs(x)) * (y >= 0 ? 1 : -1);
+        x = folded_x;
+        y = folded_y;
+    }
+
+    out[0] = static_cast<int16_t>(std::lround(std::clamp(x, -1.0, 1.0) * 32767));
+    out[1] = static_cast<int16_t>(std::lround(std::clamp(y, -1.0, 1.0) * 32767));
+}
+
+Direction Mesh::decode_octahedral(const int16_t in[2])
+{
+    double x = in[0] / 32767.0;
+    double y = in[1] / 32767.0;
+    double z = 1 - std::fabs(x) - std::fabs(y);
+
+    double t = std::max(-z, 0.0);
+    x += x >= 0 ? -t : t;
+    y += y >= 0 ? -t : t;
+
+    return Direction(x, y, z).unit();
+}
+
+bool Mesh::hit(const Ray &ray, double t_min, HitRecord &rec) const
+{
+    if (nodes.empty())
+    {
+        return false;
+    }
+
+    uint32_t stack[64];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+
+    uint32_t hit_triangle = 0;
+    double hit_u = 0, hit_v = 0;
+    bool hit_anything = false;
+
+    while (stack_size > 0)
+    {
+        uint32_t index = stack[--stack_size];
+        const Node &node = nodes[index];
+
+        if (!node.box.hit(ray, t_min))
+        {
+            continue;
+        }
+
+        if (node.count > 0)
+        {
+            //在叶子里才解码顶点
+            for (uint32_t i = node.first; i < node.first + node.count; ++i)
+            {
+                double t, u, v;
+                if (Triangle::intersect(vertex_position(indices[3 * i]), vertex_position(indices[3 * i + 1]), vertex_position(indices[3 * i + 2]),
+                                        ray, t_min, t, u, v))
+                {
+                    hit_anything = true;
+                    ray.set_t_max(t);
+                    hit_triangle = i;
+                    hit_u = u;
+                    hit_v = v;
+                }
+            }
+        }
+        else
+        {
+            stack[stack_size++] = node.first;
+            stack[stack_size++] = index + 1;
+        }
+    }
+
+    if (!hit_anything)
+    {
+        return false;
+    }
+
+    //插值顶点法线，并和Triangle一样让法线朝向光线来的一侧
+    auto normal = vertex_normal(indices[3 * hit_triangle]) * (1 - hit_u - hit_v)
+                + vertex_normal(indices[3 * hit_triangle + 1]) * hit_u
+                + vertex_normal(indices[3 * hit_triangle + 2]) * hit_v;
+    normal = normal.unit();
+    if (normal.dot(ray.get_direction()) > 0)
+    {
+        normal = -normal;
+    }
+
+    rec.t = ray.get_t_max();
+    Triangle::fill_hit_point(vertex_position(indices[3 * hit_triangle]), vertex_position(indices[3 * hit_triangle + 1]),
+                             vertex_position(indices[3 * hit_triangle + 2]), ray, hit_u, hit_v, rec);
+    rec.normal = normal;
+    rec.material = material;
+    rec.object = this;
+
+    return true;
+}
+
+AABB Mesh::bounding_box() const
+{
+    return box;
+}
+
+size_t Mesh::vertex_bytes() const
+{
+    if (format == VertexFormat::Quantized16)
+    {
+        return quantized.size() * sizeof(QuantizedVertex);
+    }
+    return positions.size() * sizeof(Point) + normals.size() * sizeof(Direction);
+}
+
+size_t Mesh::full_vertex_bytes() const
+{
+    size_t vertex_count = format == VertexFormat::Quantized16 ? quantized.size() : positions.size();
+    return vertex_count * (sizeof(Point) + sizeof(Direction));
+}
+
+size_t Mesh::memory_bytes() const
+{
+    return vertex_bytes() + indices.size() * sizeof(uint32_t) + nodes.size() * sizeof(Node);
+}
+
+std::shared_ptr<Mesh> Mesh::load_obj(const std::string &path, std::shared_ptr<Material> material,
+                                     double scale, const Direction &offset, VertexFormat format)
+{
+    objl::Loader loader;
+    if (!loader.LoadFile(path))
+    {
+        std::cerr << "ERROR: failed to load obj file " << path << std::endl;
+        return nullptr;
+    }
+
+    //obj_loader会为每个面单独复制顶点，这里按位置合并，顶点法线取各个面的平均
+    std::map<std::array<float, 3>, uint32_t> vertex_index;
+    std::vector<Point> positions;
+    std::vector<Direction> normals;
+    std::vector<uint32_t> indices;
+    indices.reserve(loader.LoadedIndices.size());
+
+    for (unsigned int loaded_index : loader.LoadedIndices)
+    {
+        const auto &vertex = loader.LoadedVertices[loaded_index];
+        std::array<float, 3> key = {vertex.Position.X, vertex.Position.Y, vertex.Position.Z};
+
+        auto it = vertex_index.find(key);
+        if (it == vertex_index.end())
+        {
+            it = vertex_index.emplace(key, static_cast<uint32_t>(positions.size())).first;
+            positions.push_back(Point(key[0] * scale, key[1] * scale, key[2] * scale) + offset);
+            normals.push_back(Direction(0, 0, 0));
+        }
+
+        normals[it->second] = normals[it->second] + Direction(vertex.Normal.X, vertex.Normal.Y, vertex.Normal.Z);
+        indices.push_back(it->second);
+    }
+
+    auto mesh = std::make_shared<Mesh>(positions, normals, indices, material, format);
+
+    std::clog << "Loaded " << path << ": " << mesh->triangle_count() << " triangles, " << positions.size() << " vertices\n";
+    std::clog << "  vertex storage " << mesh->vertex_bytes() / 1024.0 << " KB"
+              << " (full precision " << mesh->full_vertex_bytes() / 1024.0 << " KB, saved "
+              << 100.0 * (1.0 - static_cast<double>(mesh->vertex_bytes()) / mesh->full_vertex_bytes()) << "%)"
+              << ", total " << mesh->memory_bytes() / 1024.0 << " KB\n";
+
+    return mesh;
+}
@@ -0,0 +1,46 @@
+#include "moving_instance.hpp"
+
+MovingInstance::MovingInstance(std::shared_ptr<Hittable> object, const Transform &start, const Transform &end)
+    : object(object), start(start), end(end)
+{
+    start_inverse = start.inverse();
+    is_static = start == end;
+}
+
+bool MovingInstance::hit(const Ray &ray, double t_min, HitRecord &rec) const
+{
+    //仿射变换不改变光线参数t，所以物体空间里的t和t_max可以直接用
+    Transform forward = is_static ? start : Transform::lerp(start, end, ray.get_time());
+    Transform inverse = is_static ? start_inverse : forward.inverse();
+
+    Ray local_ray(inverse.apply(ray.get_origin()), inverse.apply(ray.get_direction()), ray.get_t_max());
+    local_ray.set_time(ray.get_time());
+
+    if (!object->hit(local_ray, t_min, rec))
+    {
+        return false;
+    }
+
+    ray.set_t_max(local_ray.get_t_max());
+
+    //交点从物体空间变换回来，误差界也跟着变换，不用ray.at(t)重新计算
+    rec.p = forward.apply(rec.p, rec.p_error, rec.p_error);
+
+    //法线用逆矩阵的转置变换，变换后仍然朝向光线来的一侧
+    rec.normal = inverse.apply_transposed(rec.normal).unit();
+    rec.geometric_normal = inverse.apply_transposed(rec.geometric_normal).unit();
+    rec.object = this;
+
+    return true;
+}
+
+AABB MovingInstance::bounding_box() const
+{
+    return AABB::surrounding_box(bounding_box_at(0), bounding_box_at(1));
+}
+
+AABB MovingInstance::bounding_box_at(double time) const
+{
+    AABB box = object->bounding_box();
+    return AABB::lerp(start.apply(box), end.apply(box), time);
+}
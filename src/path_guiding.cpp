@@ -0,0 +1,341 @@
+#include "path_guiding.hpp"
+#include "sampling.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+//atomic<double>在C++17中没有fetch_add，用比较交换实现
+static void atomic_add(std::atomic<double> &target, double value)
+{
+    double current = target.load(std::memory_order_relaxed);
+    while (!target.compare_exchange_weak(current, current + value, std::memory_order_relaxed))
+    {
+    }
+}
+
+//等面积映射：正方形的x对应cos_theta，y对应phi，所以正方形上的面积乘4pi就是立体角
+static void direction_to_square(const Direction &direction, double &x, double &y)
+{
+    x = std::clamp((direction.z() + 1) / 2, 0.0, 1.0);
+    double phi = std::atan2(direction.y(), direction.x());
+    if (phi < 0)
+    {
+        phi += 2 * M_PI;
+    }
+    y = std::clamp(phi / (2 * M_PI), 0.0, 1.0);
+}
+
+static Direction square_to_direction(double x, double y)
+{
+    double z = 2 * x - 1;
+    double r = std::sqrt(std::max(0.0, 1 - z * z));
+    double phi = 2 * M_PI * y;
+    return Direction(r * std::cos(phi), r * std::sin(phi), z);
+}
+
+//点(x, y)所在的象限，同时把坐标变换到这个象限内的[0, 1)
+static int child_index(double &x, double &y)
+{
+    int qx = x >= 0.5;
+    int qy = y >= 0.5;
+    x = 2 * x - qx;
+    y = 2 * y - qy;
+    return qx + 2 * qy;
+}
+
+DTree::Node::Node()
+{
+    for (auto &sum : sums)
+    {
+        sum.store(0, std::memory_order_relaxed);
+    }
+}
+
+DTree::Node::Node(const Node &other)
+{
+    *this = other;
+}
+
+DTree::Node &DTree::Node::operator=(const Node &other)
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        sums[i].store(other.sums[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        children[i] = other.children[i];
+    }
+    return *this;
+}
+
+double DTree::Node::total() const
+{
+    return sums[0].load(std::memory_order_relaxed) + sums[1].load(std::memory_order_relaxed)
+        + sums[2].load(std::memory_order_relaxed) + sums[3].load(std::memory_order_relaxed);
+}
+
+DTree::DTree() : nodes(1)
+{
+}
+
+DTree::DTree(const DTree &other) : nodes(other.nodes), record_count(other.get_record_count())
+{
+}
+
+DTree &DTree::operator=(const DTree &other)
+{
+    nodes = other.nodes;
+    set_record_count(other.get_record_count());
+    return *this;
+}
+
+double DTree::total() const
+{
+    return nodes[0].total();
+}
+
+const DTree &DTree::empty_tree()
+{
+    static const DTree tree;
+    return tree;
+}
+
+void DTree::record(const Direction &direction, double value)
+{
+    record_count.fetch_add(1, std::memory_order_relaxed);
+    if (!(value > 0) || !std::isfinite(value))
+    {
+        return;
+    }
+
+    double x, y;
+    direction_to_square(direction, x, y);
+    for (uint32_t n = 0; ; )
+    {
+        int c = child_index(x, y);
+        atomic_add(nodes[n].sums[c], value);
+        if (!nodes[n].children[c])
+        {
+            return;
+        }
+        n = nodes[n].children[c];
+    }
+}
+
+//每往下一层，密度乘上这个象限的能量占比再乘4(面积是父节点的四分之一)
+double DTree::pdf(const Direction &direction) const
+{
+    if (!(total() > 0))
+    {
+        return uniform_sphere_pdf();
+    }
+
+    double x, y;
+    direction_to_square(direction, x, y);
+    double density = 1;
+    for (uint32_t n = 0; ; )
+    {
+        int c = child_index(x, y);
+        density *= 4 * nodes[n].sums[c].load(std::memory_order_relaxed) / nodes[n].total();
+        if (density == 0 || !nodes[n].children[c])
+        {
+            break;
+        }
+        n = nodes[n].children[c];
+    }
+    return density * uniform_sphere_pdf();
+}
+
+//先按左右两半的能量选x方向的一半，再在这一半里按上下的能量选y方向，随机数重新缩放到[0, 1)后复用
+Direction DTree::sample(double u1, double u2) const
+{
+    if (!(total() > 0))
+    {
+        return sample_uniform_sphere(u1, u2);
+    }
+
+    double x0 = 0;
+    double y0 = 0;
+    double size = 1;
+    for (uint32_t n = 0; ; )
+    {
+        const Node &node = nodes[n];
+        double sums[4];
+        for (int i = 0; i < 4; ++i)
+        {
+            sums[i] = node.sums[i].load(std::memory_order_relaxed);
+        }
+
+        double left = sums[0] + sums[2];
+        double total = left + sums[1] + sums[3];
+        int qx = u1 * total >= left;
+        u1 = qx ? (u1 * total - left) / (total - left) : u1 * total / left;
+
+        double bottom = sums[qx];
+        double column = bottom + sums[qx + 2];
+        int qy = u2 * column >= bottom;
+        u2 = qy ? (u2 * column - bottom) / (column - bottom) : u2 * column / bottom;
+
+        u1 = std::clamp(u1, 0.0, 1.0);
+        u2 = std::clamp(u2, 0.0, 1.0);
+        size /= 2;
+        x0 += qx * size;
+        y0 += qy * size;
+
+        int c = qx + 2 * qy;
+        if (!node.children[c])
+        {
+            break;
+        }
+        n = node.children[c];
+    }
+    return square_to_direction(x0 + u1 * size, y0 + u2 * size);
+}
+
+//新树里原来是叶子的象限，细分时四个孩子各继承四分之一的能量，用来决定是否继续往下分
+DTree DTree::refined(double threshold, int max_depth) const
+{
+    DTree result;
+    double root_total = total();
+    if (!(root_total > 0))
+    {
+        return result;
+    }
+
+    struct Item
+    {
+        int old_node;
+        double sums[4];
+        uint32_t new_node;
+        int depth;
+    };
+    std::vector<Item> stack;
+    Item root{0, {}, 0, 1};
+    for (int i = 0; i < 4; ++i)
+    {
+        root.sums[i] = nodes[0].sums[i].load(std::memory_order_relaxed);
+    }
+    stack.push_back(root);
+
+    while (!stack.empty())
+    {
+        Item item = stack.back();
+        stack.pop_back();
+
+        for (int c = 0; c < 4; ++c)
+        {
+            if (item.depth >= max_depth || item.sums[c] / root_total <= threshold)
+            {
+                continue;
+            }
+
+            uint32_t child = static_cast<uint32_t>(result.nodes.size());
+            result.nodes.emplace_back();
+            result.nodes[item.new_node].children[c] = child;
+
+            Item next{-1, {}, child, item.depth + 1};
+            if (item.old_node >= 0 && nodes[item.old_node].children[c])
+            {
+                next.old_node = static_cast<int>(nodes[item.old_node].children[c]);
+                for (int i = 0; i < 4; ++i)
+                {
+                    next.sums[i] = nodes[next.old_node].sums[i].load(std::memory_order_relaxed);
+                }
+            }
+            else
+            {
+                std::fill(next.sums, next.sums + 4, item.sums[c] / 4);
+            }
+            stack.push_back(next);
+        }
+    }
+    return result;
+}
+
+//空间树覆盖包围盒的外接立方体，每次分裂后子节点仍然是立方体的一半，三次分裂后回到立方体
+SDTree::SDTree(const AABB &scene_bounds)
+{
+    Direction extent = scene_bounds.maximum - scene_bounds.minimum;
+    double size = std::max(extent.x(), std::max(extent.y(), extent.z())) * 1.001 + 1e-4;
+    Point center = scene_bounds.minimum + extent * 0.5;
+    Direction half(size / 2, size / 2, size / 2);
+    bounds = AABB(center - half, center + half);
+
+    nodes.push_back(Node{0, {0, 0}, 0});
+    dtrees.emplace_back();
+}
+
+int SDTree::leaf(const Point &p) const
+{
+    Direction extent = bounds.maximum - bounds.minimum;
+    double x[3] = {(p.x() - bounds.minimum.x()) / extent.x(), (p.y() - bounds.minimum.y()) / extent.y(),
+                   (p.z() - bounds.minimum.z()) / extent.z()};
+    for (double &value : x)
+    {
+        value = std::clamp(value, 0.0, 1.0);
+    }
+
+    uint32_t n = 0;
+    while (nodes[n].dtree < 0)
+    {
+        double &value = x[nodes[n].axis];
+        int c = value >= 0.5;
+        value = 2 * value - c;
+        n = nodes[n].children[c];
+    }
+    return nodes[n].dtree;
+}
+
+//两个孩子都复制父节点的方向树，记录数各分一半，再各自检查是否需要继续分裂
+void SDTree::split(uint32_t node, uint32_t threshold)
+{
+    int dtree = nodes[node].dtree;
+    uint32_t count = dtrees[dtree].building.get_record_count();
+    if (count <= threshold)
+    {
+        return;
+    }
+
+    int axis = nodes[node].axis;
+    for (int c = 0; c < 2; ++c)
+    {
+        DTreePair pair = dtrees[dtree];
+        pair.building.set_record_count(count / 2);
+
+        int child_dtree = c == 0 ? dtree : static_cast<int>(dtrees.size());
+        if (c == 0)
+        {
+            dtrees[dtree] = pair;
+        }
+        else
+        {
+            dtrees.push_back(pair);
+        }
+
+        nodes[node].children[c] = static_cast<uint32_t>(nodes.size());
+        nodes.push_back(Node{(axis + 1) % 3, {0, 0}, child_dtree});
+    }
+    nodes[node].dtree = -1;
+
+    uint32_t left = nodes[node].children[0];
+    uint32_t right = nodes[node].children[1];
+    split(left, threshold);
+    split(right, threshold);
+}
+
+void SDTree::refine(int iteration)
+{
+    uint32_t threshold = static_cast<uint32_t>(spatial_threshold * std::sqrt(std::pow(2.0, iteration)));
+    size_t node_count = nodes.size();
+    for (size_t n = 0; n < node_count; ++n)
+    {
+        if (nodes[n].dtree >= 0)
+        {
+            split(static_cast<uint32_t>(n), threshold);
+        }
+    }
+
+    for (DTreePair &pair : dtrees)
+    {
+        pair.sampling = pair.building;
+        pair.building = pair.sampling.refined(directional_threshold, max_directional_depth);
+    }
+}
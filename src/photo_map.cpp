@@ -1,4 +1,5 @@
 #include "photo_map.hpp"
+#include "sampling.hpp"
 #include <queue>
 
 // Implementation details
@@ -6,6 +7,7 @@
 void Photomap::build_map(const Hittable& world, const Hittable& light, int num_photons) {
     for (int i = 0; i < num_photons; ++i) {
         Photon photon = sample_photon_from_light(light);
+        sampler.start_pixel_sample(i, 0, 0);
         trace_photon(world, photon);
     }
     build_kd_tree();
@@ -35,7 +37,7 @@ void Photomap::trace_photon(const Hittable& world, Photon& photon) {
     const int MAX_PHOTON_BOUNCES = 10;
     for (int bounces = 0; bounces < MAX_PHOTON_BOUNCES; ++bounces) {
         HitRecord rec;
-        if (world.hit(ray, 0.001, std::numeric_limits<double>::infinity(), rec)) {
+        if (world.hit(ray, 0, rec)) {
             photon.position = rec.p;
             photon.direction = ray.get_direction();
 
@@ -43,7 +45,7 @@ void Photomap::trace_photon(const Hittable& world, Photon& photon) {
 
             ScatterRecord srec;
 
-            rec.material->scatter(ray, rec, srec);
+            rec.material->scatter(ray, rec, srec, sampler);
 
             Color attenuation = srec.attenuation;
 
@@ -60,7 +62,7 @@ void Photomap::trace_photon(const Hittable& world, Photon& photon) {
             auto b = photon.power.b();
 
             Direction new_direction = random_direction_in_hemisphere(rec.normal);
-            ray = Ray(rec.p, new_direction);
+            ray = rec.spawn_ray(new_direction, 0);
         } else {
             break;
         }
@@ -184,20 +186,8 @@ Direction Photomap::random_direction_in_hemisphere(const Direction& normal) cons
     double u1 = distribution(generator); 
     double u2 = distribution(generator);
 
-    double r = sqrt(1.0 - u1 * u1);
-    double phi = 2 * M_PI * u2;
-
-    Direction dir(r * cos(phi), r * sin(phi), u1);
-
-    // Orthonormal basis
-    Direction w = normal;
-    Direction a = (fabs(w.x()) > 0.1) ? Direction(0, 1, 0) : Direction(1, 0, 0);
-    Direction v = w.cross(a).unit();
-    Direction u = v.cross(w);
-
-    // Transform to world coordinates
-    Direction direction = u * dir.x() + v * dir.y() + w * dir.z();
-    return direction.unit();
+    // Uniform hemisphere around the normal
+    return OrthonormalBasis(normal.unit()).to_world(sample_uniform_hemisphere(u1, u2));
 }
 
 double Photomap::rand_double() const {
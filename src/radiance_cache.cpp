@@ -0,0 +1,166 @@
+#include "radiance_cache.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+//splitmix64的混合函数，让相邻格子的键散开到表的各处
+static uint64_t mix_hash(uint64_t key)
+{
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9ull;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebull;
+    key ^= key >> 31;
+    return key;
+}
+
+RadianceCache::RadianceCache(size_t capacity, double cell_size)
+{
+    reset(capacity, cell_size);
+}
+
+void RadianceCache::reset(size_t capacity, double cell_size)
+{
+    size_t size = capacity > 0 ? 1 : 0;
+    while (size < capacity)
+    {
+        size <<= 1;
+    }
+    this->capacity = size;
+    inverse_cell_size = cell_size > 0 ? 1 / cell_size : 20;
+    entries.reset(size > 0 ? new Entry[size] : nullptr);
+    clear();
+}
+
+void RadianceCache::clear()
+{
+    for (size_t i = 0; i < capacity; ++i)
+    {
+        entries[i].key.store(0, std::memory_order_relaxed);
+        for (auto &sum : entries[i].sums)
+        {
+            sum.store(0, std::memory_order_relaxed);
+        }
+        entries[i].count.store(0, std::memory_order_relaxed);
+    }
+}
+
+//每个坐标取19位，相距2^19个格子的位置会共用一个键，在场景的尺度上不会发生
+//法线的编码是绝对值最大的分量所在的轴乘2再加上它的符号，薄板两面的点不会落进同一个格子
+uint64_t RadianceCache::make_key(const Point &p, const Direction &n) const
+{
+    const uint64_t mask = (1ull << 19) - 1;
+    uint64_t x = static_cast<uint64_t>(static_cast<int64_t>(std::floor(p.x() * inverse_cell_size))) & mask;
+    uint64_t y = static_cast<uint64_t>(static_cast<int64_t>(std::floor(p.y() * inverse_cell_size))) & mask;
+    uint64_t z = static_cast<uint64_t>(static_cast<int64_t>(std::floor(p.z() * inverse_cell_size))) & mask;
+
+    double components[3] = {n.x(), n.y(), n.z()};
+    int axis = 0;
+    for (int i = 1; i < 3; ++i)
+    {
+        if (std::fabs(components[i]) > std::fabs(components[axis]))
+        {
+            axis = i;
+        }
+    }
+    uint64_t normal = static_cast<uint64_t>(axis * 2 + (components[axis] < 0));
+
+    return (1ull << 63) | (normal << 57) | (x << 38) | (y << 19) | z;
+}
+
+int64_t RadianceCache::locate(const Point &p, const Direction &n)
+{
+    if (capacity == 0)
+    {
+        return -1;
+    }
+
+    uint64_t key = make_key(p, n);
+    size_t index = static_cast<size_t>(mix_hash(key));
+    for (int probe = 0; probe < max_probes; ++probe)
+    {
+        size_t slot = (index + probe) & (capacity - 1);
+        uint64_t current = entries[slot].key.load(std::memory_order_acquire);
+        if (current == 0)
+        {
+            //另一个线程可能同时占据了这个空位，占据的是同一个键时也可以用
+            entries[slot].key.compare_exchange_strong(current, key, std::memory_order_acq_rel);
+            current = entries[slot].key.load(std::memory_order_acquire);
+        }
+        if (current == key)
+        {
+            return static_cast<int64_t>(slot);
+        }
+    }
+    return -1;
+}
+
+bool RadianceCache::lookup(int64_t cell, int min_samples, Color &radiance) const
+{
+    if (cell < 0)
+    {
+        return false;
+    }
+
+    const Entry &entry = entries[cell];
+    uint32_t count = entry.count.load(std::memory_order_acquire);
+    if (count == 0 || count < static_cast<uint32_t>(std::max(min_samples, 1)))
+    {
+        return false;
+    }
+
+    double scale = 1.0 / (fixed_point_scale * count);
+    radiance = Color(entry.sums[0].load(std::memory_order_relaxed) * scale, entry.sums[1].load(std::memory_order_relaxed) * scale,
+                     entry.sums[2].load(std::memory_order_relaxed) * scale);
+    return true;
+}
+
+//atomic<double>在C++17中没有fetch_add，定点数的整数加法是一条原子指令，多个线程写同一个格子时不需要重试
+//单个样本限制在1e6以内，整数的和不会溢出
+void RadianceCache::insert(int64_t cell, const Color &radiance)
+{
+    double channels[3] = {radiance.r(), radiance.g(), radiance.b()};
+    for (double value : channels)
+    {
+        if (cell < 0 || !std::isfinite(value) || value < 0)
+        {
+            return;
+        }
+    }
+
+    Entry &entry = entries[cell];
+    for (int c = 0; c < 3; ++c)
+    {
+        double value = std::min(channels[c], 1e6) * fixed_point_scale;
+        entry.sums[c].fetch_add(static_cast<uint64_t>(value + 0.5), std::memory_order_relaxed);
+    }
+    entry.count.fetch_add(1, std::memory_order_release);
+}
+
+//经过纯色表面后throughput有的通道是0，这些通道发出的辐亮度无法估计，记成0会让格子偏暗
+//一个顶点发出的辐亮度和路径怎样到达它无关，所以直接跳过这样的顶点不会引入偏差
+void RadianceCache::update(const RadianceCacheVertex *vertices, int count, const Color &path_radiance)
+{
+    for (int k = 0; k < count; ++k)
+    {
+        const RadianceCacheVertex &vertex = vertices[k];
+        const Color &t = vertex.throughput;
+        if (!(t.r() > 0) || !(t.g() > 0) || !(t.b() > 0))
+        {
+            continue;
+        }
+
+        Color outgoing = path_radiance - vertex.radiance;
+        insert(vertex.cell, Color(std::max(0.0, outgoing.r() / t.r()), std::max(0.0, outgoing.g() / t.g()), std::max(0.0, outgoing.b() / t.b())));
+    }
+}
+
+size_t RadianceCache::size() const
+{
+    size_t occupied = 0;
+    for (size_t i = 0; i < capacity; ++i)
+    {
+        occupied += entries[i].key.load(std::memory_order_relaxed) != 0;
+    }
+    return occupied;
+}
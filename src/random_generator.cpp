@@ -1,9 +1,9 @@
 #include "random_generator.hpp"
+#include "sampling.hpp"
 
 double RandomGenerator::get_random_double(double min, double max)
 {
-    std::uniform_real_distribution<> dis(min, max);
-    return dis(gen);
+    return min + (max - min) * distribution(gen);
 }
 
 Point RandomGenerator::sample_point_square(Point center, double side_length, Direction u_direction, Direction v_direction)
@@ -22,45 +22,17 @@ Point RandomGenerator::sample_point_square(Point center, double side_length, Dir
 
 Point RandomGenerator::sample_point_sphere(Point center, double radius)
 {
-    std::uniform_real_distribution<> dis(0, 2 * M_PI);
-    double theta = dis(gen);
-
-    dis = std::uniform_real_distribution<>(0, M_PI);
-    double phi = dis(gen);
-
-    double x = center.x() + radius * sin(phi) * cos(theta);
-    double y = center.y() + radius * sin(phi) * sin(theta);
-    double z = center.z() + radius * cos(phi);
-
-    return Point(x, y, z);
+    return center + sample_direction_sphere() * radius;
 }
 
 Direction RandomGenerator::sample_direction_sphere()
 {
-    std::uniform_real_distribution<> dis(0, 2 * M_PI);
-    double theta = dis(gen);
-
-    dis = std::uniform_real_distribution<>(0, M_PI);
-    double phi = dis(gen);
-
-    double x = sin(phi) * cos(theta);
-    double y = sin(phi) * sin(theta);
-    double z = cos(phi);
-
-    return Direction(x, y, z);
+    double u1 = distribution(gen);
+    double u2 = distribution(gen);
+    return sample_uniform_sphere(u1, u2);
 }
 
 Point RandomGenerator::sample_point_sphere_surface(Point center, double radius)
 {
-    std::uniform_real_distribution<> dis(0, 2 * M_PI);
-    double theta = dis(gen);
-
-    dis = std::uniform_real_distribution<>(0, M_PI);
-    double phi = dis(gen);
-
-    double x = center.x() + radius * sin(phi) * cos(theta);
-    double y = center.y() + radius * sin(phi) * sin(theta);
-    double z = center.z() + radius * cos(phi);
-
-    return Point(x, y, z);
-}
\ No newline at end of file
+    return sample_point_sphere(center, radius);
+}
@@ -1,20 +1,36 @@
 #include "ray.hpp"
 
-Ray::Ray() : origin(Point()), direction(Direction()) {}
+Ray::Ray() : origin(Point()), direction(Direction()), t_max(std::numeric_limits<double>::infinity()), time(0.0)
+{
+    precompute();
+}
 
-Ray::Ray(const Point &origin, const Direction &direction) : origin(origin), direction(direction) {}
+Ray::Ray(const Point &origin, const Direction &direction, double t_max) : origin(origin), direction(direction), t_max(t_max), time(0.0)
+{
+    precompute();
+}
 
-Point Ray::get_origin() const
+//分量为0时倒数是inf，slab测试仍然可以得到正确的结果
+void Ray::precompute()
 {
-    return origin;
+    inv_direction = Direction(1.0 / direction.x(), 1.0 / direction.y(), 1.0 / direction.z());
+
+    sign[0] = inv_direction.x() < 0;
+    sign[1] = inv_direction.y() < 0;
+    sign[2] = inv_direction.z() < 0;
 }
 
-Direction Ray::get_direction() const
+PackedRay::PackedRay(const Ray &ray)
+    : origin{static_cast<float>(ray.get_origin().x()), static_cast<float>(ray.get_origin().y()), static_cast<float>(ray.get_origin().z())},
+      time(static_cast<float>(ray.get_time())),
+      direction{static_cast<float>(ray.get_direction().x()), static_cast<float>(ray.get_direction().y()), static_cast<float>(ray.get_direction().z())},
+      t_max(static_cast<float>(ray.get_t_max()))
 {
-    return direction;
 }
 
-Point Ray::at(double t) const
+Ray PackedRay::unpack() const
 {
-    return origin + direction * t;
-}
\ No newline at end of file
+    Ray ray(Point(origin[0], origin[1], origin[2]), Direction(direction[0], direction[1], direction[2]), t_max);
+    ray.set_time(time);
+    return ray;
+}
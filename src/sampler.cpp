@@ -0,0 +1,540 @@
+#include "sampler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+//小于1的最大double，采样值不能等于1
+static constexpr double one_minus_epsilon = 0x1.fffffffffffffp-1;
+
+static uint64_t mix_bits(uint64_t v)
+{
+    v ^= v >> 31;
+    v *= 0x7fb5d329728ea185ull;
+    v ^= v >> 27;
+    v *= 0x81dadef4bc2dd44dull;
+    v ^= v >> 33;
+    return v;
+}
+
+static double to_unit_double(uint64_t bits)
+{
+    return (bits >> 11) * 0x1p-53;
+}
+
+static double to_unit_double(uint32_t bits)
+{
+    return std::min(bits * 0x1p-32, one_minus_epsilon);
+}
+
+static uint32_t reverse_bits(uint32_t v)
+{
+    v = (v << 16) | (v >> 16);
+    v = ((v & 0x00ff00ff) << 8) | ((v & 0xff00ff00) >> 8);
+    v = ((v & 0x0f0f0f0f) << 4) | ((v & 0xf0f0f0f0) >> 4);
+    v = ((v & 0x33333333) << 2) | ((v & 0xcccccccc) >> 2);
+    v = ((v & 0x55555555) << 1) | ((v & 0xaaaaaaaa) >> 1);
+    return v;
+}
+
+//Kensler的哈希置换：把[0, n)中的i映射到一个由p决定的随机排列中的位置，不需要保存排列
+static int permutation_element(uint32_t i, uint32_t n, uint32_t p)
+{
+    uint32_t w = n - 1;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+    do
+    {
+        i ^= p;
+        i *= 0xe170893d;
+        i ^= p >> 16;
+        i ^= (i & w) >> 4;
+        i ^= p >> 8;
+        i *= 0x0929eb3f;
+        i ^= p >> 23;
+        i ^= (i & w) >> 1;
+        i *= 1 | p >> 27;
+        i *= 0x6935fa69;
+        i ^= (i & w) >> 11;
+        i *= 0x74dcb303;
+        i ^= (i & w) >> 2;
+        i *= 0x9e501cc3;
+        i ^= (i & w) >> 2;
+        i *= 0xc860a3df;
+        i &= w;
+        i ^= i >> 5;
+    } while (i >= n);
+    return static_cast<int>((i + p) % n);
+}
+
+void Sampler::start_pixel_sample(int x, int y, int index)
+{
+    uint64_t pixel = (static_cast<uint64_t>(static_cast<uint32_t>(x)) << 32) | static_cast<uint32_t>(y);
+    pixel_x = x;
+    pixel_y = y;
+    pixel_hash = mix_bits(pixel ^ mix_bits(seed));
+    sample_index = index;
+    dimension = 0;
+}
+
+uint64_t Sampler::dimension_hash() const
+{
+    return mix_bits(pixel_hash ^ (static_cast<uint64_t>(dimension) * 0x9e3779b97f4a7c15ull));
+}
+
+std::unique_ptr<Sampler> Sampler::create(int type, int samples_per_pixel, uint32_t seed)
+{
+    switch (type)
+    {
+        case SamplerType::Independent:
+            return std::make_unique<IndependentSampler>(samples_per_pixel, seed);
+        case SamplerType::Stratified:
+            return std::make_unique<StratifiedSampler>(samples_per_pixel, seed);
+        case SamplerType::Halton:
+            return std::make_unique<HaltonSampler>(samples_per_pixel, seed);
+        case SamplerType::Sobol:
+            return std::make_unique<SobolSampler>(samples_per_pixel, seed);
+        case SamplerType::BlueNoise:
+            return std::make_unique<BlueNoiseSampler>(samples_per_pixel, seed);
+        default:
+            std::cerr << "Unknown sampler type " << type << ", using independent sampler" << std::endl;
+            return std::make_unique<IndependentSampler>(samples_per_pixel, seed);
+    }
+}
+
+double IndependentSampler::get_1d()
+{
+    uint64_t hash = mix_bits(dimension_hash() ^ static_cast<uint64_t>(sample_index));
+    ++dimension;
+    return to_unit_double(hash);
+}
+
+void IndependentSampler::get_2d(double &u1, double &u2)
+{
+    u1 = get_1d();
+    u2 = get_1d();
+}
+
+StratifiedSampler::StratifiedSampler(int samples_per_pixel, uint32_t seed) : Sampler(samples_per_pixel, seed)
+{
+    //不超过平方根的最大因子，网格尽量接近正方形
+    x_strata = static_cast<int>(std::sqrt(static_cast<double>(samples_per_pixel)));
+    while (x_strata > 1 && samples_per_pixel % x_strata != 0)
+    {
+        --x_strata;
+    }
+    x_strata = std::max(x_strata, 1);
+    y_strata = std::max(samples_per_pixel / x_strata, 1);
+}
+
+double StratifiedSampler::get_1d()
+{
+    uint64_t hash = dimension_hash();
+    int stratum = permutation_element(sample_index, samples_per_pixel, static_cast<uint32_t>(hash));
+    double jitter = to_unit_double(mix_bits(hash ^ static_cast<uint64_t>(sample_index)));
+    ++dimension;
+    return std::min((stratum + jitter) / samples_per_pixel, one_minus_epsilon);
+}
+
+void StratifiedSampler::get_2d(double &u1, double &u2)
+{
+    uint64_t hash = dimension_hash();
+    int stratum = permutation_element(sample_index, samples_per_pixel, static_cast<uint32_t>(hash));
+    uint64_t jitter = mix_bits(hash ^ static_cast<uint64_t>(sample_index));
+    dimension += 2;
+
+    int x = stratum % x_strata;
+    int y = stratum / x_strata;
+    u1 = std::min((x + to_unit_double(jitter)) / x_strata, one_minus_epsilon);
+    u2 = std::min((y + to_unit_double(mix_bits(jitter))) / y_strata, one_minus_epsilon);
+}
+
+//前max_halton_dimension个素数，第一次使用时用筛法生成
+static constexpr int max_halton_dimension = 1000;
+
+static const std::vector<int> &halton_primes()
+{
+    static const std::vector<int> primes = [] {
+        std::vector<int> result;
+        std::vector<bool> composite(8000, false);
+        for (int n = 2; n < static_cast<int>(composite.size()) && static_cast<int>(result.size()) < max_halton_dimension; ++n)
+        {
+            if (composite[n])
+            {
+                continue;
+            }
+            result.push_back(n);
+            for (int m = n * n; m < static_cast<int>(composite.size()); m += n)
+            {
+                composite[m] = true;
+            }
+        }
+        return result;
+    }();
+    return primes;
+}
+
+//Owen加扰的逆根函数：第i位数字按由前i位决定的随机排列置换
+//index < base^digits，更低的位都是0，加扰后等价于在最后一层的区间内均匀抖动
+static double owen_scrambled_radical_inverse(int base, uint32_t index, int digits, uint64_t hash)
+{
+    double inverse_base = 1.0 / base;
+    double scale = 1;
+    double result = 0;
+    uint64_t prefix = 0;
+
+    for (int i = 0; i < digits; ++i)
+    {
+        uint32_t next = index / base;
+        uint32_t digit = index - next * base;
+        uint64_t digit_hash = mix_bits(hash ^ (prefix * 0x100000001b3ull + i));
+
+        scale *= inverse_base;
+        result += permutation_element(digit, base, static_cast<uint32_t>(digit_hash)) * scale;
+        prefix = prefix * base + digit;
+        index = next;
+    }
+
+    result += scale * to_unit_double(mix_bits(hash ^ (prefix * 0x100000001b3ull + digits)));
+    return std::min(result, one_minus_epsilon);
+}
+
+double HaltonSampler::get_1d()
+{
+    uint64_t hash = dimension_hash();
+    const std::vector<int> &primes = halton_primes();
+
+    double u;
+    if (dimension < static_cast<int>(primes.size()))
+    {
+        //一个像素的样本序号都小于base^digits
+        int base = primes[dimension];
+        int digits = 1;
+        for (int64_t capacity = base; capacity < samples_per_pixel; capacity *= base)
+        {
+            ++digits;
+        }
+        u = owen_scrambled_radical_inverse(base, static_cast<uint32_t>(sample_index), digits, hash);
+    }
+    else
+    {
+        u = to_unit_double(mix_bits(hash ^ static_cast<uint64_t>(sample_index)));
+    }
+
+    ++dimension;
+    return u;
+}
+
+void HaltonSampler::get_2d(double &u1, double &u2)
+{
+    u1 = get_1d();
+    u2 = get_1d();
+}
+
+//Laine-Karras风格的哈希，等价于一次Owen加扰(嵌套的随机二进制位翻转)
+//输入和输出都是位反转后的值，每一位只受更低的位影响，也就是只受更高位的小数位影响
+static uint32_t laine_karras_permutation(uint32_t v, uint32_t seed)
+{
+    v ^= v * 0x3d20adea;
+    v += seed;
+    v *= (seed >> 16) | 1;
+    v ^= v * 0x05526c56;
+    v ^= v * 0x53a22864;
+    return v;
+}
+
+static uint32_t owen_scramble(uint32_t v, uint32_t seed)
+{
+    return reverse_bits(laine_karras_permutation(reverse_bits(v), seed));
+}
+
+//Sobol序列的第一维是以2为底的van der Corput序列，也就是index的位反转
+//在位反转的空间里加扰，省掉两次反转
+static uint32_t sobol_dimension0_scrambled(uint32_t index, uint32_t seed)
+{
+    return reverse_bits(laine_karras_permutation(index, seed));
+}
+
+//Sobol序列的第二维，本原多项式x + 1，方向数v_k = v_{k-1} ^ (v_{k-1} >> 1)
+static uint32_t sobol_dimension1(uint32_t index)
+{
+    uint32_t result = 0;
+    for (uint32_t v = 1u << 31; index; index >>= 1, v ^= v >> 1)
+    {
+        //不用分支，index的各位是随机的，分支预测不准
+        result ^= v & (0u - (index & 1));
+    }
+    return result;
+}
+
+//打乱一个像素内样本的顺序，让不同的维度对之间互不相关
+//样本数是2的幂时用Burley的做法，对序号本身做Owen加扰：序号的每一位只受更高位影响，
+//所以低位是[0, n)的一个随机排列，而决定采样值高位的序号低位被充分打乱
+//比通用的permutation_element便宜得多
+static uint32_t shuffle_index(uint32_t index, uint32_t n, uint32_t seed)
+{
+    if ((n & (n - 1)) == 0)
+    {
+        return owen_scramble(index, seed) & (n - 1);
+    }
+    return permutation_element(index, n, seed);
+}
+
+double SobolSampler::get_1d()
+{
+    uint64_t hash = dimension_hash();
+    uint32_t index = shuffle_index(sample_index, samples_per_pixel, static_cast<uint32_t>(hash));
+    ++dimension;
+    return to_unit_double(sobol_dimension0_scrambled(index, static_cast<uint32_t>(hash >> 32)));
+}
+
+void SobolSampler::get_2d(double &u1, double &u2)
+{
+    uint64_t hash = dimension_hash();
+    uint32_t index = shuffle_index(sample_index, samples_per_pixel, static_cast<uint32_t>(hash));
+    uint64_t scramble = mix_bits(hash);
+    dimension += 2;
+
+    u1 = to_unit_double(sobol_dimension0_scrambled(index, static_cast<uint32_t>(scramble)));
+    u2 = to_unit_double(owen_scramble(sobol_dimension1(index), static_cast<uint32_t>(scramble >> 32)));
+}
+
+//蓝噪声掩码的边长，必须是2的幂
+static constexpr int blue_noise_size = 64;
+
+//用Ulichney的void-and-cluster方法生成蓝噪声掩码，第一次使用时生成，返回每个位置的名次
+//能量是到已选点的环面高斯距离之和，每次在能量最低(最空)的位置放下一个点，
+//所以任意前k个点都均匀地分布在整个平面上
+static const std::vector<uint16_t> &blue_noise_mask()
+{
+    static const std::vector<uint16_t> mask = [] {
+        const int size = blue_noise_size;
+        const int count = size * size;
+        const double sigma = 1.5;
+
+        //环面上的高斯核，按坐标差查表
+        std::vector<double> kernel(count);
+        for (int dy = 0; dy < size; ++dy)
+        {
+            for (int dx = 0; dx < size; ++dx)
+            {
+                int x = std::min(dx, size - dx);
+                int y = std::min(dy, size - dy);
+                kernel[dy * size + dx] = std::exp(-(x * x + y * y) / (2 * sigma * sigma));
+            }
+        }
+
+        std::vector<char> filled(count, 0);
+        std::vector<double> energy(count, 0);
+        auto update = [&](int index, double sign) {
+            int x0 = index % size;
+            int y0 = index / size;
+            for (int y = 0; y < size; ++y)
+            {
+                const double *row = &kernel[((y - y0) & (size - 1)) * size];
+                for (int x = 0; x < size; ++x)
+                {
+                    energy[y * size + x] += sign * row[(x - x0) & (size - 1)];
+                }
+            }
+        };
+        auto tightest_cluster = [&] {
+            int best = -1;
+            for (int i = 0; i < count; ++i)
+            {
+                if (filled[i] && (best < 0 || energy[i] > energy[best]))
+                {
+                    best = i;
+                }
+            }
+            return best;
+        };
+        auto largest_void = [&] {
+            int best = -1;
+            for (int i = 0; i < count; ++i)
+            {
+                if (!filled[i] && (best < 0 || energy[i] < energy[best]))
+                {
+                    best = i;
+                }
+            }
+            return best;
+        };
+
+        //初始的随机点集，反复把最密处的点移到最空处，直到稳定
+        int initial = count / 10;
+        for (uint64_t i = 0, placed = 0; placed < static_cast<uint64_t>(initial); ++i)
+        {
+            int index = static_cast<int>(mix_bits(i) % count);
+            if (!filled[index])
+            {
+                filled[index] = 1;
+                update(index, 1);
+                ++placed;
+            }
+        }
+        for (int iteration = 0; iteration < count; ++iteration)
+        {
+            int cluster = tightest_cluster();
+            filled[cluster] = 0;
+            update(cluster, -1);
+            int hole = largest_void();
+            if (hole == cluster)
+            {
+                filled[cluster] = 1;
+                update(cluster, 1);
+                break;
+            }
+            filled[hole] = 1;
+            update(hole, 1);
+        }
+
+        std::vector<uint16_t> rank(count);
+
+        //初始点集按从密到疏的顺序拿掉，名次从高到低
+        std::vector<char> prototype = filled;
+        std::vector<double> prototype_energy = energy;
+        for (int r = initial - 1; r >= 0; --r)
+        {
+            int cluster = tightest_cluster();
+            filled[cluster] = 0;
+            update(cluster, -1);
+            rank[cluster] = static_cast<uint16_t>(r);
+        }
+
+        //其余的位置依次填入最空处
+        filled = prototype;
+        energy = prototype_energy;
+        for (int r = initial; r < count; ++r)
+        {
+            int hole = largest_void();
+            filled[hole] = 1;
+            update(hole, 1);
+            rank[hole] = static_cast<uint16_t>(r);
+        }
+        return rank;
+    }();
+    return mask;
+}
+
+double BlueNoiseSampler::mask_offset(uint64_t hash) const
+{
+    const std::vector<uint16_t> &mask = blue_noise_mask();
+    int x = (pixel_x + static_cast<int>(hash)) & (blue_noise_size - 1);
+    int y = (pixel_y + static_cast<int>(hash >> 16)) & (blue_noise_size - 1);
+    return (mask[y * blue_noise_size + x] + 0.5) / (blue_noise_size * blue_noise_size);
+}
+
+//点集和掩码的平移量都不能依赖像素，否则像素之间的偏移不再是蓝噪声
+double BlueNoiseSampler::get_1d()
+{
+    uint64_t hash = mix_bits(mix_bits(seed) ^ (static_cast<uint64_t>(dimension) * 0x9e3779b97f4a7c15ull));
+    uint32_t index = shuffle_index(sample_index, samples_per_pixel, static_cast<uint32_t>(hash));
+    double u = to_unit_double(sobol_dimension0_scrambled(index, static_cast<uint32_t>(hash >> 32)));
+    u += mask_offset(mix_bits(hash));
+    ++dimension;
+    return u < 1 ? u : std::min(u - 1, one_minus_epsilon);
+}
+
+//两维各用掩码的一个不同平移，单看每一维都是蓝噪声
+void BlueNoiseSampler::get_2d(double &u1, double &u2)
+{
+    uint64_t hash = mix_bits(mix_bits(seed) ^ (static_cast<uint64_t>(dimension) * 0x9e3779b97f4a7c15ull));
+    uint32_t index = shuffle_index(sample_index, samples_per_pixel, static_cast<uint32_t>(hash));
+    uint64_t scramble = mix_bits(hash);
+    dimension += 2;
+
+    u1 = to_unit_double(sobol_dimension0_scrambled(index, static_cast<uint32_t>(scramble))) + mask_offset(mix_bits(scramble));
+    u2 = to_unit_double(owen_scramble(sobol_dimension1(index), static_cast<uint32_t>(scramble >> 32))) + mask_offset(mix_bits(scramble ^ hash));
+    u1 = u1 < 1 ? u1 : std::min(u1 - 1, one_minus_epsilon);
+    u2 = u2 < 1 ? u2 : std::min(u2 - 1, one_minus_epsilon);
+}
+
+MLTSampler::MLTSampler(uint64_t seed, double sigma, double large_step_probability)
+    : Sampler(1, static_cast<uint32_t>(seed)), rng_state(mix_bits(seed)), sigma(sigma), large_step_probability(large_step_probability) {}
+
+//splitmix64，状态每次加一个常数再混合
+double MLTSampler::uniform()
+{
+    rng_state += 0x9e3779b97f4a7c15ull;
+    return to_unit_double(mix_bits(rng_state));
+}
+
+void MLTSampler::ensure_ready(int index)
+{
+    if (index >= static_cast<int>(samples.size()))
+    {
+        samples.resize(index + 1);
+    }
+    PrimarySample &sample = samples[index];
+
+    //上一次大步之后没有用到过，先补上那次大步
+    if (sample.last_modification < last_large_step_iteration)
+    {
+        sample.value = uniform();
+        sample.last_modification = last_large_step_iteration;
+    }
+
+    sample.value_backup = sample.value;
+    sample.modification_backup = sample.last_modification;
+    if (large_step)
+    {
+        sample.value = uniform();
+    }
+    else
+    {
+        //n次独立的正态扰动之和是标准差为sigma * sqrt(n)的一次扰动，正态分布用Box-Muller变换
+        int64_t skipped = current_iteration - sample.last_modification;
+        double u1 = uniform();
+        double u2 = uniform();
+        double normal = std::sqrt(-2 * std::log(1 - u1)) * std::cos(2 * M_PI * u2);
+        sample.value += normal * sigma * std::sqrt(static_cast<double>(skipped));
+        sample.value -= std::floor(sample.value);
+        sample.value = std::min(sample.value, one_minus_epsilon);
+    }
+    sample.last_modification = current_iteration;
+}
+
+double MLTSampler::get_1d()
+{
+    ensure_ready(dimension);
+    return samples[dimension++].value;
+}
+
+void MLTSampler::get_2d(double &u1, double &u2)
+{
+    u1 = get_1d();
+    u2 = get_1d();
+}
+
+void MLTSampler::start_iteration()
+{
+    ++current_iteration;
+    large_step = uniform() < large_step_probability;
+    dimension = 0;
+}
+
+void MLTSampler::accept()
+{
+    if (large_step)
+    {
+        last_large_step_iteration = current_iteration;
+    }
+}
+
+void MLTSampler::reject()
+{
+    for (PrimarySample &sample : samples)
+    {
+        if (sample.last_modification == current_iteration)
+        {
+            sample.value = sample.value_backup;
+            sample.last_modification = sample.modification_backup;
+        }
+    }
+    --current_iteration;
+}
@@ -1,68 +1,212 @@
 #include "sphere.hpp"
 #include "basic_types.hpp"
 #include "hittable.hpp"
-#include "random_generator.hpp"
+#include "sampler.hpp"
+#include "sampling.hpp"
+
+#include <algorithm>
+#include <cmath>
 
 Sphere::Sphere(const Point &center, double radius, std::shared_ptr<Material> material) : center(center), radius(radius), material(material) {}
 
-bool Sphere::hit(const Ray &ray, double t_min, double t_max, HitRecord &rec) const
+//只求交点的t，不填写HitRecord，MovingSphere也使用它
+//按数值稳定的形式求两个根，并估计每个根的舍入误差，和三角形一样把落在误差范围内的根视为自交丢弃
+//c = |oc|^2 - r^2在光线起点靠近球面时相消得很厉害，误差主要来自这里
+bool Sphere::intersect(const Point &center, double radius, const Ray &ray, double t_min, double &t)
 {
-    auto oc = ray.get_origin() - center;
+    double t_max = ray.get_t_max();
+
+    const Direction &d = ray.get_direction();
+    Direction oc = ray.get_origin() - center;
 
-    auto a = ray.get_direction().length_squared();
-    auto h = (oc.dot(ray.get_direction()));
-    auto c = oc.length_squared() - radius * radius;
+    double a = d.length_squared();
+    double h = oc.dot(d);
+    double oc_squared = oc.length_squared();
+    double c = oc_squared - radius * radius;
 
-    auto discriminant = h * h - a * c;
+    //a、h、c的误差界，oc的三个分量各带一次舍入
+    double delta_a = error_gamma(3) * a;
+    double delta_h = error_gamma(4) * Direction(oc.get_vector().abs()).dot(Direction(d.get_vector().abs()));
+    double delta_c = error_gamma(6) * (oc_squared + radius * radius);
+
+    double discriminant = h * h - a * c;
+    double delta_discriminant = 2 * std::abs(h) * delta_h + delta_h * delta_h + a * delta_c + std::abs(c) * delta_a + delta_a * delta_c
+                              + error_gamma(2) * (h * h + a * std::abs(c));
 
     if (discriminant < 0)
     {
         return false;
     }
 
-    auto sqrtd = std::sqrt(discriminant);
-    auto root = (-h - sqrtd) / a;
+    //sqrt(discriminant)的误差，discriminant - delta_discriminant可能小于0，这时只能用sqrt(delta_discriminant)
+    double sqrtd = std::sqrt(discriminant);
+    double lower = std::sqrt(std::max(0.0, discriminant - delta_discriminant));
+    double delta_sqrtd = (sqrtd + lower > 0 ? delta_discriminant / (sqrtd + lower) : std::sqrt(delta_discriminant)) + error_gamma(1) * sqrtd;
+
+    //q = -(h + sign(h) * sqrt(discriminant))不会相消，两个根是q / a和c / q
+    double q = -(h + std::copysign(sqrtd, h));
+    if (q == 0)
+    {
+        return false;
+    }
+    double delta_q = delta_h + delta_sqrtd + error_gamma(1) * std::abs(q);
+
+    double t0 = q / a;
+    double t1 = c / q;
+    double delta_t0 = (delta_q + std::abs(t0) * delta_a) / a + error_gamma(1) * std::abs(t0);
+    double delta_t1 = (delta_c + std::abs(t1) * delta_q) / std::abs(q) + error_gamma(1) * std::abs(t1);
+    if (t0 > t1)
+    {
+        std::swap(t0, t1);
+        std::swap(delta_t0, delta_t1);
+    }
 
-    if (root < t_min || t_max < root)
+    //根的下界不大于0时可能是起点所在的球面本身
+    if (t0 <= delta_t0 || t0 < t_min || t0 > t_max)
     {
-        root = (-h + sqrtd) / a;
-        if (root < t_min || t_max < root)
+        t0 = t1;
+        if (t1 <= delta_t1 || t1 < t_min || t1 > t_max)
         {
             return false;
         }
     }
 
-    rec.t = root;
-    rec.p = ray.at(rec.t);
-    Direction outward_normal = (rec.p - center) / radius;
-    outward_normal = outward_normal.unit();
-    rec.normal = outward_normal;
+    t = t0;
+    return true;
+}
+
+bool Sphere::hit(const Ray &ray, double t_min, HitRecord &rec) const
+{
+    double t;
+
+    if (!intersect(center, radius, ray, t_min, t))
+    {
+        return false;
+    }
+
+    ray.set_t_max(t);
+    rec.t = t;
+    fill_hit_point(center, radius, ray, rec);
     rec.material = material;
+    rec.object = this;
 
     return true;
 }
 
+//把ray.at(t)重新投影到球面上，投影后的误差只和坐标的大小有关，和t的误差无关
+void Sphere::fill_hit_point(const Point &center, double radius, const Ray &ray, HitRecord &rec)
+{
+    Direction local = ray.at(rec.t) - center;
+    local = local * (radius / local.length());
+
+    rec.p = center + local;
+    rec.p_error = Direction(local.get_vector().abs() * error_gamma(5) + (center.get_vector().abs() + local.get_vector().abs()) * error_gamma(1));
+
+    Direction outward_normal = (local / radius).unit();
+    rec.normal = outward_normal;
+    rec.geometric_normal = outward_normal;
+}
+
 AABB Sphere::bounding_box() const
 {
     return AABB(center - Direction(radius, radius, radius), center + Direction(radius, radius, radius));
 }
 
+//从o看球所张的圆锥，返回1 - cos_theta_max，o在球内时返回2(整个球面)
+//圆锥很小时cos_theta_max非常接近1，先算cos再减会损失精度，所以用sin^2 / (1 + cos)
+static double sphere_cone(const Point &center, double radius, const Point &o)
+{
+    double distance_squared = (center - o).length_squared();
+    double sin2_theta_max = radius * radius / distance_squared;
+
+    if (sin2_theta_max >= 1)
+    {
+        return 2;
+    }
+
+    return sin2_theta_max / (1 + std::sqrt(1 - sin2_theta_max));
+}
+
+//在圆锥内均匀采样，方向是否击中球只需要和圆锥比较夹角，不用求交
+//夹角也用1 - cos比较，单位向量之差的长度平方的一半就是1 - cos，小角度时没有相消
 double Sphere::pdf_value(const Point &o, const Direction &v) const
 {
-    HitRecord rec;
+    double one_minus_cos_max = sphere_cone(center, radius, o);
 
-    if (!this->hit(Ray(o, v), 0.001, std::numeric_limits<double>::infinity(), rec))
+    if (one_minus_cos_max < 2)
     {
-        return 0;
+        double one_minus_cos = 0.5 * (v.unit() - (center - o).unit()).length_squared();
+        if (one_minus_cos > one_minus_cos_max)
+        {
+            return 0;
+        }
     }
 
-    auto cos_theta_max = std::sqrt(1 - radius * radius / (center - o).length_squared());
-    auto solid_angle = 2 * M_PI * (1 - cos_theta_max);
+    return uniform_cone_pdf(one_minus_cos_max);
+}
+
+Direction Sphere::sample_direction(const Point &o, Sampler &sampler, double &pdf) const
+{
+    double one_minus_cos_max = sphere_cone(center, radius, o);
+    pdf = uniform_cone_pdf(one_minus_cos_max);
+
+    //o在球内时圆锥就是整个球面
+    double u1, u2;
+    sampler.get_2d(u1, u2);
+    Direction w = (center - o).length_squared() > 0 ? (center - o).unit() : Direction(0, 0, 1);
+
+    return OrthonormalBasis(w).to_world(sample_uniform_cone(u1, u2, one_minus_cos_max));
+}
+
+Point Sphere::random(Sampler &sampler) const
+{
+    double u1, u2;
+    sampler.get_2d(u1, u2);
+    return center + sample_uniform_sphere(u1, u2) * radius;
+}
+
+Point Sphere::sample_area(Sampler &sampler, Direction &normal) const
+{
+    double u1, u2;
+    sampler.get_2d(u1, u2);
+    normal = sample_uniform_sphere(u1, u2);
+    return center + normal * radius;
+}
+
+MovingSphere::MovingSphere(const Point &center0, const Point &center1, double radius, std::shared_ptr<Material> material)
+    : center0(center0), center1(center1), radius(radius), material(material) {}
 
-    return 1 / solid_angle;
+Point MovingSphere::center(double time) const
+{
+    return center0 + (center1 - center0) * time;
+}
+
+bool MovingSphere::hit(const Ray &ray, double t_min, HitRecord &rec) const
+{
+    double t;
+    Point current_center = center(ray.get_time());
+
+    if (!Sphere::intersect(current_center, radius, ray, t_min, t))
+    {
+        return false;
+    }
+
+    ray.set_t_max(t);
+    rec.t = t;
+    Sphere::fill_hit_point(current_center, radius, ray, rec);
+    rec.material = material;
+    rec.object = this;
+
+    return true;
+}
+
+AABB MovingSphere::bounding_box() const
+{
+    return AABB::surrounding_box(bounding_box_at(0), bounding_box_at(1));
 }
 
-Point Sphere::random(RandomGenerator &random_generator) const
+AABB MovingSphere::bounding_box_at(double time) const
 {
-    return random_generator.sample_point_sphere(center, radius);
+    Point c = center(time);
+    return AABB(c - Direction(radius, radius, radius), c + Direction(radius, radius, radius));
 }
\ No newline at end of file
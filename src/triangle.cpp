@@ -1,57 +1,136 @@
 #include "triangle.hpp"
+#include "sampler.hpp"
+
+#include <algorithm>
+#include <cmath>
 
 Triangle::Triangle(const Point &v0, const Point &v1, const Point &v2, std::shared_ptr<Material> material) : v0(v0), v1(v1), v2(v2), material(material) {}
 
-bool Triangle::hit(const Ray &ray, double t_min, double t_max, HitRecord &rec) const
+//水密求交：把光线变换到+z方向后在xy平面上算边函数，共享边上的交点不会漏掉
+//t的舍入误差按PBRT的方法保守估计，t落在误差范围内的交点视为自交丢弃
+//u, v是交点相对v1, v2的重心坐标
+bool Triangle::intersect(const Point &v0, const Point &v1, const Point &v2, const Ray &ray, double t_min, double &t, double &u, double &v)
 {
-    auto edge1 = v1 - v0;
-    auto edge2 = v2 - v0;
-    auto h = ray.get_direction().cross(edge2);
-    auto a = edge1.dot(h);
+    const Direction &d = ray.get_direction();
+    double t_max = ray.get_t_max();
 
-    if (a > -0.00001 && a < 0.00001)
+    //选|d|最大的轴作为z轴
+    int kz = 0;
+    if (std::abs(d.y()) > std::abs(d[kz]))
     {
-        return false;
+        kz = 1;
+    }
+    if (std::abs(d.z()) > std::abs(d[kz]))
+    {
+        kz = 2;
     }
+    int kx = (kz + 1) % 3;
+    int ky = (kx + 1) % 3;
 
-    auto f = 1.0 / a;
-    auto s = ray.get_origin() - v0;
-    auto u = f * s.dot(h);
+    double dx = d[kx], dy = d[ky], dz = d[kz];
+    double sx = -dx / dz, sy = -dy / dz, sz = 1.0 / dz;
 
-    if (u < 0.0 || u > 1.0)
+    //平移到光线原点，置换坐标轴后剪切，使光线沿+z
+    Direction p0t = v0 - ray.get_origin();
+    Direction p1t = v1 - ray.get_origin();
+    Direction p2t = v2 - ray.get_origin();
+
+    double p0x = p0t[kx] + sx * p0t[kz], p0y = p0t[ky] + sy * p0t[kz], p0z = p0t[kz];
+    double p1x = p1t[kx] + sx * p1t[kz], p1y = p1t[ky] + sy * p1t[kz], p1z = p1t[kz];
+    double p2x = p2t[kx] + sx * p2t[kz], p2y = p2t[ky] + sy * p2t[kz], p2z = p2t[kz];
+
+    double e0 = p1x * p2y - p1y * p2x;
+    double e1 = p2x * p0y - p2y * p0x;
+    double e2 = p0x * p1y - p0y * p1x;
+
+    if ((e0 < 0 || e1 < 0 || e2 < 0) && (e0 > 0 || e1 > 0 || e2 > 0))
     {
         return false;
     }
 
-    auto q = s.cross(edge1);
-    auto v = f * ray.get_direction().dot(q);
+    double det = e0 + e1 + e2;
+    if (det == 0)
+    {
+        return false;
+    }
+
+    p0z *= sz;
+    p1z *= sz;
+    p2z *= sz;
+    double t_scaled = e0 * p0z + e1 * p1z + e2 * p2z;
 
-    if (v < 0.0 || u + v > 1.0)
+    //t_scaled与det同号且不超过t_max * det，避免在这里做除法
+    if (det < 0 && (t_scaled >= 0 || t_scaled < t_max * det))
+    {
+        return false;
+    }
+    if (det > 0 && (t_scaled <= 0 || t_scaled > t_max * det))
     {
         return false;
     }
 
-    auto t = f * edge2.dot(q);
+    double inv_det = 1.0 / det;
+    t = t_scaled * inv_det;
 
-    if (t < t_min || t > t_max)
+    //t的误差界
+    double max_zt = std::max({std::abs(p0z), std::abs(p1z), std::abs(p2z)});
+    double max_xt = std::max({std::abs(p0x), std::abs(p1x), std::abs(p2x)});
+    double max_yt = std::max({std::abs(p0y), std::abs(p1y), std::abs(p2y)});
+    double max_e = std::max({std::abs(e0), std::abs(e1), std::abs(e2)});
+
+    double delta_z = error_gamma(3) * max_zt;
+    double delta_x = error_gamma(5) * (max_xt + max_zt);
+    double delta_y = error_gamma(5) * (max_yt + max_zt);
+    double delta_e = 2 * (error_gamma(2) * max_xt * max_yt + delta_y * max_xt + delta_x * max_yt);
+    double delta_t = 3 * (error_gamma(3) * max_e * max_zt + delta_e * max_zt + delta_z * max_e) * std::abs(inv_det);
+
+    if (t <= delta_t || t < t_min)
     {
         return false;
     }
 
-    auto normal = edge1.cross(edge2).unit();
-    if (normal.dot(ray.get_direction()) > 0)
+    u = e1 * inv_det;
+    v = e2 * inv_det;
+
+    return true;
+}
+
+bool Triangle::hit(const Ray &ray, double t_min, HitRecord &rec) const
+{
+    double t, u, v;
+
+    if (!intersect(v0, v1, v2, ray, t_min, t, u, v))
     {
-        normal = Direction(0, 0, 0) - normal;
+        return false;
     }
 
+    ray.set_t_max(t);
     rec.t = t;
-    rec.p = ray.at(rec.t);
-    rec.normal = normal;
+    fill_hit_point(v0, v1, v2, ray, u, v, rec);
+    rec.normal = rec.geometric_normal;
     rec.material = material;
+    rec.object = this;
 
     return true;
 }
 
+void Triangle::fill_hit_point(const Point &v0, const Point &v1, const Point &v2, const Ray &ray, double u, double v, HitRecord &rec)
+{
+    Vector3d b0 = v0.get_vector() * (1 - u - v);
+    Vector3d b1 = v1.get_vector() * u;
+    Vector3d b2 = v2.get_vector() * v;
+
+    rec.p = Point(b0 + b1 + b2);
+    rec.p_error = Direction((b0.abs() + b1.abs() + b2.abs()) * error_gamma(7));
+
+    auto normal = (v1 - v0).cross(v2 - v0).unit();
+    if (normal.dot(ray.get_direction()) > 0)
+    {
+        normal = -normal;
+    }
+    rec.geometric_normal = normal;
+}
+
 AABB Triangle::bounding_box() const
 {
     auto min_x = std::min(v0.x(), std::min(v1.x(), v2.x()));
@@ -65,26 +144,150 @@ AABB Triangle::bounding_box() const
     return AABB(Point(min_x, min_y, min_z), Point(max_x, max_y, max_z));
 }
 
+//立体角很小时三角形上各点的距离和夹角几乎相同，面积采样的pdf已经接近常数，
+//而球面三角形采样又慢、数值误差又大；立体角接近整个半球时球面三角形采样也不稳定
+//这两种情况都改为在面积上采样
+static constexpr double min_spherical_sample_area = 1e-2;
+static constexpr double max_spherical_sample_area = 6.22;
+
+//单位向量a, b, c围成的球面三角形的面积，也就是从原点看三角形的立体角
+static double spherical_triangle_area(const Direction &a, const Direction &b, const Direction &c)
+{
+    return std::fabs(2 * std::atan2(a.dot(b.cross(c)), 1 + a.dot(b) + a.dot(c) + b.dot(c)));
+}
+
+double Triangle::solid_angle(const Point &o) const
+{
+    return spherical_triangle_area((v0 - o).unit(), (v1 - o).unit(), (v2 - o).unit());
+}
+
+//用area * cos / distance^2粗略估计立体角，决定用哪种采样方式
+//只和o有关，所以sample_direction和pdf_value总是做出同样的选择
+bool Triangle::use_spherical_sampling(const Point &o) const
+{
+    auto cross = (v1 - v0).cross(v2 - v0);
+    Direction to_centroid = Point((v0.get_vector() + v1.get_vector() + v2.get_vector()) / 3) - o;
+    double distance_squared = to_centroid.length_squared();
+    double estimate = 0.5 * std::fabs(cross.dot(to_centroid)) / (distance_squared * std::sqrt(distance_squared));
+
+    return estimate >= min_spherical_sample_area && estimate <= max_spherical_sample_area;
+}
+
+//在面积上均匀采样时，方向v在立体角上的pdf
+//光线和三角形所在平面交于t，pdf = distance^2 / (cos * area)
+double Triangle::area_pdf(const Point &o, const Direction &v) const
+{
+    auto cross = (v1 - v0).cross(v2 - v0);
+    double n_dot_v = cross.dot(v);
+    if (n_dot_v == 0)
+    {
+        return 0;
+    }
+
+    double t = cross.dot(v0 - o) / n_dot_v;
+    double v_length = v.length();
+
+    //area = |cross| / 2，cos = |n_dot_v| / (|cross| * |v|)
+    return 2 * t * t * v_length * v_length * v_length / std::fabs(n_dot_v);
+}
+
+//v穿过三角形时，v与三个顶点两两张成的三重积都和a·(b×c)同号，不需要求交
 double Triangle::pdf_value(const Point &o, const Direction &v) const
 {
-    HitRecord rec;
-    if (!this->hit(Ray(o, v), 0.001, std::numeric_limits<double>::infinity(), rec))
+    auto a = v0 - o;
+    auto b = v1 - o;
+    auto c = v2 - o;
+
+    double volume = a.dot(b.cross(c));
+    if (volume == 0)
     {
         return 0;
     }
 
-    auto edge1 = v1 - v0;
-    auto edge2 = v2 - v0;
+    if (v.dot(a.cross(b)) * volume < 0 || v.dot(b.cross(c)) * volume < 0 || v.dot(c.cross(a)) * volume < 0)
+    {
+        return 0;
+    }
+
+    if (!use_spherical_sampling(o))
+    {
+        return area_pdf(o, v);
+    }
+
+    return 1 / solid_angle(o);
+}
+
+//Arvo的球面三角形采样，先按面积选一个子三角形确定顶点c'，再在弧b-c'上采样
+Direction Triangle::sample_direction(const Point &o, Sampler &sampler, double &pdf) const
+{
+    if (!use_spherical_sampling(o))
+    {
+        Direction direction = random(sampler) - o;
+        pdf = area_pdf(o, direction);
+        return direction;
+    }
+
+    //退化时也要取出这两维，用掉的维度数和正常采样一样
+    double u1, u2;
+    sampler.get_2d(u1, u2);
+
+    auto a = (v0 - o).unit();
+    auto b = (v1 - o).unit();
+    auto c = (v2 - o).unit();
+    double omega = spherical_triangle_area(a, b, c);
+
+    auto n_ab = a.cross(b);
+    auto n_ca = c.cross(a);
+    if (n_ab.length_squared() == 0 || n_ca.length_squared() == 0)
+    {
+        pdf = 0;
+        return a;
+    }
+
+    //顶点a处的内角alpha，三个内角之和是omega + pi，所以不需要另外两个角
+    double cos_alpha = std::clamp(-n_ab.unit().dot(n_ca.unit()), -1.0, 1.0);
+    double sin_alpha = std::sqrt(std::max(0.0, 1 - cos_alpha * cos_alpha));
 
-    double area = 0.5 * edge1.cross(edge2).length();
+    //子三角形a, b, c'的面积是u1 * omega，内角和是pi + u1 * omega
+    double sub_area = u1 * omega;
+    double sin_area = -std::sin(sub_area);
+    double cos_area = -std::cos(sub_area);
 
-    return 1.0 / area;
+    double sin_phi = sin_area * cos_alpha - cos_area * sin_alpha;
+    double cos_phi = cos_area * cos_alpha + sin_area * sin_alpha;
+    double k1 = cos_phi + cos_alpha;
+    double k2 = sin_phi - sin_alpha * a.dot(b);
+    double cos_b = (k2 + (k2 * cos_phi - k1 * sin_phi) * cos_alpha) / ((k2 * sin_phi + k1 * cos_phi) * sin_alpha);
+    cos_b = std::clamp(cos_b, -1.0, 1.0);
+    double sin_b = std::sqrt(std::max(0.0, 1 - cos_b * cos_b));
+
+    //c'在弧a-c上
+    auto c_perp = c - a * c.dot(a);
+    if (c_perp.length_squared() == 0)
+    {
+        pdf = 0;
+        return a;
+    }
+    auto c_prime = a * cos_b + c_perp.unit() * sin_b;
+
+    //在弧b-c'上按cos均匀采样
+    double cos_theta = 1 - u2 * (1 - c_prime.dot(b));
+    double sin_theta = std::sqrt(std::max(0.0, 1 - cos_theta * cos_theta));
+    auto w_perp = c_prime - b * c_prime.dot(b);
+    if (w_perp.length_squared() == 0)
+    {
+        pdf = 0;
+        return a;
+    }
+
+    pdf = 1 / omega;
+    return b * cos_theta + w_perp.unit() * sin_theta;
 }
 
-Point Triangle::random(RandomGenerator &random_generator) const
+Point Triangle::random(Sampler &sampler) const
 {
-    double r1 = random_generator.get_random_double(0, 1);
-    double r2 = random_generator.get_random_double(0, 1);
+    double r1, r2;
+    sampler.get_2d(r1, r2);
 
     if (r1 + r2 > 1.0)
     {
@@ -96,4 +299,10 @@ Point Triangle::random(RandomGenerator &random_generator) const
     auto edge2 = v2 - v0;
 
     return v0 + edge1 * r1 + edge2 * r2;
+}
+
+Point Triangle::sample_area(Sampler &sampler, Direction &normal) const
+{
+    normal = (v1 - v0).cross(v2 - v0).unit();
+    return random(sampler);
 }
\ No newline at end of file
@@ -0,0 +1,92 @@
+//渲染循环中不应该分配内存：替换全局的operator new，统计render_parallel期间的分配次数
+//先渲染一遍让图像缓冲、采样器这些只分配一次的东西就位，再统计第二遍
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+static std::atomic<long> allocations{0};
+static std::atomic<bool> counting{false};
+
+void *operator new(std::size_t size)
+{
+    if (counting.load(std::memory_order_relaxed))
+    {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+    void *p = std::malloc(size ? size : 1);
+    if (!p)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+#include "camera.hpp"
+#include "material.hpp"
+#include "sphere.hpp"
+#include "triangle.hpp"
+
+#include <iostream>
+
+static long count_render_allocations(int algorithm)
+{
+    auto floor = std::make_shared<Sphere>(Point(0, -1000, 0), 1000, std::make_shared<Lambertian>(Color(125, 125, 125)));
+    auto sphere = std::make_shared<Sphere>(Point(1, 1, -2), 1, std::make_shared<Lambertian>(Color(200, 0, 0)));
+
+    auto light_material = std::make_shared<Lambertian>(Color(255, 255, 255));
+    light_material->set_light_color(Color(10000, 10000, 10000));
+    auto light_sphere = std::make_shared<Sphere>(Point(0, 3, -2), 0.1, light_material);
+    auto light_triangle = std::make_shared<Triangle>(Point(1.75, 2.25, -3), Point(1.75, 2, -3), Point(2, 2, -3), light_material);
+
+    std::vector<std::shared_ptr<Hittable>> objects{floor, sphere, light_sphere, light_triangle};
+    auto world = std::make_shared<HittableList>(objects);
+
+    Camera camera(16.0 / 9.0, 64, 4, 16);
+    camera.set_world(world, {light_sphere, light_triangle});
+    camera.set_algorithm(algorithm);
+
+    camera.render_parallel();
+
+    allocations = 0;
+    counting = true;
+    camera.render_parallel();
+    counting = false;
+
+    return allocations;
+}
+
+int main()
+{
+    int failures = 0;
+
+    const struct
+    {
+        int algorithm;
+        const char *name;
+    } cases[] = {
+        {Algorithm::PathTracing, "PathTracing"},
+        {Algorithm::PathTracingPDF, "PathTracingPDF"},
+    };
+
+    for (const auto &c : cases)
+    {
+        long count = count_render_allocations(c.algorithm);
+        std::cout << c.name << ": " << count << " allocations during render_parallel\n";
+        if (count != 0)
+        {
+            ++failures;
+        }
+    }
+
+    return failures == 0 ? 0 : 1;
+}